@@ -0,0 +1,107 @@
+# bootstrap_bench.tcl -- Logging micro-benchmark
+#
+#	Measure the cost of ::bootstrap::log for each log level while
+#	the log level is warn, so that the lower levels are disabled.
+#	Lines are logged to a file given by its name, to an opened
+#	channel, and to the same channel with buffering switched off
+#	(-buffer 0).  The last column measures logging guarded by
+#	::bootstrap::enabled, as callers should do when formatting
+#	their messages is expensive.  Pass the path to another
+#	directory containing bootstrap.tcl to measure it instead, e.g.
+#	an older version:
+#
+#	tclsh bench/bootstrap_bench.tcl ?libdir? ?iterations?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set libdir [lindex $argv 0]
+if { $libdir eq "" } {
+    set libdir [file dirname [file dirname [info script]]]
+}
+set iterations [lindex $argv 1]
+if { $iterations eq "" } {
+    set iterations 20000
+}
+source [file join $libdir bootstrap.tcl]
+
+if { [info exists env(TMP)] } {
+    set tmpdir $env(TMP)
+} else {
+    set tmpdir /tmp
+}
+set fname [file join $tmpdir bootstrap_bench[pid].log]
+set cname [file join $tmpdir bootstrap_bench[pid].chan]
+set chan [open $cname w]
+
+
+# usecs -- Average time
+#
+#	Evaluate a script a number of times at the global level,
+#	then write all buffered log lines.
+#
+# Arguments:
+#	script	Script to evaluate
+#	n	Number of evaluations
+#
+# Results:
+#	Return the average number of microseconds per evaluation.
+#
+# Side Effects:
+#	Whatever the script does.
+proc usecs { script n } {
+    set t [lindex [uplevel \#0 [list time $script $n]] 0]
+    if { [info commands ::bootstrap::flush] ne "" } {
+	::bootstrap::flush
+    }
+    return $t
+}
+
+
+# Older versions know fewer levels and cannot tell whether a level is
+# enabled, measure what they support.
+set ::bootstrap::BS(loglevel) warn
+set guard [expr {[info commands ::bootstrap::enabled] ne ""}]
+set buffer [info exists ::bootstrap::BS(-buffer)]
+set x 42
+puts [format "%-10s %-4s %10s %10s %10s %10s" \
+	  level on file(us) chan(us) unbuf(us) guard(us)]
+foreach lvl $::bootstrap::BS(levels) {
+    set on [expr {[lsearch $::bootstrap::BS(levels) $lvl] \
+		      >= [lsearch $::bootstrap::BS(levels) warn]}]
+    set ::bootstrap::BS(dft_outfd) $fname
+    set file [usecs {::bootstrap::log $lvl "Item $x at <$x,$x>"} $iterations]
+    set ::bootstrap::BS(dft_outfd) $chan
+    set ch [usecs {::bootstrap::log $lvl "Item $x at <$x,$x>"} $iterations]
+    if { $buffer } {
+	set ::bootstrap::BS(-buffer) 0
+	set unbuf [usecs {::bootstrap::log $lvl "Item $x at <$x,$x>"} \
+		       $iterations]
+	set ::bootstrap::BS(-buffer) 256
+	set unbuf [format %.2f $unbuf]
+    } else {
+	set unbuf -
+    }
+    if { $guard } {
+	set g [format %.2f \
+		   [usecs {
+		       if { [::bootstrap::enabled $lvl] } {
+			   ::bootstrap::log $lvl "Item $x at <$x,$x>"
+		       }
+		   } $iterations]]
+    } else {
+	set g -
+    }
+    puts [format "%-10s %-4s %10.2f %10.2f %10s %10s" \
+	      $lvl [expr {$on ? "yes" : "no"}] $file $ch $unbuf $g]
+}
+
+set ::bootstrap::BS(dft_outfd) stdout
+if { [info exists ::bootstrap::CHANNELS($fname)] } {
+    close $::bootstrap::CHANNELS($fname)
+    unset ::bootstrap::CHANNELS($fname)
+}
+close $chan
+file delete -- $fname $cname
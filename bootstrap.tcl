@@ -30,7 +30,7 @@ namespace eval ::bootstrap {
     variable BS
     if { ! [info exists BS] } {
         array set BS {
-            levels     "debug info notice warn error critical"
+            levels     "debug info notice warn error critical alert emergency"
             loglevel   warn
             dateformat "%d%m%y %H:%M:%S"
             dft_outfd  stdout
@@ -38,13 +38,203 @@ namespace eval ::bootstrap {
             initdone   off
             agu_path   ""
             vbs_path   ""
+            stamp_dt   ""
+            stamp      ""
+            flush      ""
+            tkhook     off
             -maxlinks  10
+            -buffer    256
         }
+        variable LEVELS;   # Log level -> index in BS(levels)
+        array set LEVELS {}
+        set i 0
+        foreach l $BS(levels) {
+            set LEVELS($l) $i
+            incr i
+        }
+        variable CHANNELS; # Descriptor/name given to __out -> channel
+        array set CHANNELS {}
+        variable OWNED;    # Channels opened by __out -> 1
+        array set OWNED {}
+        variable BUFFER;   # Channel -> log lines not yet written
+        array set BUFFER {}
+        variable PENDING;  # Channel -> number of lines in BUFFER
+        array set PENDING {}
+
+        # Write pending log lines before the application goes away.
+        # Closing the main window of wish exits without calling the
+        # exit command, see __tkhook for that case.
+        trace add execution exit enter [list ::bootstrap::__atexit]
     }
     namespace export bootstrap
 }
 
 
+# ::bootstrap::__channel -- Resolve log destination
+#
+#       Return the channel to which log information for a
+#       destination should be written.  The destination is either
+#       an opened file descriptor or the name of a file, in which
+#       case the file is opened in append mode.  Destinations are
+#       resolved once and files are kept opened, so that logging
+#       does not probe nor reopen the destination for every line.
+#
+# Arguments:
+#	fd_nm	File descriptor/name to which to dump
+#
+# Results:
+#	Return the channel, an empty string if the file could not be
+#	opened.
+#
+# Side Effects:
+#	Opens the file when the destination is a file name.
+proc ::bootstrap::__channel { fd_nm } {
+    variable CHANNELS
+    variable OWNED
+
+    if { [info exists CHANNELS($fd_nm)] } {
+        return $CHANNELS($fd_nm)
+    }
+
+    if { [catch {fconfigure $fd_nm}] } {
+        # fconfigure will scream if the variable is not a file
+        # descriptor, in that case, it is a file name!
+        if { [catch {open $fd_nm a+} fd] } {
+            __out bootstrap warn "Cannot open $fd_nm for writing: $fd"
+            return ""
+        }
+        fconfigure $fd -buffering full
+        set OWNED($fd) 1
+    } else {
+        set fd $fd_nm
+    }
+    set CHANNELS($fd_nm) $fd
+
+    return $fd
+}
+
+
+# ::bootstrap::__write -- Write log lines to channel
+#
+#       Write log lines to a channel and flush it.  Channels that
+#       cannot be written to anymore are forgotten (and closed if
+#       they were opened by __channel), so that they are resolved
+#       again at the next log line.
+#
+# Arguments:
+#	fd	Channel to write to
+#	lines	Log lines, newline terminated
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Writes to the channel
+proc ::bootstrap::__write { fd lines } {
+    variable BS
+    variable CHANNELS
+    variable OWNED
+
+    if { [catch {puts -nonewline $fd $lines; ::flush $fd}] } {
+        foreach fd_nm [array names CHANNELS] {
+            if { $CHANNELS($fd_nm) eq $fd } {
+                unset CHANNELS($fd_nm)
+            }
+        }
+        if { [info exists OWNED($fd)] } {
+            unset OWNED($fd)
+            catch {close $fd}
+        }
+        if { $fd ne [__channel $BS(dft_outfd)] } {
+            __out bootstrap warn "Cannot write to log file descriptor $fd!"
+        }
+    }
+}
+
+
+# ::bootstrap::flush -- Write buffered log information
+#
+#       Write all log lines that have been buffered since the last
+#       flush to their destinations.  This is called when idle, when
+#       the buffer of a destination is full, when important lines
+#       are logged and when the application exits, and can also be
+#       called at any time by callers that wish to be sure that
+#       their log information has reached its destination.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Write to the log destinations
+proc ::bootstrap::flush { } {
+    variable BS
+    variable BUFFER
+    variable PENDING
+
+    if { $BS(flush) ne "" } {
+        after cancel $BS(flush)
+        set BS(flush) ""
+    }
+    foreach fd [array names BUFFER] {
+        set lines $BUFFER($fd)
+        unset BUFFER($fd)
+        unset PENDING($fd)
+        __write $fd $lines
+    }
+}
+
+
+# ::bootstrap::__atexit -- Flush log at exit
+#
+#       Write buffered log information when the application exits,
+#       this is installed as an execution trace on exit.
+#
+# Arguments:
+#	args	Arguments from the trace, ignored.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Write to the log destinations
+proc ::bootstrap::__atexit { args } {
+    catch {flush}
+}
+
+
+# ::bootstrap::__tkhook -- Flush log when main window goes away
+#
+#       Arrange for buffered log information to be written when the
+#       main window is destroyed, once Tk has been loaded.  wish
+#       exits when its main window is closed without calling the
+#       exit command, so that the trace on exit is not enough.  The
+#       binding is placed on a bindtag of its own that is only given
+#       to the main window, so that it does not fire for children
+#       and is not replaced by bindings of the application on '.'.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Adds a bindtag to the main window.
+proc ::bootstrap::__tkhook { } {
+    variable BS
+
+    if { [string is false $BS(tkhook)] && [info commands ::winfo] ne "" \
+             && [catch {winfo exists .} exists] == 0 && $exists } {
+        bind BootstrapLog <Destroy> [list ::bootstrap::__atexit]
+        bindtags . [linsert [bindtags .] 0 BootstrapLog]
+        set BS(tkhook) on
+    }
+}
+
+
 # ::bootstrap::__out -- Output log information to console
 #
 #       This command dumps log information to an opened file
@@ -52,7 +242,10 @@ namespace eval ::bootstrap {
 #       case it will append the log string to the file.  The
 #       implementation of fix_outlog sees to re-route all log dumping
 #       from the logger module to this command, that will, as such,
-#       act as a central hub.
+#       act as a central hub.  Log lines are buffered in memory and
+#       written when idle, at most -buffer lines at a time, except
+#       for errors and above that are written at once.  Setting
+#       -buffer to 0 writes every line as it comes.
 #
 # Arguments:
 #	service	Name of the logger service
@@ -68,41 +261,76 @@ namespace eval ::bootstrap {
 #	Dump to the file descriptor
 proc ::bootstrap::__out { service level str { dt "" } { fd_nm "" } } {
     variable BS
-    
-    # Store current date in right format
+    variable LEVELS
+    variable BUFFER
+    variable PENDING
+
+    # Store current date in right format, this only changes once per
+    # second at most.
     if { $dt eq "" } {
         set dt [clock seconds]
     }
-    set logdt [clock format $dt -format $BS(dateformat)]
-    
-    # Now guess if fd_nm is a file descriptor or the name of a
-    # file. If it is a file name, try to open it.
+    if { $dt != $BS(stamp_dt) } {
+        set BS(stamp) [clock format $dt -format $BS(dateformat)]
+        set BS(stamp_dt) $dt
+    }
+
+    # Now resolve where to output the string.  The channel can be
+    # empty if we could not open the file when the input was a file
+    # name.
     if { $fd_nm eq "" } {
         set fd_nm $BS(dft_outfd)
     }
-    if { [catch {fconfigure $fd_nm}] } {
-        # fconfigure will scream if the variable is not a file
-        # descriptor, in that case, it is a file name!
-        if { [catch {open $fd_nm a+} fd] } {
-            __out bootstrap warn "Cannot open $fd_nm for writing: $fd"
-            set fd ""
-        }
-    } else {
-        set fd $fd_nm
+    set fd [__channel $fd_nm]
+    if { $fd eq "" } {
+        return
     }
-    
-    # Now that we are here, fd contains where to output the string.
-    # It can be empty if we could not open the file when the input was
-    # a file name.
-    if { $fd ne "" } {
-        if { [catch {puts $fd "\[$logdt\] \[$service\] \[$level\] '$str'"}] } {
-            __out bootstrap warn "Cannot write to log file descriptor $fd!"
-        }
-        if { $fd ne $fd_nm } {
-            # Close the output file if the parameter was a name.
-            close $fd
-        }
+
+    set line "\[$BS(stamp)\] \[$service\] \[$level\] '$str'\n"
+    if { $BS(-buffer) <= 0 } {
+        __write $fd $line
+        return
+    }
+    append BUFFER($fd) $line
+    if { [incr PENDING($fd)] >= $BS(-buffer) \
+             || ( [info exists LEVELS($level)] \
+                      && $LEVELS($level) >= $LEVELS(error) ) } {
+        flush
+    } elseif { $BS(flush) eq "" } {
+        set BS(flush) [after idle ::bootstrap::flush]
+        __tkhook
+    }
+}
+
+
+# ::bootstrap::enabled -- Check if a log level is enabled
+#
+#       This command checks whether information at a given level
+#       would be logged, so that callers can skip formatting
+#       expensive log messages altogether.  The check is made
+#       against the level of the bootstrap library or against the
+#       level of a logger service.
+#
+# Arguments:
+#	lvl	Log level to check
+#	log	Logger service command prefix, empty for this library
+#
+# Results:
+#	Return 1 if information at that level would be logged, 0
+#	otherwise.
+#
+# Side Effects:
+#	None.
+proc ::bootstrap::enabled { lvl { log "" } } {
+    variable BS
+    variable LEVELS
+
+    if { $log eq "" } {
+        set current $BS(loglevel)
+    } else {
+        set current [${log}::currentloglevel]
     }
+    return [expr {$LEVELS($lvl) >= $LEVELS($current)}]
 }
 
 
@@ -125,11 +353,10 @@ proc ::bootstrap::__out { service level str { dt "" } { fd_nm "" } } {
 #	Will possibly create a new logger service.
 proc ::bootstrap::log { lvl str } {
     variable BS
-    
-    set au_lvl [lsearch $BS(levels) $BS(loglevel)]
-    set cur_lvl [lsearch $BS(levels) $lvl]
-    if { $cur_lvl >= $au_lvl } {
-        __out bootstrap debug $str
+    variable LEVELS
+
+    if { $LEVELS($lvl) >= $LEVELS($BS(loglevel)) } {
+        __out bootstrap $lvl $str
     }
 }
 
@@ -0,0 +1,45 @@
+# event_bench.tcl -- Event dispatch micro-benchmark
+#
+#	Measure how many events per second ::event::trigger and
+#	::event::generate deliver to an object, as a function of the
+#	number of bindings of the object.  One binding in ten is a glob
+#	pattern, the others are exact event names.  The triggered
+#	event matches one exact binding and none of the glob patterns.
+#	Pass the path to another copy of the event library to measure
+#	it instead, e.g. an older version:
+#
+#	tclsh bench/event_bench.tcl ?libdir? ?iterations?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set libdir [lindex $argv 0]
+if { $libdir eq "" } {
+    set libdir [file join [file dirname [file dirname [info script]]] event]
+}
+set iterations [lindex $argv 1]
+if { $iterations eq "" } {
+    set iterations 2000
+}
+source [file join $libdir event.tcl]
+
+proc sink { args } {}
+
+puts [format "%-10s %14s %14s" bindings trigger/s generate/s]
+foreach n { 10 100 500 1000 } {
+    ::event::clean bench
+    for { set i 0 } { $i < $n } { incr i } {
+	if { $i % 10 == 0 } {
+	    ::event::bind bench Evt$i* [list sink $i]
+	} else {
+	    ::event::bind bench Evt$i [list sink $i]
+	}
+    }
+    set t [lindex [time {::event::trigger bench Evt5 a b} $iterations] 0]
+    set g [lindex [time {::event::generate bench Evt5 {a b}} $iterations] 0]
+    puts [format "%-10d %14d %14d" $n [expr {int(1e6 / $t)}] \
+	      [expr {int(1e6 / $g)}]]
+}
+::event::clean bench
@@ -22,6 +22,11 @@
 ##    will always be replaced by, respectively the event (string) and
 ##    the object.
 ##
+##    Events of the first type can also be posted, in which case they
+##    are queued and delivered in batches from the event loop.
+##    Successive posts of the same event on the same object can be
+##    coalesced according to a policy.
+##
 ## Commands Exported:
 ##      ::event::bind
 ##      ::event::clean
@@ -29,6 +34,9 @@
 ##      ::event::generate
 ##      ::event::bindings
 ##      ::event::objects
+##      ::event::post
+##      ::event::policy
+##      ::event::stats
 ##################
 
 package require Tcl 8.4
@@ -40,9 +48,23 @@ namespace eval ::event {
     variable EVENT
     if { ![info exists EVENT] } {
 	array set EVENT {
+	    -cachesize   256
+	    -queuesize   1024
+	    scheduled    ""
+	    posts        0
+	    posted       0
+	    delivered    0
+	    coalesced    0
+	    dropped      0
 	}
+	variable QUEUE [list]; # Keys of posted events, in delivery order
+	variable POSTED;       # Key -> {object event arguments count}
+	array set POSTED {}
+	variable POLICIES;     # {object event} -> coalescing policy
+	array set POLICIES {}
 	variable libdir [file dirname [file normalize [info script]]]
 	::uobj::install_log event EVENT
+	::uobj::install_defaults event EVENT
     }
 }
 
@@ -76,6 +98,152 @@ proc ::event::__tobindings { obj } {
 
 
 
+# ::event::__entry -- Index a binding
+#
+#       This procedure adds a binding to the dispatch index of an
+#       object.  Patterns without any glob-style special characters
+#       are placed in a bucket indexed by the name of the event,
+#       while other patterns are kept in a list that will only be
+#       matched when a new event name is seen.  Commands that are
+#       made of plain words are kept as pre-split lists, so that they
+#       can be invoked without being reparsed.  Commands that need
+#       substitutions (or are made of several commands) are marked
+#       so that they are evaluated as before.
+#
+# Arguments:
+#       bindings	Name of internal storage variable for the object
+#       seq	Position of the binding, used for ordering
+#       ptn	Event pattern
+#       cmd	Command bound to the pattern
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Flushes the dispatch cache of the object.
+proc ::event::__entry { bindings seq ptn cmd } {
+    upvar \#0 $bindings BINDINGS
+
+    if { [regexp {[$\[\];\n\\]} $cmd] || [catch {llength $cmd}] \
+	     || [string index [string trimleft $cmd] 0] eq "#" } {
+	set call ""
+    } else {
+	set call [lrange $cmd 0 end]
+    }
+    set entry [list $seq $ptn $cmd $call]
+    if { [regexp {[*?\[\\]} $ptn] } {
+	lappend BINDINGS(globs) $entry
+    } else {
+	lappend BINDINGS(exact,$ptn) $entry
+    }
+    __flush $bindings
+}
+
+
+
+# ::event::__index -- (Re)build the dispatch index of an object
+#
+#       This procedure rebuilds the whole dispatch index of an
+#       object out of its ordered list of bindings.
+#
+# Arguments:
+#       bindings	Name of internal storage variable for the object
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::event::__index { bindings } {
+    upvar \#0 $bindings BINDINGS
+
+    array unset BINDINGS exact,*
+    set BINDINGS(globs) [list]
+    set seq 0
+    foreach { ptn cmd } $BINDINGS(bindings) {
+	__entry $bindings $seq $ptn $cmd
+	incr seq
+    }
+}
+
+
+
+# ::event::__flush -- Flush dispatch cache of an object
+#
+#       This procedure empties the cache of dispatch lists of an
+#       object.
+#
+# Arguments:
+#       bindings	Name of internal storage variable for the object
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::event::__flush { bindings } {
+    upvar \#0 $bindings BINDINGS
+
+    array unset BINDINGS cache,*
+    set BINDINGS(cached) 0
+}
+
+
+
+# ::event::__dispatch -- Bindings matching an event
+#
+#       This procedure returns the index entries of all the bindings
+#       of an object that match an event, in the order in which they
+#       were bound.  The exact bucket for the event and the glob
+#       patterns are merged once per event name, the result being
+#       cached until bindings change.  The cache is bounded by
+#       -cachesize event names.
+#
+# Arguments:
+#       bindings	Name of internal storage variable for the object
+#       evt	Name of the event
+#
+# Results:
+#       Return a list of index entries, see __entry.
+#
+# Side Effects:
+#       None.
+proc ::event::__dispatch { bindings evt } {
+    variable EVENT
+    upvar \#0 $bindings BINDINGS
+
+    if { [info exists BINDINGS(cache,$evt)] } {
+	return $BINDINGS(cache,$evt)
+    }
+
+    if { [info exists BINDINGS(exact,$evt)] } {
+	set entries $BINDINGS(exact,$evt)
+    } else {
+	set entries [list]
+    }
+    set merge [llength $entries]
+    set globs 0
+    foreach entry $BINDINGS(globs) {
+	if { [string match [lindex $entry 1] $evt] } {
+	    lappend entries $entry
+	    incr globs
+	}
+    }
+    if { $merge && $globs } {
+	set entries [lsort -integer -index 0 $entries]
+    }
+
+    if { $BINDINGS(cached) >= $EVENT(-cachesize) } {
+	__flush $bindings
+    }
+    set BINDINGS(cache,$evt) $entries
+    incr BINDINGS(cached)
+
+    return $entries
+}
+
+
+
 # ::event::bind -- Bind a command to an event pattern on an object.
 #
 #       This procedure adds a binding for an event pattern on an
@@ -83,7 +251,8 @@ proc ::event::__tobindings { obj } {
 #       commands that match the object and the pattern bound in this
 #       procedure will be called.  The module guarantees that events
 #       will be called in the order that they have been bound to a
-#       given object.
+#       given object.  The binding is indexed for fast dispatch, see
+#       __entry.
 #
 # Arguments:
 #       obj	Identifier of an object
@@ -103,8 +272,12 @@ proc ::event::bind { obj ptn cmd } {
     if { ! [info exists $bindings] } {
 	set BINDINGS(object) $obj;     # Object target for the binding
 	set BINDINGS(bindings) [list]; # Initial bindings.
+	set BINDINGS(globs) [list];    # Index entries for glob patterns
+	set BINDINGS(cached) 0;        # Number of cached dispatch lists
     }
     lappend BINDINGS(bindings) $ptn $cmd
+    __entry $bindings [expr {[llength $BINDINGS(bindings)] / 2 - 1}] \
+	$ptn $cmd
     ${log}::info "Added \"$cmd\" binding for events matching $ptn on $obj"
 
     return [expr {[llength $BINDINGS(bindings)] / 2}]
@@ -151,6 +324,8 @@ proc ::event::clean { obj { ptn * } { cmdptn * } } {
 	if { [llength $BINDINGS(bindings)] == 0 } {
 	    ${log}::debug "All bindings for $obj clean, removing internal state"
 	    unset $bindings
+	} elseif { $removed > 0 } {
+	    __index $bindings
 	}
     }
 
@@ -258,14 +433,23 @@ proc ::event::trigger { obj evt args } {
 
     set triggered 0
     if { [info exists $bindings] } {
-	foreach {ptn cmd} $BINDINGS(bindings) {
-	    if { [string match $ptn $evt] } {
-		if { [catch {eval $cmd $obj $evt $args} res] } {
-		    ${log}::warn "Error when invoking action '$cmd' bound to\
-                                  event '$evt' on $obj: $res"
-		} else {
-		    incr triggered;  # Account as triggered
+	foreach entry [__dispatch $bindings $evt] {
+	    foreach {seq ptn cmd call} $entry break
+	    if { $call eq "" } {
+		set code [catch {eval $cmd $obj $evt $args} res]
+	    } else {
+		# Pure list, evaluated without being reparsed.
+		lappend call $obj $evt
+		foreach a $args {
+		    lappend call $a
 		}
+		set code [catch {eval $call} res]
+	    }
+	    if { $code } {
+		${log}::warn "Error when invoking action '$cmd' bound to\
+                              event '$evt' on $obj: $res"
+	    } else {
+		incr triggered;  # Account as triggered
 	    }
 	}
     }
@@ -306,31 +490,31 @@ proc ::event::generate { obj evt { arglist {}} } {
 
     set triggered 0
     if { [info exists $bindings] } {
-	foreach {ptn cmd} $BINDINGS(bindings) {
-	    if { [string match $ptn $evt] } {
-		# Construct internal forced mapping, and refuse
-		# non-standard mappings.
-		set argmap [list %% % %e $evt %o $obj]
-		foreach {k v} $arglist {
-		    if { [string index $k 0] ne "%" } {
-			${log}::warn "$k does not start with a % in the\
-                                      event mapping, ignoring!"
-		    } else {
-			lappend argmap $k $v
-		    }
-		}
-
-		# Map command using constucted mapping and evaluate
-		set cmd [string map $argmap $cmd]
-		${log}::debug "Invoking bound command '$cmd' for event '$evt'\
-                               on $obj"
-		if { [catch {eval $cmd} res] } {
-		    ${log}::warn "Error when invoking action '$cmd' bound to\
-                                  event '$evt' on $obj: $res"
+	foreach entry [__dispatch $bindings $evt] {
+	    set cmd [lindex $entry 2]
+
+	    # Construct internal forced mapping, and refuse
+	    # non-standard mappings.
+	    set argmap [list %% % %e $evt %o $obj]
+	    foreach {k v} $arglist {
+		if { [string index $k 0] ne "%" } {
+		    ${log}::warn "$k does not start with a % in the\
+                                  event mapping, ignoring!"
 		} else {
-		    incr triggered;  # Account as triggered.
+		    lappend argmap $k $v
 		}
 	    }
+
+	    # Map command using constucted mapping and evaluate
+	    set cmd [string map $argmap $cmd]
+	    ${log}::debug "Invoking bound command '$cmd' for event '$evt'\
+                           on $obj"
+	    if { [catch {eval $cmd} res] } {
+		${log}::warn "Error when invoking action '$cmd' bound to\
+                              event '$evt' on $obj: $res"
+	    } else {
+		incr triggered;  # Account as triggered.
+	    }
 	}
     }
 
@@ -338,4 +522,190 @@ proc ::event::generate { obj evt { arglist {}} } {
 }
 
 
+
+# ::event::policy -- Get/set coalescing policy of posted events
+#
+#       This procedure gets or sets the policy that is used to
+#       coalesce events of a given name on a given object, when these
+#       are posted, i.e. when several such events are posted before
+#       they have been delivered.  The policies are: none, all posted
+#       events are delivered (the default); latest, only the latest
+#       event is delivered, with its arguments; count, only the
+#       latest event is delivered, with the number of events that it
+#       replaces appended to its arguments; merge, a single event is
+#       delivered, with the arguments of all events, in order.
+#       Coalesced events keep the position in the queue of the first
+#       event that was posted.
+#
+# Arguments:
+#       obj	Identifier of the object
+#       evt	Name of the event
+#       policy	New policy, empty to get the current policy.
+#
+# Results:
+#       Return the current policy.
+#
+# Side Effects:
+#       None.
+proc ::event::policy { obj evt { policy "" } } {
+    variable POLICIES
+    variable log
+
+    set key [list $obj $evt]
+    switch -- $policy {
+	"" {
+	}
+	none {
+	    catch {unset POLICIES($key)}
+	}
+	latest -
+	count -
+	merge {
+	    set POLICIES($key) $policy
+	}
+	default {
+	    return -code error "Unknown policy $policy, should be none,\
+                                latest, count or merge"
+	}
+    }
+
+    if { [info exists POLICIES($key)] } {
+	return $POLICIES($key)
+    }
+    return none
+}
+
+
+
+# ::event::post -- Post an event, first type of event.
+#
+#       This procedure queues an event of the first type for later
+#       delivery.  All queued events are delivered in one batch from
+#       the event loop, in the order in which they were posted, using
+#       trigger.  Successive events with the same name on the same
+#       object are coalesced according to their policy, see policy.
+#       The queue is bounded to -queuesize events, further events
+#       (that cannot be coalesced) are dropped.
+#
+# Arguments:
+#       obj	Identifier of the object on which the event occurs.
+#       evt	Name of the event that occurs
+#       args	Further arguments to the event passed blindly to the command
+#
+# Results:
+#       Return 1 if the event was queued or coalesced, 0 if it was
+#       dropped.
+#
+# Side Effects:
+#       Schedules delivery of the queue.
+proc ::event::post { obj evt args } {
+    variable EVENT
+    variable QUEUE
+    variable POSTED
+    variable POLICIES
+    variable log
+
+    incr EVENT(posted)
+    set key [list $obj $evt]
+    if { [info exists POLICIES($key)] && [info exists POSTED($key)] } {
+	foreach {o e a count} $POSTED($key) break
+	switch -- $POLICIES($key) {
+	    latest -
+	    count {
+		set a $args
+	    }
+	    merge {
+		foreach arg $args {
+		    lappend a $arg
+		}
+	    }
+	}
+	set POSTED($key) [list $obj $evt $a [incr count]]
+	incr EVENT(coalesced)
+	return 1
+    }
+
+    if { [llength $QUEUE] >= $EVENT(-queuesize) } {
+	incr EVENT(dropped)
+	${log}::debug "Event queue full, dropping $evt on $obj"
+	return 0
+    }
+    if { ![info exists POLICIES($key)] } {
+	set key "#[incr EVENT(posts)]"
+    }
+    set POSTED($key) [list $obj $evt $args 1]
+    lappend QUEUE $key
+
+    if { $EVENT(scheduled) eq "" } {
+	set EVENT(scheduled) [after idle [namespace current]::__deliver]
+    }
+    return 1
+}
+
+
+
+# ::event::__deliver -- Deliver posted events
+#
+#       This procedure delivers all the events that have been posted
+#       since the last delivery.  Events that are posted during
+#       delivery will be delivered in the next batch.
+#
+# Arguments:
+#       None.
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Triggers the commands bound to the events.
+proc ::event::__deliver {} {
+    variable EVENT
+    variable QUEUE
+    variable POSTED
+    variable POLICIES
+    variable log
+
+    set EVENT(scheduled) ""
+    set queue $QUEUE
+    array set batch [array get POSTED]
+    set QUEUE [list]
+    array unset POSTED
+
+    ${log}::debug "Delivering [llength $queue] posted event(s)"
+    foreach key $queue {
+	foreach {obj evt a count} $batch($key) break
+	if { [info exists POLICIES($key)] && $POLICIES($key) eq "count" } {
+	    lappend a $count
+	}
+	eval [linsert $a 0 trigger $obj $evt]
+	incr EVENT(delivered)
+    }
+}
+
+
+
+# ::event::stats -- Statistics of posted events
+#
+#       This procedure returns statistics about posted events.
+#
+# Arguments:
+#       None.
+#
+# Results:
+#       Return an even list with the number of events that were
+#       posted, delivered, coalesced and dropped, followed by the
+#       number of events currently queued.
+#
+# Side Effects:
+#       None.
+proc ::event::stats {} {
+    variable EVENT
+    variable QUEUE
+
+    return [list posted $EVENT(posted) delivered $EVENT(delivered) \
+		coalesced $EVENT(coalesced) dropped $EVENT(dropped) \
+		queued [llength $QUEUE]]
+}
+
+
 package provide event 0.1
\ No newline at end of file
@@ -2,7 +2,9 @@
 #
 #	This module provides a replacement for the update command so
 #	that callers can call it as much as they want and so that the
-#	real update command is only called once in a while.
+#	real update command is only called once in a while.  It also
+#	provides a cooperative scheduler for long jobs, which are run
+#	in slices that are interleaved with the event loop.
 #
 # Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
 #
@@ -22,10 +24,17 @@ namespace eval ::flexupdate {
 	    installed         0
 	    lastupdate        0
 	    lastidle          0
+	    idgene            0
+	    armed             0
+	    coroutines        0
 	    -triggeridle      0
 	    -trigger          75
 	    -fallback         off
+	    -budget           20
 	}
+	variable TASKS;    # Identifiers of tasks, least recently run first
+	set TASKS [list]
+	set UPD(coroutines) [llength [info commands ::coroutine]]
 	variable libdir [file dirname [file normalize [info script]]]
 	::uobj::install_log flexupdate UPD; # Creates log namespace variable
 	::uobj::install_defaults flexupdate UPD; # Creates defaults procedure
@@ -162,4 +171,457 @@ proc ::flexupdate::release {} {
     return $UPD(installed)
 }
 
+
+# ::flexupdate::__now -- Current time
+#
+#	Return the current time in microseconds, for task accounting.
+#	Tcl 8.4 only has millisecond precision.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Current time, in microseconds
+#
+# Side Effects:
+#	None.
+if { [catch {clock microseconds}] } {
+    proc ::flexupdate::__now {} {
+	return [expr {wide([clock clicks -milliseconds]) * 1000}]
+    }
+} else {
+    proc ::flexupdate::__now {} {
+	return [clock microseconds]
+    }
+}
+
+
+# ::flexupdate::task -- Create a task
+#
+#	Create a cooperative task out of a long job.  Tasks are run in
+#	slices from the event loop, see __slice.  A task is either a
+#	step command or a coroutine.  Step commands are called again
+#	and again at the global level and should perform a small part
+#	of the job each time, returning true as long as there is work
+#	left.  Coroutines (Tcl 8.6 and later) run the command once, in
+#	a coroutine, and the command should call ::flexupdate::yield
+#	every now and then to give control back.  The options are:
+#	-priority  Tasks with a higher priority run first (default 0)
+#	-coroutine Run command in a coroutine rather than as steps
+#	-done      Command called with the identifier of the task once
+#	           it has ended.
+#
+# Arguments:
+#	cmd	Step command or coroutine body command
+#	args	Dash-led options and their values, see above
+#
+# Results:
+#	Return an identifier for the task.
+#
+# Side Effects:
+#	Arranges for the scheduler to run.
+proc ::flexupdate::task { cmd args } {
+    variable UPD
+    variable TASKS
+    variable log
+
+    set id task#[incr UPD(idgene)]
+    set varname ::flexupdate::Task_[string range $id 5 end]
+    upvar \#0 $varname TASK
+    array set TASK {
+	-priority    0
+	-coroutine   off
+	-done        ""
+    }
+    foreach {opt val} $args {
+	if { ![info exists TASK($opt)] } {
+	    unset TASK
+	    return -code error "Unknown option $opt, should be\
+                                [join [lsort [array names TASK -*]] {, }]"
+	}
+	set TASK($opt) $val
+    }
+    if { [string is true $TASK(-coroutine)] && !$UPD(coroutines) } {
+	unset TASK
+	return -code error "Coroutines are not available in this interpreter"
+    }
+    set TASK(id) $id
+    set TASK(cmd) $cmd
+    set TASK(state) ready
+    set TASK(steps) 0
+    set TASK(runtime) 0
+    set TASK(created) [__now]
+    set TASK(coro) ""
+    lappend TASKS $id
+    ${log}::debug "Created task $id at priority $TASK(-priority): $cmd"
+    __arm
+
+    return $id
+}
+
+
+# ::flexupdate::__arm -- Schedule next slice
+#
+#	Arrange for the scheduler to run a slice once the application
+#	is idle, as long as there are tasks ready to run.  Slices are
+#	scheduled as a timer from within an idle callback, so that
+#	pending events and redraws get through between slices.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::__arm {} {
+    variable UPD
+
+    if { ! $UPD(armed) && [__pick] ne "" } {
+	set UPD(armed) 1
+	after idle [list after 0 ::flexupdate::__slice]
+    }
+}
+
+
+# ::flexupdate::__pick -- Pick next task to run
+#
+#	Pick the ready task with the highest priority, tasks of the
+#	same priority are picked in a round-robin fashion.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return the identifier of the task, empty if none is ready.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::__pick {} {
+    variable TASKS
+
+    set best ""
+    foreach id $TASKS {
+	upvar \#0 ::flexupdate::Task_[string range $id 5 end] TASK
+	if { $TASK(state) eq "ready" } {
+	    if { $best eq "" || $TASK(-priority) > $prio } {
+		set best $id
+		set prio $TASK(-priority)
+	    }
+	}
+    }
+    return $best
+}
+
+
+# ::flexupdate::__slice -- Run a slice of tasks
+#
+#	Run steps of the tasks that are ready, highest priority first,
+#	until the time budget of the slice (the -budget option, in
+#	milliseconds) is spent.  The CPU time spent in each step is
+#	accounted to its task.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Runs task steps.
+proc ::flexupdate::__slice {} {
+    variable UPD
+    variable TASKS
+    variable log
+
+    set UPD(armed) 0
+    set start [__now]
+    set budget [expr {$UPD(-budget) * 1000}]
+    while { [set id [__pick]] ne "" } {
+	upvar \#0 ::flexupdate::Task_[string range $id 5 end] TASK
+
+	# Move task last, for round-robin.
+	set idx [lsearch -exact $TASKS $id]
+	set TASKS [lreplace $TASKS $idx $idx]
+	lappend TASKS $id
+
+	set before [__now]
+	if { [string is true $TASK(-coroutine)] } {
+	    if { $TASK(coro) eq "" } {
+		set TASK(coro) ::flexupdate::__coro[string range $id 5 end]
+		set code [catch {coroutine $TASK(coro) \
+				     ::flexupdate::__body $id} more]
+	    } else {
+		set code [catch {$TASK(coro)} more]
+	    }
+	    if { $code == 0 && [info exists TASK(id)] } {
+		set more [llength [info commands $TASK(coro)]]
+	    }
+	} else {
+	    set code [catch {uplevel \#0 $TASK(cmd)} more]
+	}
+	set now [__now]
+
+	# The step might have cancelled its own task.
+	if { ! [info exists TASK(id)] } {
+	    if { $code } {
+		${log}::warn "Error in cancelled task $id: $more"
+	    }
+	    if { $now - $start >= $budget } {
+		break
+	    }
+	    continue
+	}
+	incr TASK(steps)
+	incr TASK(runtime) [expr {$now - $before}]
+
+	if { $code } {
+	    ${log}::warn "Error in task $id, ending it: $more"
+	    __end $id
+	} elseif { ! [string is true -strict $more] } {
+	    ${log}::debug "Task $id done after $TASK(steps) steps,\
+                           [expr {$TASK(runtime) / 1000}] ms"
+	    __end $id
+	}
+	if { $now - $start >= $budget } {
+	    break
+	}
+    }
+    __arm
+}
+
+
+# ::flexupdate::__body -- Run coroutine task
+#
+#	Body of the coroutines in which coroutine tasks run.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Runs the command of the task.
+proc ::flexupdate::__body { id } {
+    upvar \#0 ::flexupdate::Task_[string range $id 5 end] TASK
+
+    uplevel \#0 $TASK(cmd)
+}
+
+
+# ::flexupdate::__end -- End a task
+#
+#	Forget about a task and tell the caller that it has ended.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Calls the -done command of the task.
+proc ::flexupdate::__end { id } {
+    variable TASKS
+    variable log
+
+    set varname ::flexupdate::Task_[string range $id 5 end]
+    upvar \#0 $varname TASK
+
+    set idx [lsearch -exact $TASKS $id]
+    if { $idx >= 0 } {
+	set TASKS [lreplace $TASKS $idx $idx]
+    }
+    if { $TASK(coro) ne "" && [llength [info commands $TASK(coro)]] } {
+	if { [info coroutine] eq $TASK(coro) } {
+	    # Cancelled from within itself: the coroutine cannot be
+	    # deleted while running, do it once it has given control
+	    # back.
+	    after idle [list catch [list rename $TASK(coro) {}]]
+	} else {
+	    rename $TASK(coro) {}
+	}
+    }
+    set done $TASK(-done)
+    unset TASK
+    if { $done ne "" } {
+	if { [catch {uplevel \#0 $done [list $id]} err] } {
+	    ${log}::warn "Error when delivering end of task $id: $err"
+	}
+    }
+}
+
+
+# ::flexupdate::yield -- Give control back to the scheduler
+#
+#	Give control back to the scheduler from within a coroutine
+#	task, the task will be resumed at a later slice.  Outside of
+#	coroutine tasks, this is the same as (flexible) update
+#	idletasks, so that long jobs can call it in all cases.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Suspends the current coroutine task.
+proc ::flexupdate::yield {} {
+    variable UPD
+
+    if { $UPD(coroutines) \
+	     && [string match ::flexupdate::__coro* [info coroutine]] } {
+	::yield 1
+    } else {
+	update idletasks
+    }
+}
+
+
+# ::flexupdate::__task -- Access task
+#
+#	Link to the state of a task, failing if it does not exist.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Creates a TASK variable in the caller's scope.
+proc ::flexupdate::__task { id } {
+    set varname ::flexupdate::Task_[string range $id 5 end]
+    if { [string first task# $id] != 0 || ![info exists $varname] } {
+	return -code error "$id is not a known task"
+    }
+    uplevel 1 [list upvar \#0 $varname TASK]
+}
+
+
+# ::flexupdate::cancel -- Cancel a task
+#
+#	Cancel a task, its -done command is called.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::cancel { id } {
+    __task $id
+    __end $id
+}
+
+
+# ::flexupdate::pause -- Pause a task
+#
+#	Stop running a task until it is resumed.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::pause { id } {
+    __task $id
+    set TASK(state) paused
+}
+
+
+# ::flexupdate::resume -- Resume a task
+#
+#	Resume a task that was paused.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Arranges for the scheduler to run.
+proc ::flexupdate::resume { id } {
+    __task $id
+    set TASK(state) ready
+    __arm
+}
+
+
+# ::flexupdate::priority -- Get or set task priority
+#
+#	Return the priority of a task, possibly changing it first.
+#
+# Arguments:
+#	id	Identifier of task
+#	prio	New priority, empty to leave unchanged
+#
+# Results:
+#	Return the priority of the task.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::priority { id { prio "" } } {
+    __task $id
+    if { $prio ne "" } {
+	set TASK(-priority) $prio
+    }
+    return $TASK(-priority)
+}
+
+
+# ::flexupdate::tasks -- List tasks
+#
+#	Return the identifiers of all tasks that have not ended.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	List of task identifiers.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::tasks {} {
+    variable TASKS
+
+    return [lsort -dictionary $TASKS]
+}
+
+
+# ::flexupdate::taskinfo -- Task accounting
+#
+#	Return information about a task: its command, priority and
+#	state (ready or paused), the number of steps run, the time
+#	spent running these steps (runtime) and the time elapsed since
+#	the task was created, both in milliseconds.  Times are wall
+#	clock times, the runtime of a step that waits (e.g. for I/O)
+#	includes the wait.
+#
+# Arguments:
+#	id	Identifier of task
+#
+# Results:
+#	Return an even list of keys and values.
+#
+# Side Effects:
+#	None.
+proc ::flexupdate::taskinfo { id } {
+    __task $id
+    return [list command $TASK(cmd) priority $TASK(-priority) \
+		state $TASK(state) steps $TASK(steps) \
+		runtime [format %.3f [expr {$TASK(runtime) / 1000.0}]] \
+		elapsed [format %.3f \
+			     [expr {([__now] - $TASK(created)) / 1000.0}]]]
+}
+
 package provide flexupdate 0.1
@@ -0,0 +1,393 @@
+# frameclock.tcl -- Shared animation clock
+#
+#	This module implements a frame scheduler that is shared by all
+#	the animations of an application.  Animation steps are
+#	scheduled in a way similar to after, but are run at the next
+#	frame of a clock that ticks at a target frame rate, all with
+#	the same timestamp.  Configuration changes can be deferred to
+#	the end of the frame, where successive changes to the same
+#	target are coalesced so that only the last one is applied
+#	before Tk redraws when idle.  Frames that could not be run on
+#	time because of load are skipped rather than run late.
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+package require Tcl 8.4
+
+package require uobj
+
+namespace eval ::frameclock {
+    variable FC
+    if { ! [info exists FC] } {
+	array set FC {
+	    idgene       0
+	    timer        ""
+	    slot         ""
+	    now          ""
+	    origin       ""
+	    frames       0
+	    skipped      0
+	    steps        0
+	    deferred     0
+	    coalesced    0
+	    worktime     0
+	    maxtime      0
+	    -rate        25
+	}
+	variable STEPS;    # Identifier -> {due command}
+	array set STEPS {}
+	variable PENDING;  # Key -> command to run at end of frame
+	array set PENDING {}
+	variable ORDER;    # Keys of PENDING, in order of first deferral
+	set ORDER [list]
+	::uobj::install_log frameclock FC; # Creates log namespace variable
+	::uobj::install_defaults frameclock FC; # Creates defaults procedure
+    }
+}
+
+
+# ::frameclock::period -- Frame period
+#
+#	Return the period of the clock, as computed from its target
+#	frame rate (the -rate option).
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Number of milliseconds between two frames.
+#
+# Side Effects:
+#	None.
+proc ::frameclock::period { } {
+    variable FC
+
+    set period [expr {int(1000.0 / $FC(-rate))}]
+    if { $period < 1 } {
+	set period 1
+    }
+    return $period
+}
+
+
+# ::frameclock::now -- Current time
+#
+#	Return the current time.  During a frame, this is the
+#	timestamp of the frame, so that all animation steps of a frame
+#	share the same notion of time.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Current time, in milliseconds.
+#
+# Side Effects:
+#	None.
+proc ::frameclock::now { } {
+    variable FC
+
+    if { $FC(now) ne "" } {
+	return $FC(now)
+    }
+    return [clock clicks -milliseconds]
+}
+
+
+# ::frameclock::__arm -- Schedule next frame
+#
+#	Arrange for the clock to tick at the first frame at which a
+#	step is due.  Frames are aligned on a grid that starts when
+#	the clock starts ticking, and the clock stops ticking when
+#	there is nothing to do.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::frameclock::__arm { } {
+    variable FC
+    variable STEPS
+    variable ORDER
+
+    # Nothing to do while a frame is running, the frame will arm
+    # again when done.
+    if { $FC(now) ne "" } {
+	return
+    }
+
+    set now [clock clicks -milliseconds]
+    if { [llength $ORDER] > 0 } {
+	set due $now
+    } else {
+	set due ""
+	foreach id [array names STEPS] {
+	    set when [lindex $STEPS($id) 0]
+	    if { $due eq "" || $when < $due } {
+		set due $when
+	    }
+	}
+	if { $due eq "" } {
+	    # Nothing to animate anymore, stop ticking.
+	    if { $FC(timer) ne "" } {
+		after cancel $FC(timer)
+		set FC(timer) ""
+	    }
+	    set FC(slot) ""
+	    set FC(origin) ""
+	    return
+	}
+    }
+
+    # Align on the frame grid, (re)starting the grid when the clock
+    # was not ticking.
+    set period [period]
+    if { $FC(origin) eq "" } {
+	set FC(origin) $now
+    }
+    if { $due < $now } {
+	set due $now
+    }
+    set slot [expr {$FC(origin) \
+			+ (($due - $FC(origin) + $period - 1) / $period) \
+			* $period}]
+
+    if { $FC(timer) ne "" } {
+	if { $slot >= $FC(slot) } {
+	    return
+	}
+	after cancel $FC(timer)
+    }
+    set FC(slot) $slot
+    set FC(timer) [after [expr {$slot - $now}] ::frameclock::__tick]
+}
+
+
+# ::frameclock::__tick -- Run a frame
+#
+#	Run all the steps that are due, in the order in which they
+#	were scheduled, then apply all deferred configuration
+#	changes.  Frames that have passed while the application was
+#	busy are skipped and accounted for.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Runs animation steps and deferred commands.
+proc ::frameclock::__tick { } {
+    variable FC
+    variable STEPS
+    variable log
+
+    set FC(timer) ""
+    set now [clock clicks -milliseconds]
+    set period [period]
+    if { $FC(slot) ne "" } {
+	set late [expr {($now - $FC(slot)) / $period}]
+	if { $late > 0 } {
+	    ${log}::debug "Clock is late, skipping $late frame(s)"
+	    incr FC(skipped) $late
+	}
+    }
+    set FC(now) $now
+
+    set due [list]
+    foreach id [array names STEPS] {
+	if { [lindex $STEPS($id) 0] <= $now } {
+	    lappend due $id
+	}
+    }
+    foreach id [lsort -integer $due] {
+	# Steps might have been cancelled by steps run earlier.
+	if { [info exists STEPS($id)] } {
+	    set cmd [lindex $STEPS($id) 1]
+	    unset STEPS($id)
+	    incr FC(steps)
+	    if { [catch {uplevel \#0 $cmd} err] } {
+		${log}::warn "Error when running animation step $cmd: $err"
+	    }
+	}
+    }
+    __flush
+
+    # Frames that should have happened while we were running are
+    # skipped.
+    set work [expr {[clock clicks -milliseconds] - $now}]
+    if { $work >= $period } {
+	${log}::debug "Frame took ${work}ms, skipping [expr {$work / $period}]\
+                       frame(s)"
+	incr FC(skipped) [expr {$work / $period}]
+    }
+    incr FC(frames)
+    incr FC(worktime) $work
+    if { $work > $FC(maxtime) } {
+	set FC(maxtime) $work
+    }
+    set FC(now) ""
+    set FC(slot) ""
+    __arm
+}
+
+
+# ::frameclock::__flush -- Apply deferred changes
+#
+#	Run all deferred commands, in the order in which their keys
+#	were first deferred.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Runs deferred commands.
+proc ::frameclock::__flush { } {
+    variable PENDING
+    variable ORDER
+    variable log
+
+    while { [llength $ORDER] > 0 } {
+	set keys $ORDER
+	set ORDER [list]
+	foreach key $keys {
+	    set cmd $PENDING($key)
+	    unset PENDING($key)
+	    if { [catch {uplevel \#0 $cmd} err] } {
+		${log}::debug "Could not apply deferred change $cmd: $err"
+	    }
+	}
+    }
+}
+
+
+# ::frameclock::schedule -- Schedule an animation step
+#
+#	Schedule a command to be run at the first frame after a
+#	number of milliseconds, in a way similar to after.  Animation
+#	steps that should run again are expected to reschedule
+#	themselves, ::frameclock::now returns the timestamp of the
+#	frame.
+#
+# Arguments:
+#	delay	Number of milliseconds to wait, at least
+#	args	Command to run, concatenated as with after
+#
+# Results:
+#	Return an identifier that can be used to cancel the step.
+#
+# Side Effects:
+#	Starts the clock if it was not ticking.
+proc ::frameclock::schedule { delay args } {
+    variable FC
+    variable STEPS
+
+    set id [incr FC(idgene)]
+    set STEPS($id) [list [expr {[now] + $delay}] [eval concat $args]]
+    __arm
+
+    return frame#$id
+}
+
+
+# ::frameclock::cancel -- Cancel an animation step
+#
+#	Cancel a step that was scheduled but has not run yet.
+#
+# Arguments:
+#	id	Identifier of step, as returned by ::frameclock::schedule
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Stops the clock if there is nothing left to animate.
+proc ::frameclock::cancel { id } {
+    variable STEPS
+
+    set id [string range $id [string length frame#] end]
+    if { [info exists STEPS($id)] } {
+	unset STEPS($id)
+	__arm
+    }
+}
+
+
+# ::frameclock::defer -- Defer a configuration change
+#
+#	Defer a command that changes the appearance of an object to
+#	the end of the current (or next) frame.  Commands deferred
+#	under the same key during a frame are coalesced: only the
+#	last one will be run.
+#
+# Arguments:
+#	key	Key identifying the property changed, e.g. "$top,geometry"
+#	args	Command to run, concatenated as with after
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Starts the clock if it was not ticking.
+proc ::frameclock::defer { key args } {
+    variable FC
+    variable PENDING
+    variable ORDER
+
+    if { [info exists PENDING($key)] } {
+	incr FC(coalesced)
+    } else {
+	lappend ORDER $key
+    }
+    incr FC(deferred)
+    set PENDING($key) [eval concat $args]
+    __arm
+}
+
+
+# ::frameclock::stats -- Frame statistics
+#
+#	Return statistics about the frames run so far.  The keys are
+#	rate (target frame rate), frames (number of frames run),
+#	skipped (frames skipped because of load), steps (animation
+#	steps run), deferred (changes deferred), coalesced (changes
+#	that were superseded before being applied), average and max
+#	(time spent running frames, in milliseconds) and pending
+#	(steps waiting for a frame).
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return an even list of keys and values.
+#
+# Side Effects:
+#	None.
+proc ::frameclock::stats { } {
+    variable FC
+    variable STEPS
+
+    if { $FC(frames) > 0 } {
+	set avg [format %.2f [expr {double($FC(worktime)) / $FC(frames)}]]
+    } else {
+	set avg 0.00
+    }
+    return [list rate $FC(-rate) frames $FC(frames) skipped $FC(skipped) \
+		steps $FC(steps) deferred $FC(deferred) \
+		coalesced $FC(coalesced) average $avg max $FC(maxtime) \
+		pending [array size STEPS]]
+}
+
+
+package provide frameclock 0.1
@@ -10,6 +10,7 @@
 
 package require Tk
 package require winapi
+package require frameclock
 
 namespace eval ::fullscreener {
     # Initialise the global state
@@ -119,9 +120,9 @@ proc ::fullscreener::__keep { top { force off } } {
 		    ::winapi::SetWindowPos $fullscreen(win) 0
 		}
 	    }
-	    # Reschedule next check
-	    set fullscreen(checkid) \
-		[after $fullscreen(-period) ::fullscreener::__keep $top]
+	    # Reschedule next check on the shared animation clock
+	    set fullscreen(checkid) [::frameclock::schedule $fullscreen(-period) \
+					 ::fullscreener::__keep $top]
 	} else {
 	    # Detach the window.
 	    ${log}::info \
@@ -197,7 +198,8 @@ proc ::fullscreener::__attach { top args } {
 	wm geometry $top ${sw}x${sh}+0+0
 	wm deiconify $top
 	
-	set fullscreen(checkid) [after idle ::fullscreener::__keep $top on]
+	set fullscreen(checkid) [::frameclock::schedule 0 \
+				     ::fullscreener::__keep $top on]
     }
 }
 
@@ -226,7 +228,7 @@ proc ::fullscreener::__detach { top } {
 
 	${log}::debug "Detaching from current window $fullscreen(win)"
 	if { $fullscreen(checkid) != "" } {
-	    after cancel $fullscreen(checkid)
+	    ::frameclock::cancel $fullscreen(checkid)
 	}
 	set fullscreen(checkid) ""
 	set fullscreen(win) ""
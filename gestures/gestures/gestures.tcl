@@ -2,12 +2,12 @@
 #
 #	This module implements a simplistic mouse gesture recognition
 #	module.  The idea is to sub-sample from each main point and
-#	decide upon the direction that had been taken once the
-#	sub-sampling pixel border has been crossed.  For now on, the
-#	module does not support diagonals.  The module has no
-#	dependency on Tk, it is up to the callers to push event
-#	information into this module to trigger mouse gesture pattern
-#	recognition callbacks.
+#	decide upon the direction (including diagonals) that had been
+#	taken once the sub-sampling distance has been crossed, and to
+#	match the trail against precompiled templates of the
+#	registered gestures.  The module has no dependency on Tk, it
+#	is up to the callers to push event information into this
+#	module to trigger mouse gesture pattern recognition callbacks.
 #
 # Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
 #
@@ -26,7 +26,10 @@ namespace eval ::gestures {
 	array set GEST {
 	    idgene      0
 	    -subsample  20
-	    allowed     "UDLRsca"
+	    -resample   16
+	    -tolerance  0.06
+	    allowed     "UDLR1379sca"
+	    modifiers   "sca"
 	    current     ""
 	}
 	variable libdir [file dirname [file normalize [info script]]]
@@ -38,26 +41,28 @@ namespace eval ::gestures {
 # The implementation is inspired by an article from the code
 # project: http://www.codeproject.com/cpp/PoorMansMouseGesture.asp
 #
-# The idea is to start building a virtual square at the first click of
-# a mouse gesture detection.  Once the mouse pointer passes one of the
-# edges of the square, the edge passed decides if the mouvement was to
-# the left, right, upwards or downwards.  Once the edge was passed, a
-# new virtual square is constructed and the algorithm starts over
-# again.  Mouvements are reduced to their upper most simplification so
-# that whenever down down are detected, only down is kept.  Since the
-# current implementation allows to pass the corners of the square, it
-# introduces internally 4 new directions (1 7 9 and 3 (look on your
-# numeric keypad!)).  Once a mouse gesture has ended, a deep search is
-# executed so that all occurences of 1 are replaced by left down and
-# down left, the whole sequence reduced as explained above and the
-# result being tested against all registered gestures.
-#
-# Diagonals are important. Therefore, one extension to this algorithm
-# would be to work with angles in a similar way.  As soon as the mouse
-# pointer would be too far from the starting point, the angle between
-# the horizontal and the resulting vector would be computed and the
-# ownership to an octant would decide upon the direction taken (which
-# gives us diagonals).
+# The idea is to remember the position of the mouse at the first click
+# of a mouse gesture detection.  Once the mouse pointer is further away
+# than the sub-sampling distance, the octant of the vector from the
+# remembered position decides if the mouvement was to the left, right,
+# upwards, downwards or along one of the diagonals, introduced as 1, 7,
+# 9 and 3 (look on your numeric keypad!).  The position is then
+# remembered again and the algorithm starts over.  Mouvements are
+# reduced to their upper most simplification so that whenever down
+# down are detected, only down is kept.
+#
+# Once a mouse gesture has ended, the resulting string is looked up
+# among the registered gestures.  When there is no exact match, the
+# trail of the mouse is matched against templates of the registered
+# gestures, in the spirit of the $1 recogniser: the trail is resampled
+# to -resample points equally spaced along its path, translated to its
+# centroid and scaled to a unit box.  Templates are polylines made of
+# one unit long segment per direction of the gesture string,
+# precompiled in the same way when gestures are added.  The template
+# at the smallest mean squared distance wins, provided that the
+# distance is below -tolerance.  This allows the recognition of
+# gestures defined without diagonals, e.g. RD, when the user drew a
+# rounded or diagonal trail.
 
 
 # ::gestures::config -- (re)configure a recognition context
@@ -85,7 +90,11 @@ proc ::gestures::config { recog args } {
 
     upvar \#0 $recog Recogniser
 
-    return [eval ::uobj::config Recogniser "-*" $args]
+    set res [eval ::uobj::config Recogniser "-*" $args]
+    if { [llength $args] > 1 } {
+	__compile $recog
+    }
+    return $res
 }
 
 
@@ -112,7 +121,8 @@ proc ::gestures::new { args } {
     set Recogniser(id) $GEST(idgene)
     set Recogniser(current) ""    ;# Current mouse gesture being contructed
     set Recogniser(trail) [list]  ;# Trail of mouse mouvements
-    set Recogniser(center) [list] ;# Last square recognition center
+    set Recogniser(center) [list] ;# Last sub-sampling center
+    set Recogniser(gestures) [list] ;# Registered gestures, in order
 
     # Copy options
     ::uobj::inherit GEST Recogniser
@@ -158,15 +168,187 @@ proc ::gestures::__clean { gest } {
 }
 
 
+# ::gestures::__split -- Split gesture into modifiers and directions
+#
+#	This procedure splits a (clean) gesture description string
+#	into the modifier keys that it contains and its directions.
+#
+# Arguments:
+#	gest	Clean gesture description string
+#
+# Results:
+#	Return a list of two strings: the modifiers and the directions.
+#
+# Side Effects:
+#	None.
+proc ::gestures::__split { gest } {
+    variable GEST
+
+    set mods ""
+    set dirs ""
+    set len [string length $gest]
+    for {set i 0} {$i < $len} {incr i} {
+	set char [string index $gest $i]
+	if { [string first $char $GEST(modifiers)] >= 0 } {
+	    if { [string first $char $mods] < 0 } {
+		append mods $char
+	    }
+	} elseif { [string index $dirs end] ne $char } {
+	    append dirs $char
+	}
+    }
+    return [list [join [lsort [split $mods ""]] ""] $dirs]
+}
+
+
+# ::gestures::__resample -- Resample and normalise a trail
+#
+#	This procedure resamples a trail of points to a number of
+#	points equally spaced along its path.  The resulting points
+#	are translated so that their centroid is at the origin and
+#	uniformly scaled so that they fit in a unit box.
+#
+# Arguments:
+#	points	An even long list of x y coordinates of the points.
+#	n	Number of points to resample to.
+#
+# Results:
+#	Return an even long list of 2*n coordinates.
+#
+# Side Effects:
+#	None.
+proc ::gestures::__resample { points n } {
+    foreach {px py} $points break
+    set len 0.0
+    foreach {x y} [lrange $points 2 end] {
+	set len [expr {$len + hypot($x - $px, $y - $py)}]
+	set px $x
+	set py $y
+    }
+
+    foreach {px py} $points break
+    set resampled [list $px $py]
+    if { $len > 0 && $n > 1 } {
+	set step [expr {$len / ($n - 1)}]
+	set acc 0.0
+	foreach {x y} [lrange $points 2 end] {
+	    set d [expr {hypot($x - $px, $y - $py)}]
+	    while { $d > 0 && $acc + $d >= $step } {
+		set t [expr {($step - $acc) / $d}]
+		set px [expr {$px + $t * ($x - $px)}]
+		set py [expr {$py + $t * ($y - $py)}]
+		lappend resampled $px $py
+		set d [expr {hypot($x - $px, $y - $py)}]
+		set acc 0.0
+	    }
+	    set acc [expr {$acc + $d}]
+	    set px $x
+	    set py $y
+	}
+    }
+    # Account for rounding errors and degenerated trails.
+    while { [llength $resampled] < 2 * $n } {
+	lappend resampled $px $py
+    }
+    set resampled [lrange $resampled 0 [expr {2 * $n - 1}]]
+
+    set sx 0.0
+    set sy 0.0
+    foreach {x y} $resampled {
+	set sx [expr {$sx + $x}]
+	set sy [expr {$sy + $y}]
+    }
+    set sx [expr {$sx / $n}]
+    set sy [expr {$sy / $n}]
+    foreach {minx miny maxx maxy} [__bbox $resampled] break
+    set size [expr {double(max($maxx - $minx, $maxy - $miny))}]
+    if { $size <= 0 } {
+	set size 1.0
+    }
+
+    set normalised [list]
+    foreach {x y} $resampled {
+	lappend normalised \
+	    [expr {($x - $sx) / $size}] [expr {($y - $sy) / $size}]
+    }
+    return $normalised
+}
+
+
+# ::gestures::__template -- Compile a gesture into a template
+#
+#	This procedure draws the directions of a gesture as a polyline
+#	made of unit long segments and resamples it.
+#
+# Arguments:
+#	dirs	Directions of the gesture (UDLR1379)
+#	n	Number of points to resample to.
+#
+# Results:
+#	Return an even long list of 2*n coordinates.
+#
+# Side Effects:
+#	None.
+proc ::gestures::__template { dirs n } {
+    array set VEC {
+	U {0 -1}   D {0 1}   L {-1 0}   R {1 0}
+	7 {-0.7071 -0.7071}   9 {0.7071 -0.7071}
+	1 {-0.7071 0.7071}    3 {0.7071 0.7071}
+    }
+
+    set x 0.0
+    set y 0.0
+    set points [list $x $y]
+    foreach d [split $dirs ""] {
+	foreach {vx vy} $VEC($d) break
+	set x [expr {$x + $vx}]
+	set y [expr {$y + $vy}]
+	lappend points $x $y
+    }
+    return [__resample $points $n]
+}
+
+
+# ::gestures::__compile -- Compile all templates of a context
+#
+#	This procedure (re)compiles the templates of all gestures
+#	registered in a context, for example when the number of
+#	resampling points has changed.  Templates are indexed by the
+#	modifiers of their gesture.
+#
+# Arguments:
+#	recog	Identifier of recognition context.
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::gestures::__compile { recog } {
+    upvar \#0 $recog Recogniser
+
+    array unset Recogniser templates,*
+    foreach gest $Recogniser(gestures) {
+	foreach {mods dirs} [__split $gest] break
+	if { $dirs ne "" } {
+	    lappend Recogniser(templates,$mods) \
+		$gest [__template $dirs $Recogniser(-resample)]
+	}
+    }
+}
+
+
 # ::gestures::add -- Add a new gesture
 #
 #	This command register a new gesture that will be recognised
 #	whenever it occurs.  The gesture description is a string where
 #	the following characters have the following meaning: U, D, L
-#	and R mean respectively Up, Down, Left and Right and s, c and
-#	a stands for the state of the shift, control and alt keys.  If
-#	the gesture already existed, the callback will be added to the
-#	list of already registered callbacks for the gesture.
+#	and R mean respectively Up, Down, Left and Right, 1, 3, 7 and
+#	9 mean the diagonals as on the numeric keypad (e.g. 3 is Right
+#	and Down) and s, c and a stands for the state of the shift,
+#	control and alt keys.  If the gesture already existed, the
+#	callback will be added to the list of already registered
+#	callbacks for the gesture.
 #
 # Arguments:
 #	gest	New gesture to install.
@@ -191,17 +373,16 @@ proc ::gestures::add { recog gest cb } {
 	
 	upvar \#0 $recog Recogniser
 
-	set varname "::gestures::Gesture_$Recogniser(id)_${gest}"
-	if { ! [info exists $varname] } {
-	    upvar \#0 $varname Gesture
-	    
-	    set Gesture(recogniser) $Recogniser(id)
-	    set Gesture(gesture) $gest
-	    set Gesture(callbacks) [list $cb]
+	if { ! [info exists Recogniser(callbacks,$gest)] } {
+	    set Recogniser(callbacks,$gest) [list $cb]
+	    lappend Recogniser(gestures) $gest
+	    foreach {mods dirs} [__split $gest] break
+	    if { $dirs ne "" } {
+		lappend Recogniser(templates,$mods) \
+		    $gest [__template $dirs $Recogniser(-resample)]
+	    }
 	} else {
-	    upvar \#0 $varname Gesture
-	    
-	    lappend Gesture(callbacks) $cb
+	    lappend Recogniser(callbacks,$gest) $cb
 	}
     }
     
@@ -232,23 +413,69 @@ proc ::gestures::delete { recog } {
     }
 
     upvar \#0 $recog Recogniser
-    
-    foreach varname [info vars "::gestures::Gesture_$Recogniser(id)_*"] {
-	upvar \#0 $varname Gesture
-	unset Gesture
-    }
     unset Recogniser
 }
 
 
+# ::gestures::__match -- Match a trail against the templates
+#
+#	This procedure matches a trail of points against the
+#	templates of all gestures with the same modifiers.  The
+#	distance to a template is the mean squared distance between
+#	the resampled points and the template points, computation is
+#	abandoned as soon as a template cannot win.
+#
+# Arguments:
+#	recog	Recognition context
+#	mods	Modifiers of the gesture
+#	trail	Trail of points
+#
+# Results:
+#	Return the best matching gesture, an empty string if no
+#	template is within tolerance.
+#
+# Side Effects:
+#	None.
+proc ::gestures::__match { recog mods trail } {
+    variable log
+
+    upvar \#0 $recog Recogniser
+
+    if { ! [info exists Recogniser(templates,$mods)] } {
+	return ""
+    }
+
+    set n $Recogniser(-resample)
+    set points [__resample $trail $n]
+    set best ""
+    set limit [expr {double($Recogniser(-tolerance)) * $n}]
+    foreach {gest tpl} $Recogniser(templates,$mods) {
+	set dist 0.0
+	foreach {x y} $points {tx ty} $tpl {
+	    set dist [expr {$dist + ($x-$tx)*($x-$tx) + ($y-$ty)*($y-$ty)}]
+	    if { $dist >= $limit } {
+		break
+	    }
+	}
+	if { $dist < $limit } {
+	    set best $gest
+	    set limit $dist
+	}
+    }
+    if { $best ne "" } {
+	${log}::debug "Trail matches $best at distance [expr {$limit / $n}]"
+    }
+
+    return $best
+}
+
+
 # ::gestures::__recognise -- Performs gesture recognition
 #
-#	This procedure deep searches after all combinations of the
-#	incoming gesture trail where diagonals (seldom found) are
-#	replaced by their up, down, left and right equivalents (in all
-#	orders).  Once all combinations have been found, these are
-#	looked up amoug the recognition patterns that have been
-#	registered and callbacks are deliver on match.
+#	This procedure looks up the incoming gesture among the
+#	recognition patterns that have been registered.  When there
+#	is no exact match, the trail is matched against the templates
+#	of the patterns.  Callbacks are delivered on match.
 #
 # Arguments:
 #	recog	Recognition context
@@ -257,7 +484,7 @@ proc ::gestures::delete { recog } {
 #	cy	Center of trail
 #
 # Results:
-#	None
+#	Return the gesture recognised, an empty string if none.
 #
 # Side Effects:
 #	Deliver appropriate callbacks.
@@ -267,48 +494,25 @@ proc ::gestures::__recognise { recog gest cx cy } {
     
     upvar \#0 $recog Recogniser
     
-    # Deep search all possibilities for replacing 1, 3, 5 and 9 by
-    # their up, down, left and right equivalents.
-    set i1 [string first "1" $gest]
-    if { $i1 >= 0 } {
-	__recognise $recog [string replace $gest $i1 $i1 "LD"] $cx $cy
-	__recognise $recog [string replace $gest $i1 $i1 "DL"] $cx $cy
-    }
-    set i3 [string first "3" $gest]
-    if { $i3 >= 0 } {
-	__recognise $recog [string replace $gest $i3 $i3 "RD"] $cx $cy
-	__recognise $recog [string replace $gest $i3 $i3 "DR"] $cx $cy
-    }
-    set i7 [string first "7" $gest]
-    if { $i7 >= 0 } {
-	__recognise $recog [string replace $gest $i7 $i7 "LU"] $cx $cy
-	__recognise $recog [string replace $gest $i7 $i7 "UL"] $cx $cy
-    }
-    set i9 [string first "9" $gest]
-    if { $i9 >= 0 } {
-	__recognise $recog [string replace $gest $i9 $i9 "RU"] $cx $cy
-	__recognise $recog [string replace $gest $i9 $i9 "UR"] $cx $cy
+    set gest [__clean $gest]
+    if { ! [info exists Recogniser(callbacks,$gest)] } {
+	foreach {mods dirs} [__split $gest] break
+	if { $dirs eq "" } {
+	    return ""
+	}
+	set gest [__match $recog $mods $Recogniser(trail)]
+	if { $gest eq "" } {
+	    return ""
+	}
     }
 
-    # We don't have any, we are somewhere at the bottom of the
-    # recursion, trigger the matching gesture callbacks if any.
-    if { $i1 < 0 && $i3 < 0 && $i7 < 0 && $i9 < 0 } {
-	# Clean a last time to replace all doublets
-	set gest [__clean $gest]
-
-	# And match against registered patterns
-	foreach varname [info vars "::gestures::Gesture_$Recogniser(id)_*"] {
-	    upvar \#0 $varname Gesture
-	    if { $Gesture(gesture) eq $gest } {
-		foreach cb $Gesture(callbacks) {
-		    if { [catch {eval $cb $recog $gest $cx $cy} res] } {
-			${log}::warn \
-			    "Error when invoking callback $cb: $res"
-		    }
-		}
-	    }
+    foreach cb $Recogniser(callbacks,$gest) {
+	if { [catch {eval $cb $recog $gest $cx $cy} res] } {
+	    ${log}::warn "Error when invoking callback $cb: $res"
 	}
     }
+
+    return $gest
 }
 
 
@@ -420,79 +624,39 @@ proc ::gestures::push { recog type args } {
 	"ButtonPress*" {
 	    set x [lindex $args 0]
 	    set y [lindex $args 1]
-	    set Recogniser(trail) [list]
+	    set Recogniser(trail) [list $x $y]
 	    set Recogniser(center) [list $x $y]
 	}
 	"Motion*" {
+	    if { [llength $Recogniser(center)] == 0 } {
+		return
+	    }
 	    set x [lindex $args 0]
 	    set y [lindex $args 1]
 	    lappend Recogniser(trail) $x $y
 	    foreach {cx cy} $Recogniser(center) break
-	    set dx [expr $x - $cx]
-	    set dy [expr $y - $cy]
-
-	    # Handle diagonally outside the center interaction
-	    # sub-sampling square correctly, even though diagonals are
-	    # not used in the final recognition.
-	    if { $dx >= $Recogniser(-subsample) } {
-		if { $dy >= $Recogniser(-subsample) } {
-		    __appendonce Recogniser(current) "3"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} elseif { $dy <= [expr -$Recogniser(-subsample)] } {
-		    __appendonce Recogniser(current) "9"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
+	    set dx [expr {$x - $cx}]
+	    set dy [expr {$y - $cy}]
+
+	    # Once outside the sub-sampling distance, decide upon the
+	    # octant of the mouvement, tan(22.5) is about 2/5.
+	    set sub $Recogniser(-subsample)
+	    if { $dx*$dx + $dy*$dy >= $sub*$sub } {
+		set ax [expr {abs($dx)}]
+		set ay [expr {abs($dy)}]
+		if { 5*$ay <= 2*$ax } {
+		    set dir [expr {$dx > 0 ? "R" : "L"}]
+		} elseif { 5*$ax <= 2*$ay } {
+		    set dir [expr {$dy > 0 ? "D" : "U"}]
+		} elseif { $dy > 0 } {
+		    set dir [expr {$dx > 0 ? "3" : "1"}]
 		} else {
-		    __appendonce Recogniser(current) "R"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
+		    set dir [expr {$dx > 0 ? "9" : "7"}]
 		}
-	    }
-	    if { $dx <= [expr -$Recogniser(-subsample)] } {
-		if { $dy >= $Recogniser(-subsample) } {
-		    __appendonce Recogniser(current) "1"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} elseif { $dy <= [expr -$Recogniser(-subsample)] } {
-		    __appendonce Recogniser(current) "7"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} else {
-		    __appendonce Recogniser(current) "L"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		}
-	    }
-	    if { $dy >= $Recogniser(-subsample) } {
-		if { $dx >= $Recogniser(-subsample) } {
-		    __appendonce Recogniser(current) "3"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} elseif { $dx <= [expr -$Recogniser(-subsample)] } {
-		    __appendonce Recogniser(current) "1"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} else {
-		    __appendonce Recogniser(current) "D"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		}
-	    }
-	    if { $dy <= [expr -$Recogniser(-subsample)] } {
-		if { $dx >= $Recogniser(-subsample) } {
-		    __appendonce Recogniser(current) "9"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} elseif { $dx <= [expr -$Recogniser(-subsample)] } {
-		    __appendonce Recogniser(current) "7"
-		    set Recogniser(center) [list $x $y]
-		    ${log}::debug "Recognising trail is $Recogniser(current)"
-		} else {
-		    __appendonce Recogniser(current) "U"
-		    set Recogniser(center) [list $x $y]
+		if { [__appendonce Recogniser(current) $dir] } {
 		    ${log}::debug "Recognising trail is $Recogniser(current)"
 		}
+		set Recogniser(center) [list $x $y]
 	    }
 	}
 	"ButtonRelease*" {
@@ -501,8 +665,8 @@ proc ::gestures::push { recog type args } {
 	    set cx [expr int(0.5*($minx + $maxx))]
 	    set cy [expr int(0.5*($miny + $maxy))]
 
-	    # Trigger recognition, replacing diagonals by up, down,
-	    # left and right combinations.
+	    # Trigger recognition, matching the trail against templates
+	    # when the gesture is not known as such.
 	    __recognise $recog $Recogniser(current) $cx $cy
 	    set Recogniser(center) [list]
 	    set Recogniser(current) ""
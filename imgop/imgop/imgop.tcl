@@ -16,10 +16,7 @@ package require Img
 package require uobj
 package require argutil
 package require diskutil
-package require jpeg
-package require crc32;  # Turn around until png::imageInfo is fixed
-package require png
-package require fileutil::magic::mimetype
+package require imgop::sniff
 
 namespace eval ::imgop {
     variable IMGOP
@@ -28,7 +25,24 @@ namespace eval ::imgop {
 	    inited         0
 	    -imagemagick   "%libdir%/ImageMagick/%platform%"
 	    -tmpext        "png"
+	    -probesize     1024
+	    -scaleondecode on
+	    -cachebudget   33554432
+	    -parallel      4
+	    batches        0
+	    threadcapable  0
+	    cachebytes     0
+	    cacheclock     0
+	    hits           0
+	    misses         0
+	    evictions      0
 	}
+	variable PROBES;   # Cache of header probes, indexed by file path
+	array set PROBES {}
+	variable IMGCACHE; # Decoded images: key -> {image bytes refs atime}
+	array set IMGCACHE {}
+	variable IMGKEYS;  # Decoded images: image -> key
+	array set IMGKEYS {}
 	variable libdir [file dirname [file normalize [info script]]]
 	::uobj::install_log imgop IMGOP; # Creates 'log' namespace variable
 	::uobj::install_defaults imgop IMGOP
@@ -36,6 +50,28 @@ namespace eval ::imgop {
 }
 
 
+# Run batches in worker threads whenever possible.  Tk images cannot
+# be shared between threads, each worker loads this module with its
+# own Tk and processes whole files, from decoding to encoding, see
+# __batchfile.
+if { [catch {package require Thread 2.6} ver] == 0 } {
+    set ::imgop::IMGOP(threadcapable) 1
+    set ::imgop::IMGOP(workerinit) [list set ::auto_path $::auto_path]
+    append ::imgop::IMGOP(workerinit) {
+	package require Tk
+	wm withdraw .
+    } [list source [file join $::imgop::libdir imgop.tcl]] {
+	proc ::__imgop_batchfile { main id fname out ops } {
+	    if { [catch {::imgop::__batchfile $fname $out $ops} res] } {
+		set res [list $res [list]]
+	    }
+	    ::thread::send -async $main \
+		[linsert $res 0 ::imgop::__batchdone $id $fname $out]
+	}
+    }
+}
+
+
 # ::imgop::__image -- Load in an image from file
 #
 #	Create a Tk image by loading a file.
@@ -122,13 +158,61 @@ proc ::imgop::loadimage { fname { imgname "" } } {
 }
 
 
+# ::imgop::__u16 -- Unsigned 16 bits integer from binary string
+#
+#	Extract an unsigned 16 bits integer at a given offset of a
+#	binary string, in either byte order.
+#
+# Arguments:
+#	data	Binary string
+#	ofs	Offset in string
+#	order	s for little-endian (default), S for big-endian
+#
+# Results:
+#	Return the integer, an empty string if out of bounds.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__u16 { data ofs { order s } } {
+    if { [binary scan $data @${ofs}${order} val] != 1 } {
+	return ""
+    }
+    return [expr {$val & 0xFFFF}]
+}
+
+
+# ::imgop::__u32 -- Unsigned 32 bits integer from binary string
+#
+#	Extract an unsigned 32 bits integer at a given offset of a
+#	binary string, in either byte order.
+#
+# Arguments:
+#	data	Binary string
+#	ofs	Offset in string
+#	order	i for little-endian (default), I for big-endian
+#
+# Results:
+#	Return the integer, an empty string if out of bounds.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__u32 { data ofs { order i } } {
+    if { [binary scan $data @${ofs}${order} val] != 1 } {
+	return ""
+    }
+    return [expr {$val & 0xFFFFFFFF}]
+}
+
+
 # ::imgop::__gifsize -- Size of a GIF file
 #
-#	This command actively peeks in a GIF file in order to detect
-#	its size.  It is adapted from the code at http://wiki.tcl.tk/758.
+#	This command peeks in the header of a GIF file in order to
+#	detect its size.  It is adapted from the code at
+#	http://wiki.tcl.tk/758.
 #
 # Arguments:
-#	fname	Path to GIF file.
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
 #
 # Results:
 #	A list with the width and height of the picture, or an empty
@@ -136,43 +220,233 @@ proc ::imgop::loadimage { fname { imgname "" } } {
 #
 # Side Effects:
 #	None.
-proc ::imgop::__gifsize { fname} {
-    variable IMGOP
-    variable log
+proc ::imgop::__gifsize { f hdr } {
+    # Read "logical screen size", this is USUALLY the image size
+    # too.
+    set wid [__u16 $hdr 6]
+    set hgt [__u16 $hdr 8]
+    if { $hgt eq "" } {
+	return [list]
+    }
+    return [list $wid $hgt]
+}
 
-    set f [open $fname r]
-    fconfigure $f -translation binary
-    # read GIF signature -- check that this is
-    # either GIF87a or GIF89a
-    set sig [read $f 6]
-    switch $sig {
-        "GIF87a" -
-        "GIF89a" {
-            # do nothing
-        }
-        default {
-            close $f
-	    ${log}::warn "$f is not a GIF file"
-	    return [list]
-        }
+
+# ::imgop::__bmpsize -- Size of a BMP file
+#
+#	This command peeks in the header of a BMP file in order to
+#	detect its size.  It is adapted from the code at
+#	http://wiki.tcl.tk/16672 and also understands OS/2 headers.
+#
+# Arguments:
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
+#
+# Results:
+#	A list with the width and height of the picture, or an empty
+#	list on error.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__bmpsize { f hdr } {
+    # Size of the DIB header follows the 14 bytes of file header,
+    # OS/2 (core) headers use 16 bits dimensions.
+    set dibsize [__u32 $hdr 14]
+    if { $dibsize == 12 } {
+	set wid [__u16 $hdr 18]
+	set hgt [__u16 $hdr 20]
+    } else {
+	binary scan $hdr @18ii wid hgt
     }
-    # read "logical screen size", this is USUALLY the image size too.
-    # interpreting the rest of the GIF specification is left as an exercise
-    binary scan [read $f 2] s wid
-    binary scan [read $f 2] s hgt
-    close $f
+    if { ![info exists hgt] || $hgt eq "" } {
+	return [list]
+    }
+    # Top-down bitmaps have negative heights.
+    return [list $wid [expr {abs($hgt)}]]
+}
+
 
+# ::imgop::__pngsize -- Size of a PNG file
+#
+#	This command reads the IHDR chunk of a PNG file, which is
+#	mandated to be the first one, in order to detect its size.
+#
+# Arguments:
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
+#
+# Results:
+#	A list with the width and height of the picture, or an empty
+#	list on error.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__pngsize { f hdr } {
+    if { [string range $hdr 12 15] ne "IHDR" } {
+	return [list]
+    }
+    set wid [__u32 $hdr 16 I]
+    set hgt [__u32 $hdr 20 I]
+    if { $hgt eq "" } {
+	return [list]
+    }
     return [list $wid $hgt]
 }
 
 
-# ::imgop::__bmpsize -- Size of a BMP file
+# ::imgop::__jpegsize -- Size of a JPEG file
+#
+#	This command walks the markers of a JPEG file until it finds
+#	a start of frame (SOF) marker, which contains the size of the
+#	picture.  Segments are skipped by seeking over their content,
+#	so that large EXIF blocks are never read.
+#
+# Arguments:
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
+#
+# Results:
+#	A list with the width and height of the picture, or an empty
+#	list on error.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__jpegsize { f hdr } {
+    seek $f 2 start
+    while { ![eof $f] } {
+	# Find next marker, skipping any fill bytes.
+	set c [read $f 1]
+	if { $c ne "\xFF" } {
+	    return [list]
+	}
+	while { $c eq "\xFF" } {
+	    set c [read $f 1]
+	}
+	if { $c eq "" } {
+	    return [list]
+	}
+	binary scan $c c marker
+	set marker [expr {$marker & 0xFF}]
+
+	# Standalone markers carry no length.
+	if { $marker == 0x01 || ($marker >= 0xD0 && $marker <= 0xD8) } {
+	    continue
+	}
+	if { $marker == 0xD9 || $marker == 0xDA } {
+	    # End of image or start of scan before any SOF
+	    return [list]
+	}
+	set seg [read $f 2]
+	set len [__u16 $seg 0 S]
+	if { $len eq "" || $len < 2 } {
+	    return [list]
+	}
+
+	# All SOFn markers but DHT (C4), JPG (C8) and DAC (CC)
+	if { $marker >= 0xC0 && $marker <= 0xCF \
+		 && $marker != 0xC4 && $marker != 0xC8 && $marker != 0xCC } {
+	    set sof [read $f 5]
+	    set hgt [__u16 $sof 1 S]
+	    set wid [__u16 $sof 3 S]
+	    if { $wid eq "" } {
+		return [list]
+	    }
+	    return [list $wid $hgt]
+	}
+	seek $f [expr {$len - 2}] current
+    }
+
+    return [list]
+}
+
+
+# ::imgop::__pnmsize -- Size of a PBM/PGM/PPM file
+#
+#	This command parses the textual header of netpbm files in
+#	order to detect their size.
+#
+# Arguments:
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
+#
+# Results:
+#	A list with the width and height of the picture, or an empty
+#	list on error.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__pnmsize { f hdr } {
+    # Remove comments, then the magic number, the two following
+    # tokens are the dimensions.
+    regsub -all {#[^\n\r]*} [string range $hdr 2 end] " " hdr
+    if { [regexp {^\s+(\d+)\s+(\d+)} $hdr -> wid hgt] } {
+	return [list $wid $hgt]
+    }
+    return [list]
+}
+
+
+# ::imgop::__tiffsize -- Size of a TIFF file
+#
+#	This command reads the first image file directory (IFD) of a
+#	TIFF file and looks for the ImageWidth and ImageLength tags.
+#
+# Arguments:
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
+#
+# Results:
+#	A list with the width and height of the picture, or an empty
+#	list on error.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__tiffsize { f hdr } {
+    if { [string range $hdr 0 1] eq "II" } {
+	set s s; set i i
+    } else {
+	set s S; set i I
+    }
+
+    seek $f [__u32 $hdr 4 $i] start
+    set entries [__u16 [read $f 2] 0 $s]
+    if { $entries eq "" } {
+	return [list]
+    }
+    set ifd [read $f [expr {$entries * 12}]]
+    for { set e 0 } { $e < $entries } { incr e } {
+	set ofs [expr {$e * 12}]
+	set tag [__u16 $ifd $ofs $s]
+	if { $tag == 256 || $tag == 257 } {
+	    # SHORT values are left-justified in the value field.
+	    if { [__u16 $ifd [expr {$ofs + 2}] $s] == 3 } {
+		set val [__u16 $ifd [expr {$ofs + 8}] $s]
+	    } else {
+		set val [__u32 $ifd [expr {$ofs + 8}] $i]
+	    }
+	    if { $tag == 256 } {
+		set wid $val
+	    } else {
+		set hgt $val
+	    }
+	}
+    }
+    if { [info exists wid] && [info exists hgt] } {
+	return [list $wid $hgt]
+    }
+    return [list]
+}
+
+
+# ::imgop::__webpsize -- Size of a WebP file
 #
-#	This command actively peeks in a BMP file in order to detect
-#	its size.  It is adapted from the code at http://wiki.tcl.tk/16672.
+#	This command looks into the first chunk of a WebP container,
+#	which is either a lossy (VP8), lossless (VP8L) or extended
+#	(VP8X) chunk, in order to detect the size of the picture.
 #
 # Arguments:
-#	fname	Path to BMP file.
+#	f	Channel opened in binary mode, positioned at start.
+#	hdr	First bytes of the file.
 #
 # Results:
 #	A list with the width and height of the picture, or an empty
@@ -180,25 +454,87 @@ proc ::imgop::__gifsize { fname} {
 #
 # Side Effects:
 #	None.
-proc ::imgop::__bmpsize { fname} {
+proc ::imgop::__webpsize { f hdr } {
+    switch -exact -- [string range $hdr 12 15] {
+	"VP8 " {
+	    if { [string range $hdr 23 25] ne "\x9D\x01\x2A" } {
+		return [list]
+	    }
+	    set wid [expr {[__u16 $hdr 26] & 0x3FFF}]
+	    set hgt [expr {[__u16 $hdr 28] & 0x3FFF}]
+	}
+	"VP8L" {
+	    set bits [__u32 $hdr 21]
+	    set wid [expr {($bits & 0x3FFF) + 1}]
+	    set hgt [expr {(($bits >> 14) & 0x3FFF) + 1}]
+	}
+	"VP8X" {
+	    set wid [expr {([__u32 $hdr 24] & 0xFFFFFF) + 1}]
+	    set hgt [expr {([__u32 $hdr 26] >> 8) + 1}]
+	}
+	default {
+	    return [list]
+	}
+    }
+    return [list $wid $hgt]
+}
+
+
+# ::imgop::probe -- Probe the header of an image file
+#
+#	Peek in the header of an image file and return its dimensions
+#	and format, without decoding the image nor relying on any
+#	external program.  Only the first few bytes of the file are
+#	read, apart from JPEG and TIFF files where the parser seeks to
+#	the relevant data structures.  Results are cached and reused
+#	for as long as the modification time and size of the file do
+#	not change.
+#
+# Arguments:
+#	fname	Path to image file.
+#
+# Results:
+#	Return a list with the width, height and format of the image,
+#	an empty list if the format is not recognised or on errors.
+#
+# Side Effects:
+#	None.
+proc ::imgop::probe { fname } {
     variable IMGOP
+    variable PROBES
     variable log
 
-    set f [open $fname r]
-    fconfigure $f -translation binary
-    # read BMP signature -- check that this is a BMP file
-    set sig [read $f 2]
-    if { $sig ne "BM" } {
-	close $f
-	${log}::warn "$f is not a BMP file"
+    if { [catch {file stat $fname stat}] } {
+	${log}::warn "Cannot access $fname"
 	return [list]
     }
-    seek $f 18; # Past 3 integer header fields
-    binary scan [read $f 4] i wid
-    binary scan [read $f 4] i hgt
+    set key [file normalize $fname]
+    if { [info exists PROBES($key)] } {
+	foreach {mtime size res} $PROBES($key) break
+	if { $mtime == $stat(mtime) && $size == $stat(size) } {
+	    return $res
+	}
+    }
+
+    set res [list]
+    if { [catch {open $fname r} f] } {
+	${log}::warn "Cannot open $fname: $f"
+	return $res
+    }
+    fconfigure $f -translation binary
+    set hdr [read $f $IMGOP(-probesize)]
+    set fmt [__format $hdr]
+    if { $fmt ne "" } {
+	if { [catch {__${fmt}size $f $hdr} dims] } {
+	    ${log}::warn "Could not parse $fmt header of $fname: $dims"
+	} elseif { [llength $dims] == 2 } {
+	    set res [concat $dims $fmt]
+	}
+    }
     close $f
 
-    return [list $wid $hgt]
+    set PROBES($key) [list $stat(mtime) $stat(size) $res]
+    return $res
 }
 
 
@@ -302,6 +638,31 @@ proc ::imgop::duplicate { src {dst ""}} {
 }
 
 
+# ::imgop::__yield -- Give control back during long operations
+#
+#	Give control back to the application during long image
+#	operations.  When the operation runs within a coroutine task
+#	of the flexupdate scheduler, this suspends the task until its
+#	next slice, otherwise this updates idle tasks (through
+#	flexupdate if it is loaded).
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Runs idle tasks or suspends the current task.
+proc ::imgop::__yield { } {
+    if { [llength [info commands ::flexupdate::yield]] } {
+	::flexupdate::yield
+    } else {
+	update idletasks
+    }
+}
+
+
 # ::imgop::imgresize -- Resize an existing Tk image
 #
 #	Copies a source image to a destination image and resizes it
@@ -318,7 +679,7 @@ proc ::imgop::duplicate { src {dst ""}} {
 #	Name of destination image
 #
 # Side Effects:
-#	None.
+#	Gives control back between rows, see __yield.
 proc ::imgop::imgresize { src {newx -1} {newy -1} {dest ""}} {
     variable IMGOP
     variable log
@@ -489,7 +850,7 @@ proc ::imgop::imgresize { src {newx -1} {newy -1} {dest ""}} {
 	set prevrow $thisrow
 	set prow $row
 
-	update idletasks
+	__yield
     }
 
     # Finish off last rows
@@ -497,7 +858,7 @@ proc ::imgop::imgresize { src {newx -1} {newy -1} {dest ""}} {
 	$dest put -to 0 $ny [list $row]
 	incr ny
     }
-    update idletasks
+    __yield
 
     return $dest
 }
@@ -507,7 +868,9 @@ proc ::imgop::imgresize { src {newx -1} {newy -1} {dest ""}} {
 #
 #	Actively computes the size of an image and return it.  This
 #	command is both able to handle file names and existing Tk
-#	images.  Files will not be loaded into memory.
+#	images.  Files will not be loaded into memory, their headers
+#	are peeked at by probe and ImageMagick is only used for
+#	formats that are not recognised there.
 #
 # Arguments:
 #	name	Name of existing image or of file pointing to an image.
@@ -524,15 +887,9 @@ proc ::imgop::size { name } {
 
     if { [lsearch -exact [image names] $name] < 0 } {
 	${log}::debug "Image $name is a file on disk, guessing"
-	if { [::jpeg::isJPEG $name] } {
-	    return [::jpeg::dimensions $name]
-	} elseif { [::png::isPNG $name] } {
-	    array set imginfo [::png::imageInfo $name]
-	    return [list $imginfo(width) $imginfo(height)]
-	} elseif { [::fileutil::magic::mimetype $name] eq "image/gif" } {
-	    return [__gifsize $name]
-	} elseif { [::fileutil::magic::mimetype $name] eq "image/x-bmp" } {
-	    return [__bmpsize $name]
+	set probe [probe $name]
+	if { $probe ne "" } {
+	    return [lrange $probe 0 1]
 	} else {
 	    # The image is of none of the internally recognised types,
 	    # use image magick to get its size, this is heavy but our
@@ -712,150 +1069,694 @@ proc ::imgop::resize { name { width -1 } { height -1 } args } {
 }
 
 
-# ::imgop::histogram -- Compute picture histogram
+# ::imgop::__convert -- Locate ImageMagick convert
 #
-#	This command computes the histogram of a given picture, the
-#	histogram is returned in the form of a sorted list with the
-#	color of the highest intensity first.
+#	Locate the convert executable of the ImageMagick installation
+#	pointed at by the -imagemagick option.
 #
 # Arguments:
-#	img	Tk image
+#	None.
 #
 # Results:
-#	Return a 4-sized list where the quadruplets contain the r, g,
-#	b and frequency values of the sorted histogram.
+#	Return a list suitable for exec, an empty list when convert
+#	cannot be found.
 #
 # Side Effects:
 #	None.
-proc ::imgop::histogram { img } {
+proc ::imgop::__convert { } {
     variable IMGOP
     variable log
 
-    ${log}::debug "Computing histogram for $img"
-
-    # Compute histogram in local array
-    array set hist {}
-    set w [image width $img]
-    set h [image height $img]
-    for { set x 0 } { $x < $w } { incr x } {
-	for { set y 0 } { $y < $h } { incr y } {
-	    foreach {r g b} [$img get $x $y] {}
-	    set idx [format "%02x%02x%02x" $r $g $b]
-	    if { [array names hist $idx] eq "" } {
-		set hist($idx) 1
-	    } else {
-		incr hist($idx)
-	    }
-	}
-    }
-
-    # Convert the histogram to a list appropriate for sorting
-    set outlist [list]
-    foreach i [array names hist] {
-	scan $i "%02x%02x%02x" r g b
-	lappend outlist [list $r $g $b $hist($i)]
+    set mdir [::argutil::resolve_links $IMGOP(-imagemagick)]
+    set convert [auto_execok [file join $mdir convert]]
+    if { $convert eq "" } {
+	${log}::debug "Could not find convert in $mdir!"
     }
-
-    # Sort and return list in appropriate format
-    return [eval concat [lsort -index 3 -integer -decreasing $outlist]]
+    return $convert
 }
 
 
-# ::imgop::pixcounter -- Apply pixel rules on image
+# ::imgop::thumbcommand -- ImageMagick command for thumbnails
 #
-#	Apply a rule on all pixels.  A rules can be any string
-#	compatible with expr, where the strings R, G and B will be
-#	replaced by the RGB value of the pixel.  The number of
-#	matching pixels is returned.
+#	Build the command that creates a thumbnail of an image file
+#	using ImageMagick.  A jpeg:size hint is passed to the decoder
+#	so that libjpeg performs its DCT-domain downscaling (1/2, 1/4
+#	or 1/8) while decoding JPEG files, instead of decoding the
+#	whole picture.  The final resampling also happens within
+#	ImageMagick, keeping the ratio of the original picture.  The
+#	command does not depend on Tk and is suitable for execution
+#	from other threads.
 #
 # Arguments:
-#	img	Tk image
-#	rules	Rules to apply within image.
+#	fname	Path to image file
+#	width	Maximum width of thumbnail
+#	height	Maximum height of thumbnail
+#	dst_fname	Path to thumbnail file to create
 #
 # Results:
-#	Return the number of pixels matching the rules.
+#	Return a list suitable for exec, an empty list when
+#	ImageMagick cannot be found.
 #
 # Side Effects:
 #	None.
-proc ::imgop::pixcounter { img rules } {
+proc ::imgop::thumbcommand { fname width height dst_fname } {
     variable IMGOP
     variable log
-    
-    ${log}::debug "Applying pixel rules '$rules' on image $img"
 
-    set match 0
-    set w [image width $img]
-    set h [image height $img]
-    for { set x 0 } { $x < $w } { incr x } {
-	for { set y 0 } { $y < $h } { incr y } {
-	    foreach {r g b} [$img get $x $y] {}
-	    set prule [string map [list "R" $r "G" $g "B" $b] $rules]
-	    if { [expr $prule] } {
-		incr match
-	    }
-	}
+    set convert [__convert]
+    if { $convert eq "" } {
+	return [list]
     }
 
-    return $match
+    # Ask the decoder for twice the size, so that the final resampling
+    # has enough pixels to produce a good quality thumbnail.
+    set hint "[expr {2*$width}]x[expr {2*$height}]"
+    return [concat $convert \
+		[list -define jpeg:size=$hint \
+		     [file nativename [file normalize $fname]] \
+		     -thumbnail "${width}x${height}>" \
+		     [file nativename [file normalize $dst_fname]]]]
 }
 
 
-# ::imgop::transparent -- Make pixels in an image transparent
+# ::imgop::__magickthumb -- Scale-on-decode thumbnail via ImageMagick
 #
-#	Makes all pixels of a given colour in a Tk image transparent.
-#	Colour selection is based on expressions, so that all < or >
-#	or any other signs can be used.  The current colour of the
-#	image pixel is always prepended to the expression before being
-#	evaluated.  Simple integers will automatically be amended and
-#	prepended with ==, which is the default awaited (and original)
-#	behaviour of this procedure!
+#	Create a thumbnail of an image file using ImageMagick, see
+#	thumbcommand.
 #
 # Arguments:
-#	img	Image to process.
-#	bg	RGB list of "background" colour expressions to make transparent
+#	fname	Path to image file
+#	width	Maximum width of thumbnail
+#	height	Maximum height of thumbnail
+#	imgname	Name of image to create
 #
 # Results:
-#	Return the number of pixels that were made transparent.
+#	Return the name of the image that was created, empty string on
+#	error.
+#
+# Side Effects:
+#	Will use a temporary file.
+proc ::imgop::__magickthumb { fname width height { imgname "" } } {
+    variable IMGOP
+    variable log
+
+    set prefix [lindex [split [regsub -all "::" [namespace current] " "]] 0]
+    set dst_fname [::diskutil::temporary_file $prefix $IMGOP(-tmpext)]
+    set cmd [thumbcommand $fname $width $height $dst_fname]
+    if { $cmd eq "" } {
+	return ""
+    }
+    if { [catch {eval exec $cmd} output] } {
+	${log}::warn "Could not create thumbnail via Image Magick: $output!"
+	catch {file delete $dst_fname}
+	return ""
+    }
+
+    set img [__image $dst_fname $imgname]
+    file delete $dst_fname
+
+    return $img
+}
+
+
+# ::imgop::thumbnail -- Create a thumbnail of an image file
+#
+#	Create a Tk image containing a thumbnail of an image file,
+#	which fits within the width and height passed as arguments
+#	while keeping the ratio of the original picture.  JPEG files
+#	are downscaled by the decoder whenever possible.  Other files
+#	are decoded by Tk and subsampled natively down to a size close
+#	to the thumbnail, before being resampled to their final size
+#	in Tcl.  Since the latter only operates on a few pixels, this
+#	is much cheaper than resizing the whole picture.
+#
+# Arguments:
+#	fname	Path to image file
+#	width	Maximum width of thumbnail
+#	height	Maximum height of thumbnail
+#	imgname	Name of image to create
+#
+# Results:
+#	Return the name of the image that was created, empty string on
+#	error.
 #
 # Side Effects:
 #	None.
-proc ::imgop::transparent { img { bg "0 0 0" } } {
+proc ::imgop::thumbnail { fname width height { imgname "" } } {
     variable IMGOP
     variable log
 
-    ${log}::debug "Making pixels in image $img transparent: $bg"
-    set no_trans 0
+    set probe [probe $fname]
+    if { $probe ne "" } {
+	foreach {iw ih fmt} $probe break
+    } else {
+	set sizel [size $fname]
+	if { $sizel eq "" } {
+	    ${log}::warn "Cannot compute dimensions of $fname"
+	    return ""
+	}
+	foreach {iw ih} $sizel break
+	set fmt ""
+    }
+
+    # Compute thumbnail dimensions, keeping the ratio of the original.
+    # Small pictures are simply loaded.
+    set sx [expr {double($width)/double($iw)}]
+    set sy [expr {double($height)/double($ih)}]
+    if { $sx < $sy } { set scale $sx } else { set scale $sy }
+    if { $scale >= 1.0 } {
+	return [loadimage $fname $imgname]
+    }
+    set tw [expr {round($iw * $scale)}]
+    set th [expr {round($ih * $scale)}]
+    if { $tw < 1 } { set tw 1 }
+    if { $th < 1 } { set th 1 }
+
+    if { $fmt eq "jpeg" && [string is true $IMGOP(-scaleondecode)] } {
+	set img [__magickthumb $fname $tw $th $imgname]
+	if { $img ne "" } {
+	    return $img
+	}
+    }
+
+    set src [loadimage $fname]
+    if { $src eq "" } {
+	return ""
+    }
 
-    foreach {bg_r bg_g bg_b} $bg break
-    if { [string is integer $bg_r] } {
-	set exp_r " == $bg_r"
+    # Subsample natively (every nth pixel in both directions), keeping
+    # at least twice the thumbnail size for the final resampling.
+    set n [expr {int(1.0 / (2.0 * $scale))}]
+    if { $n > 1 } {
+	set sub [image create photo]
+	$sub copy $src -subsample $n $n
+	image delete $src
+	set src $sub
+    }
+
+    if { [image width $src] == $tw && [image height $src] == $th } {
+	if { $imgname eq "" } {
+	    return $src
+	}
+	set img [duplicate $src $imgname]
     } else {
-	set exp_r " $bg_r"
+	set img [imgresize $src $tw $th $imgname]
+    }
+    image delete $src
+
+    return $img
+}
+
+
+# ::imgop::__cachekey -- Key of a decoded image in the cache
+#
+#	Compute the key under which a decoded image is kept in the
+#	image cache.  The key captures the identity of the file, so
+#	that modified files lead to new keys.
+#
+# Arguments:
+#	fname	Path to image file
+#	width	Maximum width of image, negative for original size
+#	height	Maximum height of image, negative for original size
+#
+# Results:
+#	Return the key, an empty string if the file cannot be accessed.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__cachekey { fname width height } {
+    if { [catch {file stat $fname stat}] } {
+	return ""
     }
-    if { [string is integer $bg_g] } {
-	set exp_g " == $bg_g"
+    return [list [file normalize $fname] $stat(mtime) $stat(size) \
+		$width $height]
+}
+
+
+# ::imgop::__evict -- Evict images from the cache
+#
+#	Delete the least recently used images from the image cache
+#	until the cache fits within its byte budget.  Images that are
+#	still referenced, or that are still displayed by some widget,
+#	are never evicted.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Deletes Tk images.
+proc ::imgop::__evict { } {
+    variable IMGOP
+    variable IMGCACHE
+    variable IMGKEYS
+    variable log
+
+    if { $IMGOP(cachebytes) <= $IMGOP(-cachebudget) } {
+	return
+    }
+
+    set candidates [list]
+    foreach key [array names IMGCACHE] {
+	foreach {img bytes refs atime} $IMGCACHE($key) break
+	if { $refs <= 0 } {
+	    lappend candidates [list $atime $key]
+	}
+    }
+    foreach c [lsort -integer -index 0 $candidates] {
+	if { $IMGOP(cachebytes) <= $IMGOP(-cachebudget) } {
+	    break
+	}
+	set key [lindex $c 1]
+	foreach {img bytes refs atime} $IMGCACHE($key) break
+	if { [catch {image inuse $img} inuse] == 0 && $inuse } {
+	    continue
+	}
+	unset IMGCACHE($key)
+	unset IMGKEYS($img)
+	catch {image delete $img}
+	incr IMGOP(cachebytes) -$bytes
+	incr IMGOP(evictions)
+    }
+    if { $IMGOP(cachebytes) > $IMGOP(-cachebudget) } {
+	${log}::info "Image cache over budget, all images in use"
+    }
+}
+
+
+# ::imgop::lookup -- Look for a decoded image in the cache
+#
+#	Look for a decoded image of a file in the process-wide image
+#	cache.  Images in the cache are shared and should not be
+#	modified nor deleted by callers, which should instead call
+#	release once they do not need the image anymore.
+#
+# Arguments:
+#	fname	Path to image file
+#	width	Maximum width of image, negative for original size
+#	height	Maximum height of image, negative for original size
+#
+# Results:
+#	Return the name of the image, an empty string if it was not in
+#	the cache.
+#
+# Side Effects:
+#	Increments the reference count of the image.
+proc ::imgop::lookup { fname { width -1 } { height -1 } } {
+    variable IMGOP
+    variable IMGCACHE
+    variable IMGKEYS
+
+    set key [__cachekey $fname $width $height]
+    if { $key ne "" && [info exists IMGCACHE($key)] } {
+	foreach {img bytes refs atime} $IMGCACHE($key) break
+	if { [catch {image type $img}] == 0 } {
+	    set IMGCACHE($key) \
+		[list $img $bytes [incr refs] [incr IMGOP(cacheclock)]]
+	    incr IMGOP(hits)
+	    return $img
+	}
+	# Deleted behind our back
+	unset IMGCACHE($key)
+	unset IMGKEYS($img)
+	incr IMGOP(cachebytes) -$bytes
+    }
+    incr IMGOP(misses)
+    return ""
+}
+
+
+# ::imgop::adopt -- Place a decoded image in the cache
+#
+#	Place an image that was decoded from a file in the image
+#	cache, see lookup.  The image is considered referenced once,
+#	adopting an image that already is in the cache references it
+#	once more.  When another copy of the same image is cached, the
+#	newest copy replaces it, unless the other copy still is in use;
+#	the image is then left out of the cache and will be deleted
+#	when released.
+#
+# Arguments:
+#	img	Tk image
+#	fname	Path to image file the image was decoded from
+#	width	Maximum width used when decoding, negative for original size
+#	height	Maximum height used when decoding, negative for original size
+#
+# Results:
+#	Return the image.
+#
+# Side Effects:
+#	May evict other images from the cache.
+proc ::imgop::adopt { img fname { width -1 } { height -1 } } {
+    variable IMGOP
+    variable IMGCACHE
+    variable IMGKEYS
+
+    if { [info exists IMGKEYS($img)] } {
+	set key $IMGKEYS($img)
+	foreach {img bytes refs atime} $IMGCACHE($key) break
+	set IMGCACHE($key) \
+	    [list $img $bytes [incr refs] [incr IMGOP(cacheclock)]]
+	return $img
+    }
+    set key [__cachekey $fname $width $height]
+    if { $key eq "" } {
+	return $img
+    }
+    if { [info exists IMGCACHE($key)] } {
+	# Another copy is already cached, keep the newest unless the
+	# other one is still in use.
+	foreach {old bytes refs atime} $IMGCACHE($key) break
+	if { $refs > 0 \
+		 || ([catch {image inuse $old} inuse] == 0 && $inuse) } {
+	    return $img
+	}
+	unset IMGCACHE($key)
+	unset IMGKEYS($old)
+	catch {image delete $old}
+	incr IMGOP(cachebytes) -$bytes
+    }
+    set bytes [expr {[image width $img] * [image height $img] * 4}]
+    set IMGCACHE($key) [list $img $bytes 1 [incr IMGOP(cacheclock)]]
+    set IMGKEYS($img) $key
+    incr IMGOP(cachebytes) $bytes
+    __evict
+
+    return $img
+}
+
+
+# ::imgop::acquire -- Get a decoded image, through the cache
+#
+#	Return a decoded image of a file, from the image cache if
+#	possible.  On cache misses, the image is loaded (see
+#	loadimage), or a thumbnail fitting within the width and height
+#	is created (see thumbnail), and placed in the cache.
+#
+# Arguments:
+#	fname	Path to image file
+#	width	Maximum width of image, negative for original size
+#	height	Maximum height of image, negative for original size
+#
+# Results:
+#	Return the name of the image, which should be released with
+#	release, an empty string on errors.
+#
+# Side Effects:
+#	May evict other images from the cache.
+proc ::imgop::acquire { fname { width -1 } { height -1 } } {
+    set img [lookup $fname $width $height]
+    if { $img ne "" } {
+	return $img
+    }
+
+    if { $width < 0 || $height < 0 } {
+	set img [loadimage $fname]
     } else {
-	set exp_g " $bg_g"
+	set img [thumbnail $fname $width $height]
+    }
+    if { $img ne "" } {
+	adopt $img $fname $width $height
     }
-    if { [string is integer $bg_b] } {
-	set exp_b " == $bg_b"
+    return $img
+}
+
+
+# ::imgop::release -- Release a decoded image
+#
+#	Release an image that was obtained through acquire or lookup,
+#	or that was adopted.  Released images are kept in the cache
+#	until they are evicted.  Images that are not in the cache are
+#	simply deleted.
+#
+# Arguments:
+#	img	Tk image
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	May delete the image.
+proc ::imgop::release { img } {
+    variable IMGCACHE
+    variable IMGKEYS
+
+    if { [info exists IMGKEYS($img)] } {
+	set key $IMGKEYS($img)
+	foreach {img bytes refs atime} $IMGCACHE($key) break
+	if { $refs > 0 } {
+	    incr refs -1
+	}
+	set IMGCACHE($key) [list $img $bytes $refs $atime]
+	__evict
     } else {
-	set exp_b " $bg_b"
+	catch {image delete $img}
+    }
+}
+
+
+# ::imgop::cachestats -- Image cache statistics
+#
+#	Return statistics about the image cache.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return a list of keys and values, the keys being hits, misses,
+#	evictions, entries, bytes and budget.
+#
+# Side Effects:
+#	None.
+proc ::imgop::cachestats { } {
+    variable IMGOP
+    variable IMGCACHE
+
+    return [list hits $IMGOP(hits) misses $IMGOP(misses) \
+		evictions $IMGOP(evictions) entries [array size IMGCACHE] \
+		bytes $IMGOP(cachebytes) budget $IMGOP(-cachebudget)]
+}
+
+
+# ::imgop::histogram -- Compute picture histogram
+#
+#	This command computes the histogram of a given picture, the
+#	histogram is returned in the form of a sorted list with the
+#	color of the highest intensity first.
+#
+# Arguments:
+#	img	Tk image
+#
+# Results:
+#	Return a 4-sized list where the quadruplets contain the r, g,
+#	b and frequency values of the sorted histogram.
+#
+# Side Effects:
+#	None.
+proc ::imgop::histogram { img } {
+    variable IMGOP
+    variable log
+
+    ${log}::debug "Computing histogram for $img"
+
+    # Compute histogram in local array
+    array set hist {}
+    set w [image width $img]
+    set h [image height $img]
+    for { set x 0 } { $x < $w } { incr x } {
+	for { set y 0 } { $y < $h } { incr y } {
+	    foreach {r g b} [$img get $x $y] {}
+	    set idx [format "%02x%02x%02x" $r $g $b]
+	    if { [array names hist $idx] eq "" } {
+		set hist($idx) 1
+	    } else {
+		incr hist($idx)
+	    }
+	}
+    }
+
+    # Convert the histogram to a list appropriate for sorting
+    set outlist [list]
+    foreach i [array names hist] {
+	scan $i "%02x%02x%02x" r g b
+	lappend outlist [list $r $g $b $hist($i)]
     }
 
+    # Sort and return list in appropriate format
+    return [eval concat [lsort -index 3 -integer -decreasing $outlist]]
+}
+
+
+# ::imgop::pixcounter -- Apply pixel rules on image
+#
+#	Apply a rule on all pixels.  A rules can be any string
+#	compatible with expr, where the strings R, G and B will be
+#	replaced by the RGB value of the pixel.  The number of
+#	matching pixels is returned.
+#
+# Arguments:
+#	img	Tk image
+#	rules	Rules to apply within image.
+#
+# Results:
+#	Return the number of pixels matching the rules.
+#
+# Side Effects:
+#	None.
+proc ::imgop::pixcounter { img rules } {
+    variable IMGOP
+    variable log
+    
+    ${log}::debug "Applying pixel rules '$rules' on image $img"
 
+    set match 0
+    set w [image width $img]
+    set h [image height $img]
+    for { set x 0 } { $x < $w } { incr x } {
+	for { set y 0 } { $y < $h } { incr y } {
+	    foreach {r g b} [$img get $x $y] {}
+	    set prule [string map [list "R" $r "G" $g "B" $b] $rules]
+	    if { [expr $prule] } {
+		incr match
+	    }
+	}
+    }
+
+    return $match
+}
+
+
+# ::imgop::__rules -- Compile transparency rules
+#
+#	Turn an RGB list of colour expressions, as accepted by
+#	transparent, into a single expression operating on the
+#	variables r, g and b.  Simple integers are amended and
+#	prepended with ==.  Since the same expression object is
+#	evaluated for all pixels, it is only byte-compiled once.
+#
+# Arguments:
+#	bg	RGB list of colour expressions
+#
+# Results:
+#	Return the expression.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__rules { bg } {
+    set exp [list]
+    foreach c {r g b} rule $bg {
+	if { [string is integer -strict $rule] } {
+	    lappend exp "(\$$c == $rule)"
+	} else {
+	    lappend exp "(\$$c $rule)"
+	}
+    }
+    return [join $exp " && "]
+}
+
+
+# ::imgop::__transparency -- Transparency kernel
+#
+#	Make all pixels of a Tk image matching an expression
+#	transparent, see __rules.
+#
+# Arguments:
+#	img	Image to process.
+#	cond	Expression on r, g and b, as returned by __rules
+#
+# Results:
+#	Return the number of pixels that were made transparent.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__transparency { img cond } {
+    set no_trans 0
     set w [image width $img]
     set h [image height $img]
     for { set xx 0 } { $xx < $w } { incr xx } {
 	for { set yy 0 } { $yy < $h } { incr yy } {
 	    foreach {r g b} [$img get $xx $yy] break
-	    if { [expr $r $exp_r] && [expr $g $exp_g] && [expr $b $exp_b] } {
+	    if { [expr $cond] } {
 		incr no_trans
 		$img transparency set $xx $yy 1
 	    }
 	}
     }
+    return $no_trans
+}
+
+
+# ::imgop::crop -- Crop an existing Tk image
+#
+#	Copy a rectangular area of a Tk image into a new image.  The
+#	area is clipped to the dimensions of the source image.
+#
+# Arguments:
+#	src	Source image
+#	x	Left of area
+#	y	Top of area
+#	width	Width of area
+#	height	Height of area
+#	dst	Destination image (optional, in that case generated name)
+#
+# Results:
+#	Return the name of the destination image, an empty string on
+#	errors.
+#
+# Side Effects:
+#	None.
+proc ::imgop::crop { src x y width height { dst "" } } {
+    variable IMGOP
+    variable log
+
+    set x2 [expr {$x + $width}]
+    set y2 [expr {$y + $height}]
+    if { $x2 > [image width $src] } { set x2 [image width $src] }
+    if { $y2 > [image height $src] } { set y2 [image height $src] }
+    if { $x < 0 || $y < 0 || $x2 <= $x || $y2 <= $y } {
+	${log}::warn "Crop area $x,$y ${width}x${height} outside of $src"
+	return ""
+    }
+
+    if { $dst eq "" } {
+	set dst [image create photo]
+    } elseif { [lsearch -exact [image names] $dst] < 0 } {
+	set dst [image create photo $dst]
+    }
+    $dst configure -width [expr {$x2 - $x}] -height [expr {$y2 - $y}]
+    $dst copy $src -from $x $y $x2 $y2
+
+    return $dst
+}
+
+
+# ::imgop::transparent -- Make pixels in an image transparent
+#
+#	Makes all pixels of a given colour in a Tk image transparent.
+#	Colour selection is based on expressions, so that all < or >
+#	or any other signs can be used.  The current colour of the
+#	image pixel is always prepended to the expression before being
+#	evaluated.  Simple integers will automatically be amended and
+#	prepended with ==, which is the default awaited (and original)
+#	behaviour of this procedure!
+#
+# Arguments:
+#	img	Image to process.
+#	bg	RGB list of "background" colour expressions to make transparent
+#
+# Results:
+#	Return the number of pixels that were made transparent.
+#
+# Side Effects:
+#	None.
+proc ::imgop::transparent { img { bg "0 0 0" } } {
+    variable IMGOP
+    variable log
 
+    ${log}::debug "Making pixels in image $img transparent: $bg"
+    set no_trans [__transparency $img [__rules $bg]]
     ${log}::notice "Made $no_trans pixel(s) transparent in $img"
 
     return $no_trans
@@ -910,6 +1811,675 @@ proc ::imgop::opaque { img { bg "" } } {
 
 
 
+# ::imgop::__chain -- Check and compile a chain of operations
+#
+#	Check a declarative chain of operations, as accepted by batch,
+#	and compile it for execution.  Transparency rules are
+#	compiled once for the whole batch, see __rules.
+#
+# Arguments:
+#	chain	List of operations
+#
+# Results:
+#	Return the compiled chain, an empty list on errors.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__chain { chain } {
+    variable IMGOP
+    variable log
+
+    set ops [list]
+    set encode 0
+    foreach op $chain {
+	if { $encode } {
+	    ${log}::warn "encode must be the last operation of a chain"
+	    return [list]
+	}
+	switch -- [lindex $op 0] {
+	    decode {
+	    }
+	    crop {
+		if { [llength $op] != 5 } {
+		    ${log}::warn "Wrong crop operation '$op', should be\
+                                  crop x y width height"
+		    return [list]
+		}
+		lappend ops $op
+	    }
+	    resize {
+		if { [llength $op] != 3 } {
+		    ${log}::warn "Wrong resize operation '$op', should be\
+                                  resize width height"
+		    return [list]
+		}
+		lappend ops $op
+	    }
+	    transparent {
+		set bg [lindex $op 1]
+		if { [llength $bg] != 3 } {
+		    ${log}::warn "Wrong transparent operation '$op', should\
+                                  be transparent {r g b}"
+		    return [list]
+		}
+		lappend ops [list transparent $bg [__rules $bg]]
+	    }
+	    encode {
+		if { [llength $op] < 2 || [llength $op] > 3 } {
+		    ${log}::warn "Wrong encode operation '$op', should be\
+                                  encode format ?dir?"
+		    return [list]
+		}
+		lappend ops [list encode [lindex $op 1] [lindex $op 2]]
+		set encode 1
+	    }
+	    default {
+		${log}::warn "Unknown operation '[lindex $op 0]'"
+		return [list]
+	    }
+	}
+    }
+    if { ! $encode } {
+	${log}::warn "Chain does not end with an encode operation"
+	return [list]
+    }
+
+    return $ops
+}
+
+
+# ::imgop::__magickargs -- Express a chain using ImageMagick
+#
+#	Translate a compiled chain into arguments to ImageMagick
+#	convert.  Transparency is only expressible when it targets a
+#	single colour.  When the chain starts with a resize, a size
+#	hint is passed to the JPEG decoder, as for thumbnails.
+#
+# Arguments:
+#	ops	Compiled chain, as returned by __chain
+#	pre_p	Name of variable to store arguments to place before input
+#	post_p	Name of variable to store arguments to place after input
+#
+# Results:
+#	Return 1 if the chain could be translated, 0 otherwise.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__magickargs { ops pre_p post_p } {
+    upvar $pre_p pre
+    upvar $post_p post
+
+    set pre [list]
+    set post [list]
+    foreach op $ops {
+	switch -- [lindex $op 0] {
+	    crop {
+		foreach {x y w h} [lrange $op 1 end] break
+		lappend post -crop "${w}x${h}+${x}+${y}" +repage
+	    }
+	    resize {
+		foreach {w h} [lrange $op 1 end] break
+		if { $w < 0 && $h < 0 } {
+		    continue
+		} elseif { $w < 0 } {
+		    lappend post -resize "x${h}"
+		} elseif { $h < 0 } {
+		    lappend post -resize "${w}x"
+		} else {
+		    if { [llength $post] == 0 } {
+			lappend pre -define jpeg:size=${w}x${h}
+		    }
+		    lappend post -resize "${w}x${h}!"
+		}
+	    }
+	    transparent {
+		foreach c [lindex $op 1] {
+		    if { ![string is integer -strict $c] } {
+			return 0
+		    }
+		}
+		foreach {r g b} [lindex $op 1] break
+		lappend post -transparent [format "rgb(%d,%d,%d)" $r $g $b]
+	    }
+	}
+    }
+
+    return 1
+}
+
+
+# ::imgop::__batchout -- Destination of a file in a batch
+#
+#	Compute the path to the file that will be encoded out of an
+#	input file.
+#
+# Arguments:
+#	fname	Path to input file
+#	encode	Compiled encode operation
+#
+# Results:
+#	Return the path to the output file.
+#
+# Side Effects:
+#	Creates the output directory if necessary.
+proc ::imgop::__batchout { fname encode } {
+    foreach {fmt dir} [lrange $encode 1 end] break
+    if { $dir eq "" } {
+	set dir [file dirname $fname]
+    } elseif { ![file isdirectory $dir] } {
+	file mkdir $dir
+    }
+    return [file join $dir [file rootname [file tail $fname]].$fmt]
+}
+
+
+# ::imgop::__batchstage -- Account for the execution of a stage
+#
+#	Account for the time spent in one of the stages of a batch.
+#
+# Arguments:
+#	id	Identifier of batch
+#	stage	Name of stage
+#	ms	Milliseconds spent in the stage, empty when unknown
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__batchstage { id stage ms } {
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    if { ![info exists BATCH(stage,$stage)] } {
+	lappend BATCH(stages) $stage
+	set BATCH(stage,$stage) [list 0 $ms]
+    }
+    foreach {count total} $BATCH(stage,$stage) break
+    if { $ms ne "" && $total ne "" } {
+	set total [expr {$total + $ms}]
+    }
+    set BATCH(stage,$stage) [list [incr count] $total]
+}
+
+
+# ::imgop::__batchreport -- Report the outcome of a file in a batch
+#
+#	Account for the result of the processing of a file and
+#	deliver it to the callback of the batch, if any.
+#
+# Arguments:
+#	id	Identifier of batch
+#	fname	Path to input file
+#	out	Path to output file
+#	err	Error message, empty on success
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Removes partial output on errors.
+proc ::imgop::__batchreport { id fname out err } {
+    variable log
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    if { $err eq "" } {
+	incr BATCH(done)
+    } else {
+	${log}::warn "Could not process $fname: $err"
+	catch {file delete $out}
+	incr BATCH(failed)
+    }
+    if { $BATCH(-command) ne "" } {
+	if { [catch {uplevel \#0 $BATCH(-command) \
+			 [list $fname $out $err]} res] } {
+	    ${log}::warn "Error when delivering result of $fname: $res"
+	}
+    }
+}
+
+
+# ::imgop::__batchfile -- Run a chain on a file
+#
+#	Run a compiled chain on a file using the Tk image kernels of
+#	this module, from decoding the file to encoding the result.
+#	Only files are taken and produced, so that this can run in
+#	worker threads, see batch.
+#
+# Arguments:
+#	fname	Path to input file
+#	out	Path to output file
+#	ops	Compiled chain, as returned by __chain
+#
+# Results:
+#	Return a list composed of an error message (empty on success)
+#	and of an even list with the milliseconds spent in each
+#	operation that was performed.
+#
+# Side Effects:
+#	Writes the output file.
+proc ::imgop::__batchfile { fname out ops } {
+    set err ""
+    set timings [list]
+    set t0 [clock clicks -milliseconds]
+    set img [loadimage $fname]
+    if { $img eq "" } {
+	return [list "could not decode" $timings]
+    }
+    set now [clock clicks -milliseconds]
+    lappend timings decode [expr {$now - $t0}]
+    set t0 $now
+    foreach op $ops {
+	set res $img
+	switch -- [lindex $op 0] {
+	    crop {
+		foreach {x y w h} [lrange $op 1 end] break
+		set res [crop $img $x $y $w $h]
+	    }
+	    resize {
+		foreach {w h} [lrange $op 1 end] break
+		set res [imgresize $img $w $h]
+	    }
+	    transparent {
+		__transparency $img [lindex $op 2]
+	    }
+	    encode {
+		if { [catch {$img write $out -format [lindex $op 1]} e] } {
+		    set err $e
+		}
+	    }
+	}
+	if { $res ne $img } {
+	    image delete $img
+	    set img $res
+	}
+	if { $img eq "" } {
+	    set err "[lindex $op 0] failed"
+	}
+	if { $err ne "" } {
+	    break
+	}
+	set now [clock clicks -milliseconds]
+	lappend timings [lindex $op 0] [expr {$now - $t0}]
+	set t0 $now
+    }
+    if { $img ne "" } {
+	image delete $img
+    }
+
+    return [list $err $timings]
+}
+
+
+# ::imgop::__batchdone -- A file of a batch has been processed
+#
+#	Account for the time spent in the operations on a file of a
+#	batch, report on the file and go on with the next files.
+#	This is called in the main thread by worker threads.
+#
+# Arguments:
+#	id	Identifier of batch
+#	fname	Path to input file
+#	out	Path to output file
+#	err	Error message, empty on success
+#	timings	Even list of operations and milliseconds spent in them
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__batchdone { id fname out err timings } {
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    if { ![info exists BATCH] } {
+	return
+    }
+    foreach {stage ms} $timings {
+	__batchstage $id $stage $ms
+    }
+    __batchreport $id $fname $out $err
+    if { $BATCH(engine) eq "tk" } {
+	set BATCH(timer) [after 0 [list [namespace current]::__batchrun $id]]
+    } else {
+	incr BATCH(running) -1
+	__batchspawn $id
+    }
+}
+
+
+# ::imgop::__batchrun -- Process next file of a batch in-process
+#
+#	Run the chain on the next file of a batch in this thread.
+#	Files are processed one at a time, giving the event loop a
+#	chance to run in between.
+#
+# Arguments:
+#	id	Identifier of batch
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__batchrun { id } {
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    set BATCH(timer) ""
+    if { [llength $BATCH(queue)] == 0 } {
+	__batchend $id
+	return
+    }
+    set fname [lindex $BATCH(queue) 0]
+    set BATCH(queue) [lrange $BATCH(queue) 1 end]
+
+    set out [__batchout $fname [lindex $BATCH(ops) end]]
+    foreach {err timings} [__batchfile $fname $out $BATCH(ops)] break
+    __batchdone $id $fname $out $err $timings
+}
+
+
+# ::imgop::__batchspawn -- Start as many workers as allowed
+#
+#	Start ImageMagick processes, or post jobs to the pool of
+#	worker threads, for the next files of a batch until -parallel
+#	of them are running.  Batches which worker threads cannot be
+#	started go on in this thread, see __batchrun.
+#
+# Arguments:
+#	id	Identifier of batch
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Starts external processes or threads.
+proc ::imgop::__batchspawn { id } {
+    variable log
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    set BATCH(timer) ""
+    while { $BATCH(running) < $BATCH(-parallel) \
+		&& [llength $BATCH(queue)] > 0 } {
+	set fname [lindex $BATCH(queue) 0]
+	set BATCH(queue) [lrange $BATCH(queue) 1 end]
+	set out [__batchout $fname [lindex $BATCH(ops) end]]
+
+	if { $BATCH(engine) eq "threads" } {
+	    if { [catch {::tpool::post -detached $BATCH(pool) \
+			     [list ::__imgop_batchfile [::thread::id] $id \
+				  $fname $out $BATCH(ops)]} err] } {
+		${log}::notice "Could not start worker threads ($err),\
+                                processing in this thread instead"
+		set BATCH(queue) [linsert $BATCH(queue) 0 $fname]
+		if { $BATCH(running) == 0 } {
+		    __batchthreads $id
+		    set BATCH(engine) "tk"
+		    set BATCH(timer) \
+			[after 0 [list [namespace current]::__batchrun $id]]
+		}
+		return
+	    }
+	    incr BATCH(running)
+	    continue
+	}
+
+	set cmd [concat | $BATCH(convert) $BATCH(pre) \
+		     [list [file nativename [file normalize $fname]]] \
+		     $BATCH(post) \
+		     [list [file nativename [file normalize $out]] 2>@1]]
+	if { [catch {open $cmd r} fd] } {
+	    __batchreport $id $fname $out $fd
+	    continue
+	}
+	fconfigure $fd -blocking 0
+	set BATCH(fd,$fd) [list $fname $out]
+	set BATCH(output,$fd) ""
+	fileevent $fd readable [list [namespace current]::__batchread $id $fd]
+	incr BATCH(running)
+    }
+
+    if { $BATCH(running) == 0 } {
+	__batchend $id
+    }
+}
+
+
+# ::imgop::__batchread -- Collect output of ImageMagick process
+#
+#	Collect the output of one of the ImageMagick processes of a
+#	batch and report on the file once the process has ended.
+#	ImageMagick runs all the operations of the chain at once,
+#	their stages only count files and the time spent in them is
+#	unknown.
+#
+# Arguments:
+#	id	Identifier of batch
+#	fd	Pipe to process
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Starts processes for the next files of the batch.
+proc ::imgop::__batchread { id fd } {
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    append BATCH(output,$fd) [read $fd]
+    if { ![eof $fd] } {
+	return
+    }
+
+    fconfigure $fd -blocking 1
+    set err ""
+    if { [catch {close $fd} e] } {
+	set err [string trim $BATCH(output,$fd)]
+	if { $err eq "" } {
+	    set err $e
+	}
+    }
+    foreach {fname out} $BATCH(fd,$fd) break
+    unset BATCH(fd,$fd) BATCH(output,$fd)
+
+    set timings [list]
+    if { $err eq "" } {
+	lappend timings decode ""
+	foreach op $BATCH(ops) {
+	    lappend timings [lindex $op 0] ""
+	}
+    }
+    __batchdone $id $fname $out $err $timings
+}
+
+
+# ::imgop::__batchthreads -- Release the worker threads of a batch
+#
+#	Release the pool of worker threads of a batch, if any.  This
+#	should only happen once no job is running in the pool.
+#
+# Arguments:
+#	id	Identifier of batch
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Worker threads exit.
+proc ::imgop::__batchthreads { id } {
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    if { $BATCH(pool) ne "" } {
+	catch {::tpool::release $BATCH(pool)}
+	set BATCH(pool) ""
+    }
+}
+
+
+# ::imgop::__batchend -- End a batch
+#
+#	Summarise the throughput of a batch and deliver it to the
+#	-done callback of the batch.
+#
+# Arguments:
+#	id	Identifier of batch
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Releases the worker threads of the batch.
+proc ::imgop::__batchend { id } {
+    variable log
+    upvar \#0 ::imgop::batch_$id BATCH
+
+    __batchthreads $id
+    set elapsed [expr {[clock clicks -milliseconds] - $BATCH(start)}]
+
+    # Summarise throughput of the whole batch and of each stage.
+    set stages [list]
+    foreach stage $BATCH(stages) {
+	foreach {count ms} $BATCH(stage,$stage) break
+	if { $ms eq "" } {
+	    set rate ""
+	} elseif { $ms > 0 } {
+	    set rate [expr {1000.0*$count/$ms}]
+	} else {
+	    set rate 0.0
+	}
+	lappend stages $stage [list $count $ms $rate]
+    }
+    set files [expr {$BATCH(done) + $BATCH(failed)}]
+    set stats [list files $files done $BATCH(done) \
+		   failed $BATCH(failed) elapsed $elapsed \
+		   rate [expr {$elapsed>0 ? 1000.0*$BATCH(done)/$elapsed : 0.0}]\
+		   engine $BATCH(engine) stages $stages]
+    ${log}::notice "Batch of $files file(s) done in ${elapsed}ms\
+                    ($BATCH(engine)): $BATCH(failed) failure(s)"
+    set cmd $BATCH(-done)
+    unset BATCH
+
+    if { $cmd ne "" } {
+	if { [catch {uplevel \#0 $cmd [list $stats]} res] } {
+	    ${log}::warn "Error when delivering end of batch $id: $res"
+	}
+    }
+}
+
+
+# ::imgop::batch -- Run a chain of operations on many image files
+#
+#	Run a declarative chain of operations on a list of image
+#	files.  The chain is a list of operations, each operation
+#	being a list led by its name:
+#	  decode                   Read the file (always performed first)
+#	  crop x y width height    Keep a rectangular area
+#	  resize width height      Resize, keep ratio if negative
+#	  transparent {r g b}      Make pixels transparent, see transparent
+#	  encode format ?dir?      Write result, must be last
+#	Output files have the same root name as the input files and
+#	the format as an extension, they are placed in dir or next to
+#	the input files.  Whenever the chain can be expressed using
+#	ImageMagick, files are processed by up to -parallel
+#	concurrent processes.  Otherwise, files are processed by up
+#	to -parallel worker threads when the Thread extension is
+#	available, each thread decoding and encoding files with its
+#	own Tk.  Files are processed one at a time from the event loop
+#	in all other cases.  The number of images in memory is bounded
+#	and results are delivered as soon as files are done: the
+#	command passed to -command is called with the path to the
+#	input file, the path to the output file and an error message
+#	(empty on success).  The batch runs from the event loop, the
+#	command passed to -done is called with a description of the
+#	whole batch once all files have been processed.  The
+#	description is an even list: files, done and failed contain
+#	the number of files, elapsed the number of milliseconds spent,
+#	rate the number of files per second and engine how files were
+#	processed (imagemagick, threads or tk).  stages is an even list
+#	where each stage (decode and the operations of the chain) is
+#	described by a list containing the number of files that have
+#	passed the stage, the milliseconds spent in the stage and the
+#	number of files per second.  With threads, the milliseconds
+#	are summed over all threads.  ImageMagick runs the whole chain
+#	at once, the time spent in each operation is then unknown and
+#	both the milliseconds and the rate are empty.
+#
+# Arguments:
+#	files	List of paths to input files
+#	chain	List of operations
+#	args	List of dash-led options and their values: -parallel
+#		(number of concurrent processes or threads, 0 to force
+#		execution in this thread), -command (called for each
+#		file), -done (called at the end of the batch)
+#
+# Results:
+#	Return an identifier for the batch, an empty string when the
+#	chain is wrong.
+#
+# Side Effects:
+#	Might start external processes or threads.
+proc ::imgop::batch { files chain args } {
+    variable IMGOP
+    variable log
+
+    set ops [__chain $chain]
+    if { [llength $ops] == 0 } {
+	return ""
+    }
+
+    set id [incr IMGOP(batches)]
+    upvar \#0 ::imgop::batch_$id BATCH
+    array set BATCH [list \
+			 -parallel $IMGOP(-parallel) \
+			 -command  "" \
+			 -done     "" \
+			 ops       $ops \
+			 queue     $files \
+			 running   0 \
+			 done      0 \
+			 failed    0 \
+			 engine    tk \
+			 pool      "" \
+			 stages    [list] \
+			 timer     ""]
+    foreach {opt val} $args {
+	if { ![info exists BATCH($opt)] || [string index $opt 0] ne "-" } {
+	    ${log}::warn "Unknown option $opt"
+	    unset BATCH
+	    return ""
+	}
+	set BATCH($opt) $val
+    }
+
+    set BATCH(convert) ""
+    if { $BATCH(-parallel) > 0 \
+	     && [__magickargs $ops BATCH(pre) BATCH(post)] } {
+	set BATCH(convert) [__convert]
+    }
+
+    set BATCH(start) [clock clicks -milliseconds]
+    if { $BATCH(convert) ne "" } {
+	${log}::info "Processing [llength $files] file(s) using up to\
+                      $BATCH(-parallel) ImageMagick process(es)"
+	set BATCH(engine) imagemagick
+    } elseif { $BATCH(-parallel) > 0 && $IMGOP(threadcapable) } {
+	${log}::info "Processing [llength $files] file(s) using up to\
+                      $BATCH(-parallel) worker thread(s)"
+	set BATCH(engine) threads
+	set BATCH(pool) [::tpool::create -maxworkers $BATCH(-parallel) \
+			     -initcmd $IMGOP(workerinit)]
+    } else {
+	${log}::info "Processing [llength $files] file(s) in-process"
+    }
+    # Never deliver results before the caller knows the batch.
+    if { $BATCH(engine) eq "tk" } {
+	set BATCH(timer) [after idle [list [namespace current]::__batchrun $id]]
+    } else {
+	set BATCH(timer) [after idle [list [namespace current]::__batchspawn $id]]
+    }
+
+    return $id
+}
+
+
 # ::imgop::__init -- Initialise module
 #
 #	This command initialises the module internals once and only once.
@@ -9,3 +9,4 @@
 # full path name of this file's directory.
 
 package ifneeded imgop 0.1 [list source [file join $dir imgop.tcl]]
+package ifneeded imgop::sniff 0.1 [list source [file join $dir sniff.tcl]]
@@ -0,0 +1,81 @@
+# sniff.tcl -- Recognise image files
+#
+#	This module recognises the format of image files from the magic
+#	bytes at their beginning.  It is part of imgop, but does not
+#	depend on Tk, so that it can also be loaded in threads that
+#	have no Tk, e.g. to sort out the files of a directory in the
+#	background.
+#
+# Copyright (c) 2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+package require Tcl 8.4
+
+namespace eval ::imgop {}
+
+
+# ::imgop::__format -- Guess format of an image file
+#
+#	Guess the format of an image file from the magic bytes at its
+#	beginning.
+#
+# Arguments:
+#	hdr	First bytes of the file.
+#
+# Results:
+#	Return one of png, jpeg, gif, bmp, pnm, tiff or webp, an empty
+#	string if the format is not recognised.
+#
+# Side Effects:
+#	None.
+proc ::imgop::__format { hdr } {
+    if { [string range $hdr 0 7] eq "\x89PNG\r\n\x1A\n" } {
+	return png
+    } elseif { [string range $hdr 0 2] eq "\xFF\xD8\xFF" } {
+	return jpeg
+    } elseif { [string range $hdr 0 5] eq "GIF87a" \
+		   || [string range $hdr 0 5] eq "GIF89a" } {
+	return gif
+    } elseif { [string range $hdr 0 1] eq "BM" } {
+	return bmp
+    } elseif { [regexp {^P[1-6]\s} $hdr] } {
+	return pnm
+    } elseif { [string range $hdr 0 3] eq "II*\x00" \
+		   || [string range $hdr 0 3] eq "MM\x00*" } {
+	return tiff
+    } elseif { [string range $hdr 0 3] eq "RIFF" \
+		   && [string range $hdr 8 11] eq "WEBP" } {
+	return webp
+    }
+    return ""
+}
+
+
+# ::imgop::sniff -- Guess format of an image file
+#
+#	Guess the format of an image file by only reading the first
+#	few (magic) bytes of the file.
+#
+# Arguments:
+#	fname	Path to file.
+#
+# Results:
+#	Return one of png, jpeg, gif, bmp, pnm, tiff or webp, an empty
+#	string if the file is not an image in a known format.
+#
+# Side Effects:
+#	None.
+proc ::imgop::sniff { fname } {
+    if { [catch {open $fname r} f] } {
+	return ""
+    }
+    fconfigure $f -translation binary
+    set hdr [read $f 16]
+    close $f
+    return [__format $hdr]
+}
+
+
+package provide imgop::sniff 0.1
@@ -23,6 +23,9 @@ namespace eval ::init {
             -load        {uobj}
             -log         ""
             -language    "en"
+            -manifest    "~/.til/%progname%.manifest"
+            -trace       ""
+            -traceprocs  {::*::__init ::winop::__ks_read ::winop::__ks_load}
             -messages    "msgs"
             -options     {}
             -outlog      ""
@@ -40,6 +43,12 @@ namespace eval ::init {
             argv         ""
             argv_copied  0
             inits        {}
+            manifest     ""
+            mfpath       ""
+            mfdirty      0
+            trace        ""
+            traced       {}
+            tracestamp   ""
             src_locs     {. "./sources/%progname%" "./modules/%progname%" "./src/%progname%" "./sources" "./modules" "./src"}
         }
         variable forced_opts {
@@ -49,6 +58,10 @@ namespace eval ::init {
             { language.arg "" "Language to use in app, empty for OS language" }
         }
         variable libdir [file dirname [file normalize [info script]]]
+        variable MANIFEST;  # Resolved packages and sources, see __manifest_load
+        array set MANIFEST {}
+        variable TRACE;     # Trace events, see tracebegin
+        set TRACE [list]
     }
 }
 
@@ -367,6 +380,664 @@ proc ::init::configuration { { glbl_p "" } } {
 }
 
 
+# ::init::__manifest_key -- Compute startup manifest validity key
+#
+#       Compute the key against which the startup manifest is
+#       validated.  The key captures the application (path to and
+#       modification time of the main script or executable), the
+#       version of Tcl and the modification times of the library
+#       directories and of their immediate sub-directories, so that
+#       installing, removing or modifying a package or a source
+#       invalidates the manifest.
+#
+# Arguments:
+#	dirs	List of library directories
+#
+# Results:
+#       Return the key.
+#
+# Side Effects:
+#       None.
+proc ::init::__manifest_key { dirs } {
+    set main [main]
+    if { [catch {file mtime $main} mtime] } {
+        set mtime ""
+    }
+    set key [list $main $mtime [info patchlevel]]
+    foreach d $dirs {
+        if { [catch {file mtime $d} mtime] } {
+            lappend key $d ""
+            continue
+        }
+        lappend key $d $mtime
+        foreach sub [lsort [glob -nocomplain -directory $d -types d *]] {
+            if { [catch {file mtime $sub} mtime] == 0 } {
+                lappend key [file tail $sub] $mtime
+            }
+        }
+    }
+    
+    return $key
+}
+
+
+# ::init::__manifest_path -- Library search path of startup manifest
+#
+#       Compute the library search path at the time the manifest is
+#       loaded, i.e. the normalized auto_path (which depends on
+#       TCLLIBPATH among others), the dependencies of the application
+#       and the locations of direct sources.  Packages registered from
+#       the manifest would shadow packages found in new directories of
+#       the path, so the manifest is only valid for the path that it
+#       was saved with.
+#
+# Arguments:
+#	-- none -- Takes value from latest inited application
+#
+# Results:
+#       Return the search path.
+#
+# Side Effects:
+#       None.
+proc ::init::__manifest_path { } {
+    variable INIT
+    global auto_path
+    
+    # Access global array containing options.
+    upvar \#0 [lindex $INIT(inits) end] ARGS
+    
+    set dirs [list]
+    foreach d $auto_path {
+        lappend dirs [file normalize $d]
+    }
+    
+    return [list $dirs $ARGS(-depends) $INIT(src_locs)]
+}
+
+
+# ::init::__manifest_load -- Read startup manifest
+#
+#       Read the startup manifest that was saved by a previous run of
+#       the application, if it is still valid.  The manifest records
+#       where the packages of the application were found and their
+#       versions, together with the location of direct sources.
+#       Packages from the manifest are registered with package
+#       ifneeded so that requiring them does not scan the auto_path
+#       for package indices.  The manifest is stored at the location
+#       pointed at by the -manifest option, empty to switch it off.
+#
+# Arguments:
+#	-- none -- Takes value from latest inited application
+#
+# Results:
+#       Return 1 if a valid manifest was read, 0 otherwise.
+#
+# Side Effects:
+#       Registers packages from the manifest.
+proc ::init::__manifest_load { } {
+    variable INIT
+    variable MANIFEST
+    
+    # Access global array containing options.
+    upvar \#0 [lindex $INIT(inits) end] ARGS
+    
+    array unset MANIFEST
+    array set MANIFEST {}
+    set INIT(mfdirty) 1
+    set INIT(mfpath) [__manifest_path]
+    if { $ARGS(-manifest) eq "" } {
+        set INIT(manifest) ""
+        return 0
+    }
+    set INIT(manifest) [file normalize \
+            [string map [list %progname% [__clean_progname]] \
+                 $ARGS(-manifest)]]
+    
+    if { [catch {open $INIT(manifest)} fd] } {
+        log debug "No startup manifest at $INIT(manifest)"
+        return 0
+    }
+    set content [read $fd]
+    close $fd
+    if { [catch {array set M $content}] \
+             || ! [info exists M(key)] || ! [info exists M(dirs)] } {
+        log notice "Corrupted startup manifest at $INIT(manifest), ignoring"
+        return 0
+    }
+    if { ! [info exists M(path)] || $M(path) ne $INIT(mfpath) } {
+        log info "Library path has changed since startup manifest at\
+                  $INIT(manifest) was saved, ignoring"
+        return 0
+    }
+    if { $M(key) ne [__manifest_key $M(dirs)] } {
+        log info "Startup manifest at $INIT(manifest) is out of date"
+        return 0
+    }
+    
+    array set MANIFEST $content
+    set INIT(mfdirty) 0
+    set nb 0
+    foreach k [array names MANIFEST pkg,*] {
+        set pkg [string range $k 4 end]
+        foreach {ver script} $MANIFEST($k) break
+        if { [package provide $pkg] eq "" \
+                 && [package ifneeded $pkg $ver] eq "" } {
+            package ifneeded $pkg $ver $script
+            incr nb
+        }
+    }
+    log info "Registered $nb package(s) from startup manifest\
+              $INIT(manifest)"
+    
+    return 1
+}
+
+
+# ::init::__manifest_forget -- Forget packages from startup manifest
+#
+#       Forget all the packages of the manifest that have not been
+#       loaded yet, so that they will be looked for in the auto_path
+#       again.  This is used when requiring a package fails, which
+#       means that the manifest is out of sync with the disk.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#       Return 1 if there were packages to forget, 0 otherwise.
+#
+# Side Effects:
+#       Forgets registered packages.
+proc ::init::__manifest_forget { } {
+    variable INIT
+    variable MANIFEST
+    
+    set forgotten 0
+    foreach k [array names MANIFEST pkg,*] {
+        set pkg [string range $k 4 end]
+        if { [package provide $pkg] eq "" } {
+            package forget $pkg
+            unset MANIFEST($k)
+            set INIT(mfdirty) 1
+            set forgotten 1
+        }
+    }
+    
+    return $forgotten
+}
+
+
+# ::init::__manifest_save -- Save startup manifest
+#
+#       Save the startup manifest for the next run of the
+#       application, if it has changed.  The manifest records all
+#       packages that were loaded from the auto_path, the direct
+#       sources that were located, the library search path at the
+#       time the manifest was loaded and the validity key for the
+#       library directories.
+#
+# Arguments:
+#	-- none -- Takes value from latest inited application
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       (Atomically) writes the manifest file
+proc ::init::__manifest_save { } {
+    variable INIT
+    variable MANIFEST
+    variable libdir
+    global auto_path
+    
+    if { $INIT(manifest) eq "" } {
+        return
+    }
+    
+    # Collect the packages that are loaded and that were not provided
+    # statically.
+    foreach pkg [package names] {
+        set ver [package provide $pkg]
+        if { $ver ne "" } {
+            set script [package ifneeded $pkg $ver]
+            if { $script ne "" } {
+                if { ! [info exists MANIFEST(pkg,$pkg)] \
+                         || $MANIFEST(pkg,$pkg) ne [list $ver $script] } {
+                    set MANIFEST(pkg,$pkg) [list $ver $script]
+                    set INIT(mfdirty) 1
+                }
+            }
+        }
+    }
+    
+    # Directories that the validity of the manifest depends on.
+    set progname [file rootname [file tail $::argv0]]
+    set dirs [list]
+    foreach d $auto_path {
+        lappend dirs [file normalize $d]
+    }
+    foreach d $INIT(src_locs) {
+        lappend dirs [file normalize [string map [list %progname% $progname] \
+                                          [file join $libdir $d]]]
+    }
+    set valid [list]
+    foreach d $dirs {
+        if { [file isdirectory $d] && [lsearch -exact $valid $d] < 0 } {
+            lappend valid $d
+        }
+    }
+    if { ! [info exists MANIFEST(dirs)] || $MANIFEST(dirs) ne $valid } {
+        set MANIFEST(dirs) $valid
+        set INIT(mfdirty) 1
+    }
+    if { ! [info exists MANIFEST(path)] || $MANIFEST(path) ne $INIT(mfpath) } {
+        set MANIFEST(path) $INIT(mfpath)
+        set INIT(mfdirty) 1
+    }
+    
+    if { ! $INIT(mfdirty) } {
+        return
+    }
+    set MANIFEST(key) [__manifest_key $valid]
+    set tmp $INIT(manifest).[pid]
+    if { [catch {
+        file mkdir [file dirname $INIT(manifest)]
+        set fd [open $tmp w]
+        foreach k [lsort [array names MANIFEST]] {
+            puts $fd [list $k $MANIFEST($k)]
+        }
+        close $fd
+        file rename -force $tmp $INIT(manifest)
+    } err] } {
+        log warn "Could not save startup manifest to $INIT(manifest): $err"
+        catch {file delete $tmp}
+    } else {
+        log debug "Saved startup manifest to $INIT(manifest)"
+        set INIT(mfdirty) 0
+    }
+}
+
+
+# ::init::tracestart -- Start tracing
+#
+#       Start recording trace events for the initialisation phases
+#       and for the procedures registered through traceprocs.  Events
+#       are kept in memory and written as Chrome trace JSON (as read
+#       by chrome://tracing or Perfetto) to the file when the
+#       application exits, or whenever tracedump is called.  Tracing
+#       is also started by init when the TIL_TRACE environment
+#       variable or the -trace option point to a file.
+#
+# Arguments:
+#	fname	Path to trace file
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Arranges for the trace file to be written at exit.
+proc ::init::tracestart { fname } {
+    variable INIT
+    
+    if { $INIT(trace) eq "" } {
+        trace add execution exit enter [list ::init::__traceexit]
+        # Catch procedures as they are created, some modules call
+        # their procedures as soon as they are sourced.
+        trace add execution proc leave [list ::init::__traceproc]
+    }
+    set INIT(trace) [file normalize $fname]
+    
+    # Prefer real microseconds, clicks are good enough on 8.4.
+    if { [catch {clock microseconds}] } {
+        set INIT(tracestamp) [list clock clicks]
+    } else {
+        set INIT(tracestamp) [list clock microseconds]
+    }
+    log notice "Tracing to $INIT(trace)"
+    __traceinstall
+}
+
+
+# ::init::tracebegin -- Begin a trace span
+#
+#       Record the beginning of a span, this is a no-op when tracing
+#       is off.
+#
+# Arguments:
+#	name	Name of span
+#	cat	Category of span
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::init::tracebegin { name { cat "init" } } {
+    variable INIT
+    variable TRACE
+    
+    if { $INIT(trace) ne "" } {
+        lappend TRACE [list B $name $cat [eval $INIT(tracestamp)]]
+    }
+}
+
+
+# ::init::traceend -- End a trace span
+#
+#       Record the end of a span started with tracebegin, this is a
+#       no-op when tracing is off.
+#
+# Arguments:
+#	name	Name of span
+#	cat	Category of span
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::init::traceend { name { cat "init" } } {
+    variable INIT
+    variable TRACE
+    
+    if { $INIT(trace) ne "" } {
+        lappend TRACE [list E $name $cat [eval $INIT(tracestamp)]]
+    }
+}
+
+
+# ::init::__traceenter -- Record entry in traced procedure
+#
+#       Execution trace callback for procedures that are traced.
+#
+# Arguments:
+#	name	Fully-qualified name of procedure
+#	cmd	Command being executed
+#	op	Trace operation (enter)
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::init::__traceenter { name cmd op } {
+    variable INIT
+    variable TRACE
+    
+    lappend TRACE [list B $name proc [eval $INIT(tracestamp)]]
+}
+
+
+# ::init::__traceleave -- Record exit from traced procedure
+#
+#       Execution trace callback for procedures that are traced.
+#
+# Arguments:
+#	name	Fully-qualified name of procedure
+#	cmd	Command being executed
+#	code	Result code of the command
+#	result	Result of the command
+#	op	Trace operation (leave)
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       None.
+proc ::init::__traceleave { name cmd code result op } {
+    variable INIT
+    variable TRACE
+    
+    lappend TRACE [list E $name proc [eval $INIT(tracestamp)]]
+}
+
+
+# ::init::__tracematch -- Match procedure against registered patterns
+#
+#       Check whether a procedure matches one of the patterns
+#       registered for tracing, see __traceinstall.
+#
+# Arguments:
+#	p	Fully-qualified name of procedure
+#
+# Results:
+#       Return 1 if the procedure should be traced, 0 otherwise.
+#
+# Side Effects:
+#       None.
+proc ::init::__tracematch { p } {
+    variable INIT
+    
+    if { [llength $INIT(inits)] > 0 } {
+        upvar \#0 [lindex $INIT(inits) end] ARGS
+    } else {
+        upvar \#0 [namespace current]::INIT ARGS
+    }
+    
+    set ns [namespace qualifiers $p]
+    foreach ptn $ARGS(-traceprocs) {
+        set pns [namespace qualifiers $ptn]
+        if { [string match [namespace tail $ptn] [namespace tail $p]] \
+                 && [namespace qualifiers $pns] eq [namespace qualifiers $ns] \
+                 && [string match $pns $ns] } {
+            return 1
+        }
+    }
+    return 0
+}
+
+
+# ::init::__traceone -- Install traces on a procedure
+#
+#       Install the execution traces on a procedure, unless they
+#       already are in place.  Traces are bound to the qualified name
+#       of the procedure, so that spans are named the same however
+#       the procedure is called.
+#
+# Arguments:
+#	p	Fully-qualified name of procedure
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Installs execution traces.
+proc ::init::__traceone { p } {
+    variable INIT
+    
+    set enter [list ::init::__traceenter $p]
+    if { [lsearch -exact [trace info execution $p] [list enter $enter]] < 0 } {
+        trace add execution $p enter $enter
+        trace add execution $p leave [list ::init::__traceleave $p]
+        if { [lsearch -exact $INIT(traced) $p] < 0 } {
+            lappend INIT(traced) $p
+        }
+        log debug "Tracing $p"
+    }
+}
+
+
+# ::init::__traceproc -- Trace procedures as they are created
+#
+#       Execution trace callback on proc, installs traces on new (or
+#       redefined) procedures that match the registered patterns.
+#
+# Arguments:
+#	cmd	Command being executed
+#	code	Result code of the command
+#	result	Result of the command
+#	op	Trace operation (leave)
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Installs execution traces.
+proc ::init::__traceproc { cmd code result op } {
+    variable INIT
+    
+    if { $code != 0 || $INIT(trace) eq "" } {
+        return
+    }
+    set p [uplevel 1 [list namespace which -command [lindex $cmd 1]]]
+    if { $p ne "" && [__tracematch $p] } {
+        __traceone $p
+    }
+}
+
+
+# ::init::__traceinstall -- Install traces on registered procedures
+#
+#       Install execution traces on all existing procedures that
+#       match the patterns registered for tracing.  Patterns are
+#       fully qualified and can contain glob-style characters in
+#       their last namespace qualifier and in the procedure name,
+#       e.g. ::*::__init.  Procedures that are created later on are
+#       picked up as they are created, see __traceproc.
+#
+# Arguments:
+#	-- none -- Takes value from latest inited application
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Installs execution traces.
+proc ::init::__traceinstall { } {
+    variable INIT
+    
+    if { $INIT(trace) eq "" } {
+        return
+    }
+    if { [llength $INIT(inits)] > 0 } {
+        upvar \#0 [lindex $INIT(inits) end] ARGS
+    } else {
+        upvar \#0 [namespace current]::INIT ARGS
+    }
+    
+    foreach ptn $ARGS(-traceprocs) {
+        set ns [namespace qualifiers $ptn]
+        set tail [namespace tail $ptn]
+        set namespaces [list]
+        if { $ns eq "" } {
+            lappend namespaces ""
+        } else {
+            set parent [namespace qualifiers $ns]
+            if { $parent eq "" } {
+                set parent ::
+            }
+            foreach child [namespace children $parent] {
+                if { [string match $ns $child] } {
+                    lappend namespaces $child
+                }
+            }
+        }
+        foreach child $namespaces {
+            foreach p [info procs ${child}::$tail] {
+                __traceone [namespace which -command $p]
+            }
+        }
+    }
+}
+
+
+# ::init::traceprocs -- Register procedures for tracing
+#
+#       Register procedures (or patterns, see __traceinstall) that
+#       should be traced, in addition to the ones of the -traceprocs
+#       option.  Nothing is installed when tracing is off, so that
+#       registered procedures run at full speed.
+#
+# Arguments:
+#	args	Fully-qualified procedure names or patterns
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Installs execution traces when tracing is on.
+proc ::init::traceprocs { args } {
+    variable INIT
+    
+    if { [llength $INIT(inits)] > 0 } {
+        upvar \#0 [lindex $INIT(inits) end] ARGS
+    } else {
+        upvar \#0 [namespace current]::INIT ARGS
+    }
+    foreach ptn $args {
+        if { [lsearch -exact $ARGS(-traceprocs) $ptn] < 0 } {
+            lappend ARGS(-traceprocs) $ptn
+        }
+    }
+    __traceinstall
+}
+
+
+# ::init::tracedump -- Write trace file
+#
+#       Write all trace events recorded so far as Chrome trace JSON.
+#
+# Arguments:
+#	fname	Path to file, empty for the file given to tracestart
+#
+# Results:
+#       Return the number of events written, -1 on errors.
+#
+# Side Effects:
+#       (Atomically) writes the trace file
+proc ::init::tracedump { { fname "" } } {
+    variable INIT
+    variable TRACE
+    
+    if { $fname eq "" } {
+        set fname $INIT(trace)
+    }
+    if { $fname eq "" } {
+        return -1
+    }
+    
+    set pid [pid]
+    set events [list]
+    foreach e $TRACE {
+        foreach {ph name cat ts} $e break
+        set name [string map [list \\ \\\\ \" \\\"] $name]
+        lappend events "\{\"name\":\"$name\",\"cat\":\"$cat\",\"ph\":\"$ph\",\"ts\":$ts,\"pid\":$pid,\"tid\":1\}"
+    }
+    
+    set tmp $fname.[pid]
+    if { [catch {
+        set fd [open $tmp w]
+        puts $fd "\{\"traceEvents\":\[\n[join $events ,\n]\n\],\"displayTimeUnit\":\"ms\"\}"
+        close $fd
+        file rename -force $tmp $fname
+    } err] } {
+        log warn "Could not write trace to $fname: $err"
+        catch {file delete $tmp}
+        return -1
+    }
+    
+    return [llength $events]
+}
+
+
+# ::init::__traceexit -- Write trace file at exit
+#
+#       Write the trace file when the application exits, this is
+#       installed as an execution trace on exit.
+#
+# Arguments:
+#	args	Arguments from the trace, ignored.
+#
+# Results:
+#       None.
+#
+# Side Effects:
+#       Writes the trace file
+proc ::init::__traceexit { args } {
+    catch {tracedump}
+}
+
+
 # ::init::dependencies -- Arrange for library access
 #
 #       Arrange to access libraries that this application depends on.
@@ -448,6 +1119,7 @@ proc ::init::modules { } {
 
 proc ::init::slocate { f { progname "" } } {
     variable INIT
+    variable MANIFEST
     variable libdir
     global argv0
     
@@ -478,12 +1150,20 @@ proc ::init::slocate { f { progname "" } } {
     if { $progname eq "" } {
         set progname [file rootname [file tail $argv0]]
     }
+    set mkey src,[list $f $progname $ARGS(-extensions)]
+    if { [info exists MANIFEST($mkey)] && [file readable $MANIFEST($mkey)] } {
+        return $MANIFEST($mkey)
+    }
     foreach d $INIT(src_locs) {
         set rd [string map [list %progname% $progname] [file join $libdir $d]]
         if { [file isdirectory $rd] } {
             foreach fn $fnames {
                 set fname [file join $rd $fn]
                 if { [file readable $fname] } {
+                    if { $INIT(manifest) ne "" } {
+                        set MANIFEST($mkey) $fname
+                        set INIT(mfdirty) 1
+                    }
                     return $fname
                 }
             }
@@ -598,16 +1278,22 @@ proc ::init::Require { pkg {v ""} {lazy 0} } {
         lappend cmd $v
     }
     
+    # Packages registered from a stale startup manifest can fail to
+    # load, forget about them and look in the auto_path again.
+    set code [catch {eval $cmd} ver]
+    if { $code && [__manifest_forget] } {
+        log notice "Startup manifest is stale, requiring $pkg again: $ver"
+        set code [catch {eval $cmd} ver]
+    }
+    if { $code == 0 } {
+        return $ver
+    }
+    
     # Accept (or not) when package cannot be loaded.
     if { [string is true $lazy] } {
-        if { [catch {eval $cmd} ver] == 0 } {
-            return $ver
-        } else {
-            log warn "Could not load package $pkg: $ver"
-        }
+        log warn "Could not load package $pkg: $ver"
     } else {
-        set ver [eval $cmd]
-        return $ver
+        return -code error -errorinfo $::errorInfo $ver
     }
     
     return ""
@@ -697,6 +1383,15 @@ proc ::init::packages { } {
 #       -splash    Path to picture for splash, relative to top directory,
 #                  empty splash will not load Tk/tile and not show a splash.
 #       -outlog    Procedure to receive log messages from all modules.
+#       -manifest  Path to startup manifest, recording where packages and
+#                  sources were found to speed up the next start, empty
+#                  to switch off.  %progname% is replaced by the name of
+#                  the program.
+#       -trace     Path to Chrome trace file for initialisation phases and
+#                  traced procedures, empty (the default) to switch off.
+#                  The TIL_TRACE environment variable has the same effect.
+#       -traceprocs List of procedures (or patterns) to trace, see
+#                  traceprocs.
 #       -booleans  List of options that are boolean option (their presence will
 #                  set the global variable to 1, otherwise 0).
 #       -progress  Number of additional progress states (see -callback)
@@ -791,6 +1486,17 @@ proc ::init::init { args } {
             -la* {
                 set ARGS(-language) $val
             }
+            -ma* {
+                set ARGS(-manifest) $val
+            }
+            -tracep* {
+                foreach p $val {
+                    lappend ARGS(-traceprocs) $p
+                }
+            }
+            -tr* {
+                set ARGS(-trace) $val
+            }
             -op* {
                 foreach spec $val {
                     lappend ARGS(-options) $spec
@@ -837,6 +1543,15 @@ proc ::init::init { args } {
     set INIT(argv) $argv
     set INIT(argv0) $argv0
     set INIT(argv_copied) 1
+    if { $ARGS(-trace) eq "" && [info exists ::env(TIL_TRACE)] } {
+        set ARGS(-trace) $::env(TIL_TRACE)
+    }
+    if { $ARGS(-trace) ne "" } {
+        tracestart $ARGS(-trace)
+    }
+    tracebegin init
+    __manifest_load
+    tracebegin options
     package require cmdline
     upvar \#0 $ARGS(-store) GLBL
     set inited [::argutil::initargs GLBL $ARGS(-options)]
@@ -854,6 +1569,7 @@ proc ::init::init { args } {
     foreach key $inited {
         ::argutil::makelist GLBL($key)
     }
+    traceend options
     
     # Fix package dependency depending on some of the options,
     # i.e. arrange to only require packages when the debug port is
@@ -917,10 +1633,11 @@ proc ::init::init { args } {
     
     # Arrange for accessing libraries and loading in packages of various
     # sorts.
-    dependencies
-    sources
-    modules
-    packages
+    foreach phase [list dependencies sources modules packages] {
+        tracebegin $phase
+        $phase
+        traceend $phase
+    }
     if { $ARGS(-outlog) ne "" } {
         ::argutil::logcb $ARGS(-outlog)
     }
@@ -941,7 +1658,9 @@ proc ::init::init { args } {
     
     # Read arguments from file if any, adapt verbosity if necessary
     log debug "Now read definitive program arguments list"
+    tracebegin arguments
     arguments
+    traceend arguments
     if { $ARGS(-splash) ne "" } {
         ::splash::progress $splash "Arguments read and parsed"
     }
@@ -964,7 +1683,9 @@ proc ::init::init { args } {
     }
     
     # Read configuration files for module-based settings
+    tracebegin configuration
     configuration GLBL
+    traceend configuration
     if { $ARGS(-splash) ne "" } {
         ::splash::progress $splash "Application configured"
     }
@@ -999,6 +1720,11 @@ proc ::init::init { args } {
         destroy $splash
     }
     
+    # Remember where everything was found for next time.
+    __manifest_save
+    traceend init
+    tracedump
+    
     return $ARGS(-store)
 }
 
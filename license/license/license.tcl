@@ -11,7 +11,10 @@
 #	customer "database", i.e. a file that contains customer
 #	identifiers, which are automatically generated for new
 #	customers.  This idea is however not mandatory and you could
-#	use any integer for the customer id.
+#	use any integer for the customer id.  New customers are
+#	appended to the database, which is cached in memory and
+#	indexed on disk so that it does not have to be parsed again
+#	each time.
 #
 # Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
 #
@@ -22,6 +25,7 @@ package require Tcl 8.4
 
 package require uobj
 package require md5
+package require lockfile
 
 namespace eval ::license {
     variable LC
@@ -42,9 +46,15 @@ namespace eval ::license {
 	    separator     "|"
 	    secret        "Change this to any secret pass, long is best!"
 	    dt_fmt        "%m/%d/%Y %H:%M"
+	    idgene        0
+	    lockwait      2000
+	    lockstale     10
+	    indexlag      1000
 	    generator     {algo_ver -product -version -expiration -customer -name -email -organisation}
 	}
 	variable libdir [file dirname [file normalize [info script]]]
+	variable USERDBS;  # Normalized path to user database -> cache array
+	array set USERDBS {}
 	::uobj::install_log [namespace current] LC; # Creates 'log' variable
 	::uobj::install_defaults [namespace current] LC
     }
@@ -103,38 +113,542 @@ proc ::license::__rand { } {
 }
 
 
+# ::license::__lock -- Acquire user database lock
+#
+#	Acquire the lock file that protects modifications of a user
+#	database between processes, waiting for at most LC(lockwait)
+#	milliseconds.  Locks that are older than LC(lockstale) seconds
+#	and which owner is gone are broken, see the lockfile library.
+#
+# Arguments:
+#	fname	Full path to user database
+#
+# Results:
+#	Return 1 if the lock was acquired, 0 otherwise.
+#
+# Side Effects:
+#	Creates the lock file.
+proc ::license::__lock { fname } {
+    variable LC
+    variable log
+
+    if { ! [::lockfile::acquire $fname.lock \
+		-wait $LC(lockwait) -stale $LC(lockstale)] } {
+	${log}::error "Could not acquire lock at $fname.lock"
+	return 0
+    }
+    return 1
+}
+
+
+# ::license::__unlock -- Release user database lock
+#
+#	Release the lock acquired by __lock.
+#
+# Arguments:
+#	fname	Full path to user database
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Removes the lock file.
+proc ::license::__unlock { fname } {
+    ::lockfile::release $fname.lock
+}
+
+
+# ::license::__parse -- Parse user database lines
+#
+#	This procedure parses the lines of a user database, starting
+#	at a given byte offset.  The file is read in one go and
+#	incomplete lines at its end, e.g. after a crash while
+#	appending, are left for later.
+#
+# Arguments:
+#	fname	Full path to user database
+#	offset	Byte offset at which to start, must start a line
+#
+# Results:
+#	Return a list composed of the offset of the first byte that
+#	was not parsed, followed by an even list of identifiers and
+#	{name email organisation} triplets, in file order.
+#
+# Side Effects:
+#	None.
+proc ::license::__parse { fname { offset 0 } } {
+    variable LC
+    variable log
+
+    if { [catch {open $fname} fd] } {
+	${log}::error "Could not open user database at $fname: $fd"
+	return [list $offset [list]]
+    }
+    fconfigure $fd -translation binary
+    seek $fd $offset
+    set data [read $fd]
+    close $fd
+
+    set end [string last "\n" $data]
+    set data [encoding convertfrom [encoding system] \
+		  [string range $data 0 $end]]
+    incr offset [expr {$end + 1}]
+
+    set records [list]
+    foreach line [split $data "\n"] {
+	set line [string trim $line]
+	if { $line ne "" } {
+	    set firstchar [string index $line 0]
+	    if { [string first $firstchar $LC(comments)] < 0 } {
+		if { [catch {foreach {id name email org} $line break}] \
+			 || ![string is integer -strict $id] } {
+		    ${log}::warn "Invalid user entry in $fname: $line"
+		    continue
+		}
+		lappend records $id [list $name $email $org]
+	    }
+	}
+    }
+
+    return [list $offset $records]
+}
+
+
+# ::license::__reindex -- (Re)build user database index
+#
+#	This procedure builds the index of a user database.  The
+#	index sits next to the database and is sorted on customer
+#	information, so that customers can be looked up with a binary
+#	search (see __search) without reading the database.  Its
+#	first line is a header with the format version, the inode of
+#	the database, the number of bytes of the database that it
+#	covers and the highest identifier in use.  The index is
+#	atomically replaced, several processes can write it since it
+#	only is a snapshot of (part of) the database.
+#
+# Arguments:
+#	fname	Full path to user database
+#	udb	Name of cache array
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Writes the index file and resets the cache.
+proc ::license::__reindex { fname udb } {
+    variable log
+
+    upvar \#0 $udb UDB
+
+    # Walk the records backwards, lsort -unique keeps the last of
+    # duplicates, i.e. the first occurrence in the database.
+    foreach {offset records} [__parse $fname] break
+    set maxid 0
+    set lines [list]
+    for { set i [expr {[llength $records] - 2}] } { $i >= 0 } { incr i -2 } {
+	set id [lindex $records $i]
+	lappend lines [list [lindex $records [expr {$i + 1}]] $id]
+	if { $id > $maxid } {
+	    set maxid $id
+	}
+    }
+    set lines [lsort -unique -index 0 $lines]
+
+    if { [catch {file stat $fname stat}] } {
+	set stat(ino) ""
+    }
+    array unset UDB
+    array set UDB [list @ino $stat(ino) @indexed 0 @offset 0 @maxid 0 @tail 0]
+
+    set tmp $fname.idx.[pid]
+    if { [catch {open $tmp w} fd] } {
+	${log}::warn "Could not write index to $tmp: $fd"
+    } else {
+	fconfigure $fd -encoding utf-8 -translation lf
+	puts $fd [list 1 $stat(ino) $offset $maxid]
+	puts $fd [join $lines "\n"]
+	close $fd
+	file rename -force $tmp $fname.idx
+	${log}::info "Indexed [llength $lines] customers of $fname"
+	set UDB(@indexed) $offset
+    }
+
+    # Whatever the index does not cover is kept in memory.
+    set UDB(@offset) $UDB(@indexed)
+    set UDB(@maxid) $maxid
+    if { $UDB(@indexed) == 0 } {
+	__remember $udb $records
+    }
+}
+
+
+# ::license::__remember -- Cache customers
+#
+#	Remember customers in the cache of a user database.
+#
+# Arguments:
+#	udb	Name of cache array
+#	records	Even list of identifiers and customer information
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::license::__remember { udb records } {
+    upvar \#0 $udb UDB
+
+    foreach {id who} $records {
+	if { ! [info exists UDB(who,$who)] } {
+	    set UDB(who,$who) $id
+	}
+	if { $id > $UDB(@maxid) } {
+	    set UDB(@maxid) $id
+	}
+	incr UDB(@tail)
+    }
+}
+
+
+# ::license::__userdb -- Access cached user database
+#
+#	This procedure returns the name of the array that caches the
+#	state of a user database, bringing it up to date first.  The
+#	user database is a text file with one customer per line, to
+#	which new customers are appended.  Most customers are found
+#	in the index of the database, only the customers that were
+#	appended since the index was built are parsed and kept in
+#	memory, under who,<name email org>.  The index is rebuilt
+#	once there are more than LC(indexlag) of them, or when it
+#	does not match the database anymore.
+#
+# Arguments:
+#	fname	Full path to user database
+#
+# Results:
+#	Return the name of the cache array.
+#
+# Side Effects:
+#	Possibly rebuilds the index.
+proc ::license::__userdb { fname } {
+    variable LC
+    variable USERDBS
+    variable log
+
+    set fname [file normalize $fname]
+    if { ! [info exists USERDBS($fname)] } {
+	set USERDBS($fname) ::license::userdb_[incr LC(idgene)]
+    }
+    set udb $USERDBS($fname)
+    upvar \#0 $udb UDB
+
+    if { [catch {file stat $fname stat}] } {
+	array unset UDB
+	array set UDB {@ino "" @indexed 0 @offset 0 @maxid 0 @tail 0}
+	return $udb
+    }
+
+    # (Re)start from the index when the database was replaced or has
+    # shrunk, e.g. when it was compacted.
+    if { ! [info exists UDB(@offset)] || $UDB(@ino) ne $stat(ino) \
+	     || $stat(size) < $UDB(@offset) } {
+	array unset UDB
+	if { [catch {open $fname.idx} fd] == 0 } {
+	    fconfigure $fd -encoding utf-8 -translation lf
+	    gets $fd header
+	    close $fd
+	    if { [catch {foreach {version ino offset maxid} $header break}] \
+		     || $version != 1 || $ino ne $stat(ino) \
+		     || $offset > $stat(size) } {
+		${log}::info "Index of $fname is out of date"
+	    } else {
+		array set UDB [list @ino $ino @indexed $offset \
+				   @offset $offset @maxid $maxid @tail 0]
+	    }
+	}
+	if { ! [info exists UDB(@offset)] } {
+	    __reindex $fname $udb
+	}
+    }
+
+    # Parse what was appended since, starting again from scratch if
+    # we are not at the beginning of a line: the database was
+    # rewritten behind our back.
+    if { $stat(size) > $UDB(@offset) } {
+	if { $UDB(@offset) > 0 } {
+	    set fd [open $fname]
+	    fconfigure $fd -translation binary
+	    seek $fd [expr {$UDB(@offset) - 1}]
+	    set nl [read $fd 1]
+	    close $fd
+	    if { $nl ne "\n" } {
+		${log}::notice "$fname has changed, indexing it again"
+		__reindex $fname $udb
+	    }
+	}
+	foreach {UDB(@offset) records} [__parse $fname $UDB(@offset)] break
+	__remember $udb $records
+	if { $UDB(@tail) > $LC(indexlag) } {
+	    __reindex $fname $udb
+	}
+    }
+
+    return $udb
+}
+
+
+# ::license::__search -- Look up customers in index
+#
+#	This procedure looks up customers in the sorted index of a
+#	user database, using a binary search on the byte offsets of
+#	the index file.
+#
+# Arguments:
+#	fname	Full path to user database
+#	whos	List of {name email organisation} triplets
+#
+# Results:
+#	Return the list of identifiers, in the same order as the
+#	customers, empty for customers that were not found.
+#
+# Side Effects:
+#	None.
+proc ::license::__search { fname whos } {
+    set ids [list]
+    if { [catch {open $fname.idx} fd] } {
+	foreach who $whos {
+	    lappend ids ""
+	}
+	return $ids
+    }
+    fconfigure $fd -encoding utf-8 -translation lf
+    gets $fd
+    set start [tell $fd]
+    seek $fd 0 end
+    set size [tell $fd]
+
+    foreach who $whos {
+	# Find the first line which key is not less than who.  All
+	# lines starting before lo are less than who.
+	set lo $start
+	set hi $size
+	while { $lo < $hi } {
+	    set mid [expr {($lo + $hi) / 2}]
+	    seek $fd [expr {$mid - 1}]
+	    gets $fd;		# Skip to first line starting at mid or after
+	    set pos [tell $fd]
+	    if { $pos >= $hi || [gets $fd line] < 0 } {
+		set hi $mid
+	    } elseif { [string compare [lindex $line 0] $who] < 0 } {
+		set lo [tell $fd]
+	    } else {
+		set hi $mid
+	    }
+	}
+	set id ""
+	seek $fd $lo
+	if { [gets $fd line] >= 0 && [lindex $line 0] eq $who } {
+	    set id [lindex $line 1]
+	}
+	lappend ids $id
+    }
+    close $fd
+
+    return $ids
+}
+
+
+# ::license::__lookup -- Look up known customers
+#
+#	This procedure looks up customers in the cache of a user
+#	database, then in its index.  The identifiers found are
+#	stored in an array of the caller rather than in the cache,
+#	since the cache is reset whenever the database is indexed
+#	again.
+#
+# Arguments:
+#	fname	Full path to user database
+#	udb	Name of cache array, as returned by __userdb
+#	whos	List of normalised {name email organisation} triplets
+#	found_p	Pointer to array of identifiers, indexed by triplets
+#
+# Results:
+#	Return the list of customers that could not be found, without
+#	duplicates.
+#
+# Side Effects:
+#	None.
+proc ::license::__lookup { fname udb whos found_p } {
+    upvar \#0 $udb UDB
+    upvar $found_p FOUND
+
+    set missing [list]
+    foreach who $whos {
+	if { [info exists FOUND($who)] || [info exists seen($who)] } {
+	    continue
+	}
+	if { [info exists UDB(who,$who)] } {
+	    set FOUND($who) $UDB(who,$who)
+	} else {
+	    lappend missing $who
+	    set seen($who) 1
+	}
+    }
+    if { [llength $missing] == 0 || $UDB(@indexed) == 0 } {
+	return $missing
+    }
+
+    set remaining [list]
+    foreach who $missing id [__search $fname $missing] {
+	if { $id eq "" } {
+	    lappend remaining $who
+	} else {
+	    set FOUND($who) $id
+	}
+    }
+    return $remaining
+}
+
+
+# ::license::__customers -- Find or allocate customer identifiers
+#
+#	This procedure returns the identifiers of a number of
+#	customers, allocating new identifiers to customers that are
+#	not yet in the user database.  New customers are appended to
+#	the database in one go.
+#
+# Arguments:
+#	fname	Full path to user database
+#	users	List of {name email organisation} triplets
+#
+# Results:
+#	Return the list of identifiers, in the same order as the users,
+#	an empty list on errors.
+#
+# Side Effects:
+#	Appends new customers to the user database.
+proc ::license::__customers { fname users } {
+    variable log
+
+    if { $fname eq "" } {
+	${log}::error "No user database to allocate customer identifiers"
+	return [list]
+    }
+
+    # Customers are stored as canonical lists of three elements in
+    # the database, normalise so that they can be found.
+    set whos [list]
+    foreach who $users {
+	foreach {name email org} $who break
+	lappend whos [list $name $email $org]
+    }
+
+    # Look in memory, then in the index.  Most customers are usually
+    # known.
+    set missing [__lookup $fname [__userdb $fname] $whos found]
+
+    if { [llength $missing] } {
+	if { ! [__lock $fname] } {
+	    return [list]
+	}
+	# Others might have appended since, or compacted the database,
+	# catch up and look again before allocating.
+	set udb [__userdb $fname]
+	upvar \#0 $udb UDB
+	set missing [__lookup $fname $udb $missing found]
+	set lines ""
+	set maxid $UDB(@maxid)
+	foreach who $missing {
+	    set found($who) [incr maxid]
+	    foreach {name email org} $who break
+	    append lines "$maxid \{$name\} \{$email\} \{$org\}\n"
+	}
+	if { [llength $missing] } {
+	    ${log}::info "Appending [llength $missing] user(s) to $fname"
+	    if { [catch {open $fname {RDWR CREAT}} fd] } {
+		${log}::error "Could not open $fname for writing: $fd"
+		__unlock $fname
+		return [list]
+	    }
+	    fconfigure $fd -translation lf
+	    seek $fd 0 end
+	    if { [tell $fd] > 0 } {
+		# Terminate the remains of a crashed append, if any.
+		seek $fd -1 end
+		if { [read $fd 1] ne "\n" } {
+		    set lines "\n$lines"
+		}
+		seek $fd 0 end
+	    }
+	    puts -nonewline $fd $lines
+	    close $fd
+	    __userdb $fname
+	}
+	__unlock $fname
+    }
+
+    set ids [list]
+    foreach who $whos {
+	lappend ids $found($who)
+    }
+    return $ids
+}
+
+
 # ::license::__save_userdb -- Save user database
 #
 #	This procedure saves the user database which content is
 #	contained in the variable passed as an argument.  The user
 #	database is a private document that contains all the
-#	identifiers that are assigned to customers.
+#	identifiers that are assigned to customers.  The database is
+#	written in full and atomically replaces the existing one.
 #
 # Arguments:
 #	db_p	Pointer to user database array
 #	fname	Full path to user database
+#	locked	Set when the caller already holds the database lock
 #
 # Results:
-#	None
+#	Return 1 if the database was saved, 0 otherwise.
 #
 # Side Effects:
-#	None.
-proc ::license::__save_userdb { db_p fname } {
+#	Removes the index of the database.
+proc ::license::__save_userdb { db_p fname { locked 0 } } {
     variable LC
     variable log
 
     upvar $db_p DB
 
     ${log}::info "Saving user database to $fname"
-    if { [catch {open $fname w} fd] == 0 } {
-	foreach id [lsort [array names DB]] {
-	    foreach {name email org} $DB($id) break
-	    puts $fd "$id \{$name\} \{$email\} \{$org\}"
+    if { ! $locked && ! [__lock $fname] } {
+	return 0
+    }
+    set tmp $fname.[pid]
+    set saved 0
+    if { [catch {open $tmp w} fd] == 0 } {
+	fconfigure $fd -translation lf
+	if { [catch {
+	    foreach id [lsort -integer [array names DB]] {
+		foreach {name email org} $DB($id) break
+		puts $fd "$id \{$name\} \{$email\} \{$org\}"
+	    }
+	    close $fd
+	    file rename -force $tmp $fname
+	} err] } {
+	    ${log}::error "Could not save user database to $fname: $err"
+	    catch {close $fd}
+	    catch {file delete $tmp}
+	} else {
+	    catch {file delete $fname.idx}
+	    set saved 1
 	}
-	close $fd
     } else {
-	${log}::error "Could not open $fname for writing: $fd"
+	${log}::error "Could not open $tmp for writing: $fd"
+    }
+    if { ! $locked } {
+	__unlock $fname
     }
+    return $saved
 }
 
 
@@ -155,33 +669,49 @@ proc ::license::__save_userdb { db_p fname } {
 # Side Effects:
 #	None.
 proc ::license::__read_userdb { db_p fname } {
-    variable LC
     variable log
 
     upvar $db_p DB
 
     ${log}::info "Opening user database: $fname"
     set nb_users 0
-    if { [catch {open $fname} fd] == 0 } {
-	while { ! [eof $fd] } {
-	    set line [string trim [gets $fd]]
-	    if { $line ne "" } {
-		set firstchar [string index $line 0]
-		if { [string first $firstchar $LC(comments)] < 0 } {
-		    foreach {id name email org} $line break
-		    if { [string is integer $id] } {
-			set DB($id) [list "$name" "$email" "$org"]
-			incr nb_users
-		    } else {
-			${log}::warn "$id is not a valid user identifier"
-		    }
-		}
-	    }
-	}
-	close $fd
-    } else {
-	${log}::error "Could not open user database at $fname: $fd"
+    foreach {offset records} [__parse $fname] break
+    foreach {id who} $records {
+	set DB($id) $who
+	incr nb_users
+    }
+
+    return $nb_users
+}
+
+
+# ::license::compact -- Compact user database
+#
+#	This procedure rewrites a user database with one line per
+#	customer, sorted by identifier, leaving out comments and
+#	invalid lines, and builds a fresh index for it.
+#
+# Arguments:
+#	fname	Full path to user database
+#
+# Results:
+#	Return the number of customers in the database, -1 on errors.
+#
+# Side Effects:
+#	Atomically replaces the user database and its index.
+proc ::license::compact { fname } {
+    # Hold the lock from reading to writing, customers appended by
+    # others in between would be lost otherwise.
+    if { ! [__lock $fname] } {
+	return -1
     }
+    array set DB {}
+    set nb_users [__read_userdb DB $fname]
+    if { ! [__save_userdb DB $fname 1] } {
+	set nb_users -1
+    }
+    __unlock $fname
+    __userdb $fname;		# Indexes the new database
 
     return $nb_users
 }
@@ -251,34 +781,8 @@ proc ::license::generate { userdb args } {
     }
 
     if { $LINFO(-customer) eq "" } {
-	array set UDB {}
-	__read_userdb UDB $userdb
-	set maxid ""
-	set found 0
-	foreach id [array names UDB] {
-	    if { $maxid eq "" || $UDB($id) > $maxid } {
-		set maxid $UDB($id)
-	    }
-	    foreach {name email org} $UDB($id) break
-	    if { [string eq $name $LINFO(-name)] \
-		     && [string eq $email $LINFO(-email)] \
-		     && [string eq $org $LINFO(-organisation)] } {
-		set found 1
-		break
-	    }
-	}
-	
-	if { $found } {
-	    set LINFO(-customer) $id
-	} else {
-	    if { $maxid eq "" } {
-		set maxid 0
-	    }
-	    set LINFO(-customer) [incr maxid]
-	    set UDB($maxid) \
-		[list "$LINFO(-name)" "$LINFO(-email)" "$LINFO(-organisation)"]
-	    __save_userdb UDB $userdb
-	}
+	set LINFO(-customer) [lindex [__customers $userdb \
+	    [list [list $LINFO(-name) $LINFO(-email) $LINFO(-organisation)]]] 0]
     }
 
     if { ![string is integer $LINFO(-customer)] } {
@@ -350,6 +854,63 @@ proc ::license::add { fname userdb args } {
 }
 
 
+# ::license::bulk -- Generate licenses for many users
+#
+#	This procedure generates licenses for a number of users at
+#	once.  Customer identifiers are looked up (and allocated) in
+#	the user database in one go, and all licenses are appended to
+#	the license file in a single write.
+#
+# Arguments:
+#	fname	Path to license file, empty to only generate
+#	userdb	Path to user database (see above)
+#	users	List of {name email organisation} triplets
+#	args	Dash led options and values for the license generation,
+#	        except user information.
+#
+# Results:
+#	Return the list of licenses, in the same order as the users,
+#	an empty list on errors.
+#
+# Side Effects:
+#	Appends the licenses to the license file.
+proc ::license::bulk { fname userdb users args } {
+    variable LC
+    variable log
+
+    set ids [__customers $userdb $users]
+    if { [llength $ids] != [llength $users] } {
+	${log}::error "Could not allocate customer identifiers!"
+	return [list]
+    }
+
+    set licenses [list]
+    foreach who $users id $ids {
+	foreach {name email org} $who break
+	set license [eval [list generate "" -name $name -email $email \
+			       -organisation $org] $args [list -customer $id]]
+	if { $license eq "" } {
+	    ${log}::error "Could not generate license for $name!"
+	    return [list]
+	}
+	lappend licenses $license
+    }
+
+    if { $fname ne "" } {
+	${log}::info "Saving [llength $licenses] new licenses to $fname"
+	if { [catch {open $fname a} fd] == 0 } {
+	    puts $fd [join $licenses \n]
+	    close $fd
+	} else {
+	    ${log}::error "Could not open $fname for writing: $fd"
+	    return [list]
+	}
+    }
+
+    return $licenses
+}
+
+
 # ::license::check -- Check license validity
 #
 #	This procedure checks the validity of a product against a
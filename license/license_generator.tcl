@@ -45,6 +45,7 @@ foreach key $inited {
 # Include modules that we depend on.  This is complicated to be able
 # to address separately modules in the verbose specification.
 argutil::accesslib til
+argutil::accesslib lockfile
 argutil::accesslib license
 argutil::loadmodules [list diskutil license] $LG(verbose)
 
@@ -0,0 +1,249 @@
+# userdb.tcl -- Exercise the user database
+#
+#	Allocate customer identifiers in a user database in various
+#	situations: in bulk past the number of customers that trigger
+#	a new index (LC(indexlag)) with customers that are already
+#	known, with customer information that is not written in its
+#	canonical form, and while other processes append to or
+#	compact the database.  No customer should ever get two
+#	identifiers.  Files are created in a temporary directory that
+#	is removed at the end.  The script exits with a non-zero code
+#	when a scenario fails:
+#
+#	tclsh userdb.tcl
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set here [file dirname [file normalize [info script]]]
+lappend auto_path [file dirname $here] \
+    [file join [file dirname [file dirname $here]] lockfile]
+package require license
+
+if { [info exists env(TMP)] } {
+    set tmpdir $env(TMP)
+} else {
+    set tmpdir /tmp
+}
+set dir [file join $tmpdir userdb[pid]]
+file mkdir $dir
+set failures 0
+
+
+# verdict -- Report on a scenario
+#
+#	Check the conditions that should hold at the end of a
+#	scenario and print the result.
+#
+# Arguments:
+#	name	Name of scenario
+#	checks	Even list of descriptions and expressions that should be
+#		true, evaluated at the global level.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Counts failures.
+proc verdict { name checks } {
+    global failures
+
+    set failed [list]
+    foreach {descr cond} $checks {
+	if { [catch {uplevel \#0 [list expr $cond]} ok] || ! $ok } {
+	    lappend failed $descr
+	}
+    }
+    if { [llength $failed] } {
+	puts "FAIL $name: [join $failed {, }]"
+	incr failures
+    } else {
+	puts "ok   $name"
+    }
+}
+
+
+# database -- Fresh user database
+#
+#	Remove a user database, its index and what this process
+#	remembers of it.
+#
+# Arguments:
+#	name	Name of database in test directory
+#
+# Results:
+#	Return the full path to the database.
+#
+# Side Effects:
+#	None.
+proc database { name } {
+    global dir
+
+    set fname [file join $dir $name]
+    file delete -force -- $fname $fname.idx $fname.lock
+    forget $fname
+    return $fname
+}
+
+
+# forget -- Forget cached database
+#
+#	Forget what this process knows of a user database, as if it
+#	was another process.
+#
+# Arguments:
+#	fname	Full path to database
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc forget { fname } {
+    set fname [file normalize $fname]
+    if { [info exists ::license::USERDBS($fname)] } {
+	array unset $::license::USERDBS($fname)
+	unset ::license::USERDBS($fname)
+    }
+}
+
+
+# users -- Generate customers
+#
+#	Generate a number of customers.
+#
+# Arguments:
+#	pfx	Prefix of names
+#	n	Number of customers
+#
+# Results:
+#	Return a list of {name email organisation} triplets.
+#
+# Side Effects:
+#	None.
+proc users { pfx n } {
+    set users [list]
+    for { set i 0 } { $i < $n } { incr i } {
+	lappend users [list "$pfx $i" $pfx$i@example.com "Org $pfx"]
+    }
+    return $users
+}
+
+
+# entries -- Database content
+#
+#	Read all identifiers and customers of a user database.
+#
+# Arguments:
+#	fname	Full path to database
+#
+# Results:
+#	Return an even list of the number of identifiers and the
+#	number of distinct customers.
+#
+# Side Effects:
+#	None.
+proc entries { fname } {
+    array set DB {}
+    ::license::__read_userdb DB $fname
+    foreach id [array names DB] {
+	set who($DB($id)) $id
+    }
+    return [list [array size DB] [array size who]]
+}
+
+
+# Make sure that the scenarios below go past the index lag.
+set lag $::license::LC(indexlag)
+
+# Bulk allocation of new customers together with a known one: the
+# database is indexed again during allocation.
+set db [database bulk.dat]
+set first [::license::__customers $db [list {Alice alice@example.com ACME}]]
+set users [linsert [users Bulk [expr {$lag + 500}]] 0 \
+	       {Alice alice@example.com ACME}]
+set licenses [::license::bulk "" $db $users -product test]
+set ids [::license::__customers $db $users]
+forget $db
+set again [::license::__customers $db $users]
+foreach {nids nwho} [entries $db] break
+verdict "bulk past index lag" {
+    "all licensed"                 {[llength $licenses] == [llength $users]}
+    "known customer kept"          {[lindex $ids 0] == $first}
+    "one identifier per customer"  {$nids == [llength $users] && $nwho == $nids}
+    "same identifiers from disk"   {$again eq $ids}
+}
+
+# Customer information that is not a canonical list.
+set ids [::license::__customers $db \
+	     [list "Alice   alice@example.com\tACME" {{Bulk 3} Bulk3@example.com {Org Bulk}}]]
+foreach {nids nwho} [entries $db] break
+verdict "non-canonical customers" {
+    "known customers found"        {$ids eq [list $first [lindex $again 4]]}
+    "nothing appended"             {$nids == [llength $users]}
+}
+
+# Another process appends many customers, including the ones we are
+# about to allocate, while we wait for the lock: we should find them
+# in the new index rather than allocate them again.
+set db [database concurrent.dat]
+::license::__customers $db [users Old 10]
+set theirs [users Theirs [expr {$lag + 10}]]
+rename ::license::__lock ::license::__lock_orig
+proc ::license::__lock { fname } {
+    global theirs
+    rename ::license::__lock {}
+    rename ::license::__lock_orig ::license::__lock
+    # Act as another process.
+    set udb $::license::USERDBS($fname)
+    array set saved [array get $udb]
+    forget $fname
+    set ::otherids [::license::__customers $fname $theirs]
+    set ::license::USERDBS($fname) $udb
+    array set $udb [array get saved]
+    return [::license::__lock $fname]
+}
+set ids [::license::__customers $db [lrange $theirs end-4 end]]
+foreach {nids nwho} [entries $db] break
+verdict "others appended past index lag" {
+    "found their identifiers"      {$ids eq [lrange $::otherids end-4 end]}
+    "one identifier per customer"  {$nids == $nwho && $nids == 10 + [llength $theirs]}
+}
+
+# Another process compacts the database while we wait for the lock.
+set db [database compacted.dat]
+::license::__customers $db [users Old 10]
+forget $db
+set mine [users Mine 5]
+set ::license::LC(indexlag) 0
+::license::__customers $db $mine;	# Indexed from now on
+set ::license::LC(indexlag) $lag
+rename ::license::__lock ::license::__lock_orig
+proc ::license::__lock { fname } {
+    rename ::license::__lock {}
+    rename ::license::__lock_orig ::license::__lock
+    set udb $::license::USERDBS($fname)
+    array set saved [array get $udb]
+    forget $fname
+    ::license::__customers $fname [users Theirs 3]
+    ::license::compact $fname
+    set ::license::USERDBS($fname) $udb
+    array set $udb [array get saved]
+    return [::license::__lock $fname]
+}
+set before [::license::__customers $db $mine]
+set ids [::license::__customers $db [concat [users Theirs 3] $mine [users New 2]]]
+foreach {nids nwho} [entries $db] break
+verdict "others compacted" {
+    "own identifiers kept"         {[lrange $ids 3 7] eq $before}
+    "one identifier per customer"  {$nids == $nwho && $nids == 20}
+}
+
+file delete -force -- $dir
+if { $failures } {
+    puts "$failures scenario(s) failed"
+    exit 1
+}
+exit 0
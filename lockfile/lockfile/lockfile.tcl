@@ -0,0 +1,403 @@
+# lockfile.tcl -- Lock files shared between processes
+#
+#	This module implements locks that protect files shared between
+#	processes.  A lock is a file that is created exclusively and
+#	that contains the process identifier and host name of its
+#	owner.  Locks are either acquired synchronously, for
+#	non-interactive callers, or from the event loop, in which case
+#	a callback is called once the lock has been acquired or could
+#	not be acquired in time.  Locks that have not been modified
+#	for a while (see touch) and which owner is known to be gone
+#	are considered left behind by crashed processes and are
+#	broken.  Breaking a lock atomically renames it, so that only
+#	one process can break it.
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+package require Tcl 8.4
+
+package require uobj
+
+namespace eval ::lockfile {
+    variable LF
+    if { ! [info exists LF] } {
+	array set LF {
+	    idgene    0
+	    -wait     2000
+	    -stale    10
+	    -retry    10
+	    -retrymax 200
+	}
+	variable HELD;     # Normalised path to locks held by this process
+	array set HELD {}
+	::uobj::install_log lockfile LF; # Creates 'log' variable
+	::uobj::install_defaults lockfile LF
+    }
+}
+
+
+# ::lockfile::__owner -- Owner of lock
+#
+#	Read the owner of a lock from the lock file.
+#
+# Arguments:
+#	lock	Path to lock file
+#
+# Results:
+#	Return a list composed of the process identifier and the host
+#	name of the owner, an empty list when the lock could not be
+#	read, e.g. because it has just been created.
+#
+# Side Effects:
+#	None.
+proc ::lockfile::__owner { lock } {
+    if { [catch {open $lock} fd] } {
+	return [list]
+    }
+    set owner [string trim [read $fd]]
+    close $fd
+    if { [catch {llength $owner} len] || $len != 2 \
+	     || ![string is integer -strict [lindex $owner 0]] } {
+	return [list]
+    }
+    return $owner
+}
+
+
+# ::lockfile::__alive -- Check whether the owner of a lock runs
+#
+#	Check whether the process that owns a lock still runs.  This
+#	can only be known for processes of this host.  Locks that
+#	carry the identifier of this process but that it does not hold
+#	were left behind by a previous process with the same
+#	identifier.
+#
+# Arguments:
+#	lock	Path to lock file
+#	owner	Owner of lock, as returned by __owner
+#
+# Results:
+#	Return 1 if the owner runs, 0 if it is gone, -1 if this cannot
+#	be known.
+#
+# Side Effects:
+#	None.
+proc ::lockfile::__alive { lock owner } {
+    global tcl_platform
+    variable HELD
+
+    foreach {pid host} $owner break
+    if { [llength $owner] != 2 || $host ne [info hostname] } {
+	return -1
+    }
+    if { $pid == [pid] } {
+	return [info exists HELD([file normalize $lock])]
+    }
+    if { [file isdirectory /proc/[pid]] } {
+	return [file isdirectory /proc/$pid]
+    }
+    if { $tcl_platform(platform) eq "windows" } {
+	if { [catch {exec tasklist /NH /FI "PID eq $pid"} res] } {
+	    return -1
+	}
+	return [regexp "\\s$pid\\s" $res]
+    }
+    if { [catch {exec kill -0 $pid} res] } {
+	if { [string match -nocase "*no such process*" $res] } {
+	    return 0
+	}
+	# Not allowed to signal, which means that it runs.
+	if { [string match -nocase "*not permitted*" $res] } {
+	    return 1
+	}
+	return -1
+    }
+    return 1
+}
+
+
+# ::lockfile::__break -- Break stale lock
+#
+#	Break a lock that has not been modified for more than a number
+#	of seconds and which owner is gone, or cannot be checked.  The
+#	lock is first renamed, which only one process can do, and
+#	restored when it turns out to have been released and acquired
+#	again in the meantime.
+#
+# Arguments:
+#	lock	Path to lock file
+#	stale	Number of seconds after which a lock can be broken
+#
+# Results:
+#	Return 1 if the lock was broken, 0 otherwise.
+#
+# Side Effects:
+#	Removes the lock file.
+proc ::lockfile::__break { lock stale } {
+    variable log
+
+    set now [clock seconds]
+    if { [catch {file mtime $lock} mtime] || $now - $mtime <= $stale } {
+	return 0
+    }
+    set owner [__owner $lock]
+    if { [__alive $lock $owner] == 1 } {
+	${log}::debug "Lock at $lock is old but its owner $owner still runs"
+	return 0
+    }
+
+    set grave $lock.[pid]
+    if { [catch {file rename -- $lock $grave}] } {
+	return 0
+    }
+    if { [__owner $grave] ne $owner || [catch {file mtime $grave} mtime] \
+	     || $now - $mtime <= $stale } {
+	catch {file rename -- $grave $lock}
+	return 0
+    }
+    catch {file delete -- $grave}
+    ${log}::notice "Broke stale lock at $lock, left by '$owner'"
+    return 1
+}
+
+
+# ::lockfile::__try -- Try acquiring lock
+#
+#	Make one attempt at acquiring a lock, breaking it if it is
+#	stale.
+#
+# Arguments:
+#	lock	Path to lock file
+#	stale	Number of seconds after which a lock can be broken
+#
+# Results:
+#	Return 1 if the lock was acquired, 0 otherwise.
+#
+# Side Effects:
+#	Creates the lock file.
+proc ::lockfile::__try { lock stale } {
+    variable HELD
+
+    set norm [file normalize $lock]
+    if { [info exists HELD($norm)] } {
+	return 0
+    }
+    if { [catch {open $lock {WRONLY CREAT EXCL}} fd] } {
+	if { ! [__break $lock $stale] \
+		 || [catch {open $lock {WRONLY CREAT EXCL}} fd] } {
+	    return 0
+	}
+    }
+    puts $fd [list [pid] [info hostname]]
+    close $fd
+    set HELD($norm) 1
+    return 1
+}
+
+
+# ::lockfile::acquire -- Acquire lock, waiting for it
+#
+#	Acquire a lock, waiting for it for a while when it is held by
+#	another process.  This blocks the caller, interactive callers
+#	should use ::lockfile::lock instead.  The options are:
+#	-wait   Number of milliseconds to wait for the lock
+#	-stale  Number of seconds after which locks can be broken
+#
+# Arguments:
+#	lock	Path to lock file
+#	args	Dash-led options and their values, see above
+#
+# Results:
+#	Return 1 if the lock was acquired, 0 otherwise.
+#
+# Side Effects:
+#	Creates the lock file.
+proc ::lockfile::acquire { lock args } {
+    variable LF
+    variable log
+
+    ::uobj::inherit LF OPTS {-wait -stale}
+    array set OPTS $args
+
+    set deadline [expr {[clock clicks -milliseconds] + $OPTS(-wait)}]
+    set delay $LF(-retry)
+    while { ! [__try $lock $OPTS(-stale)] } {
+	set left [expr {$deadline - [clock clicks -milliseconds]}]
+	if { $left <= 0 } {
+	    ${log}::warn "Could not acquire lock at $lock"
+	    return 0
+	}
+	if { $delay > $left } {
+	    set delay $left
+	}
+	after $delay
+	set delay [expr {2 * $delay}]
+	if { $delay > $LF(-retrymax) } {
+	    set delay $LF(-retrymax)
+	}
+    }
+    return 1
+}
+
+
+# ::lockfile::lock -- Acquire lock from the event loop
+#
+#	Acquire a lock without blocking the caller.  Attempts are made
+#	from the event loop, at increasing intervals, until the lock
+#	is acquired or until the caller has waited for too long.  The
+#	callback is then called at the global level with an additional
+#	argument, 1 if the lock was acquired, 0 otherwise.  The
+#	callback is never called before this procedure returns.  The
+#	options are the same as for ::lockfile::acquire.
+#
+# Arguments:
+#	lock	Path to lock file
+#	cmd	Command to callback
+#	args	Dash-led options and their values
+#
+# Results:
+#	Return an identifier for the request, which can be cancelled.
+#
+# Side Effects:
+#	Creates the lock file.
+proc ::lockfile::lock { lock cmd args } {
+    variable LF
+
+    set id [incr LF(idgene)]
+    set varname [namespace current]::request_$id
+    upvar \#0 $varname REQUEST
+    ::uobj::inherit LF REQUEST {-wait -stale}
+    array set REQUEST $args
+    set REQUEST(lock) $lock
+    set REQUEST(cmd) $cmd
+    set REQUEST(deadline) \
+	[expr {[clock clicks -milliseconds] + $REQUEST(-wait)}]
+    set REQUEST(delay) $LF(-retry)
+    set REQUEST(after) [after idle [list [namespace current]::__retry $id]]
+
+    return $id
+}
+
+
+# ::lockfile::__retry -- Attempt to acquire lock
+#
+#	Make an attempt at acquiring the lock of a request, schedule
+#	the next attempt or call the callback of the request.
+#
+# Arguments:
+#	id	Identifier of request
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Creates the lock file.
+proc ::lockfile::__retry { id } {
+    variable LF
+    variable log
+
+    set varname [namespace current]::request_$id
+    if { ! [info exists $varname] } {
+	return
+    }
+    upvar \#0 $varname REQUEST
+
+    if { [__try $REQUEST(lock) $REQUEST(-stale)] } {
+	set ok 1
+    } elseif { [clock clicks -milliseconds] >= $REQUEST(deadline) } {
+	${log}::warn "Could not acquire lock at $REQUEST(lock)"
+	set ok 0
+    } else {
+	set REQUEST(after) \
+	    [after $REQUEST(delay) [list [namespace current]::__retry $id]]
+	set REQUEST(delay) [expr {2 * $REQUEST(delay)}]
+	if { $REQUEST(delay) > $LF(-retrymax) } {
+	    set REQUEST(delay) $LF(-retrymax)
+	}
+	return
+    }
+    set cmd $REQUEST(cmd)
+    unset REQUEST
+    if { [catch {uplevel \#0 [linsert $cmd end $ok]} err] } {
+	${log}::warn "Error when calling back $cmd: $err"
+    }
+}
+
+
+# ::lockfile::cancel -- Cancel lock request
+#
+#	Cancel a request made with ::lockfile::lock, its callback will
+#	not be called.
+#
+# Arguments:
+#	id	Identifier of request
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::lockfile::cancel { id } {
+    set varname [namespace current]::request_$id
+    if { [info exists $varname] } {
+	upvar \#0 $varname REQUEST
+	after cancel $REQUEST(after)
+	unset REQUEST
+    }
+}
+
+
+# ::lockfile::touch -- Refresh lock
+#
+#	Mark a lock as recently used, callers holding a lock for long
+#	operations should call this regularly so that their lock does
+#	not look stale.
+#
+# Arguments:
+#	lock	Path to lock file
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Modifies the lock file.
+proc ::lockfile::touch { lock } {
+    catch {file mtime $lock [clock seconds]}
+}
+
+
+# ::lockfile::release -- Release lock
+#
+#	Release a lock held by this process.  Locks that were broken
+#	and acquired by another process in the meantime are left
+#	untouched.
+#
+# Arguments:
+#	lock	Path to lock file
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Removes the lock file.
+proc ::lockfile::release { lock } {
+    variable HELD
+    variable log
+
+    set norm [file normalize $lock]
+    if { ! [info exists HELD($norm)] } {
+	return
+    }
+    unset HELD($norm)
+    if { [lindex [__owner $lock] 0] == [pid] } {
+	catch {file delete -- $lock}
+    } else {
+	${log}::warn "Lock at $lock was broken while held"
+    }
+}
+
+
+package provide lockfile 0.1
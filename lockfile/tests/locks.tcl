@@ -0,0 +1,242 @@
+# locks.tcl -- Exercise lock files
+#
+#	Acquire and release locks in various situations: locks held
+#	by this process, stale locks left behind by processes that are
+#	gone, old locks of processes that still run, several processes
+#	racing for a stale lock, and requests made from the event
+#	loop.  Files are created in a temporary directory that is
+#	removed at the end.  The script exits with a non-zero code
+#	when a scenario fails:
+#
+#	tclsh locks.tcl
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set here [file dirname [file normalize [info script]]]
+lappend auto_path [file dirname $here]
+package require lockfile
+
+if { [info exists env(TMP)] } {
+    set tmpdir $env(TMP)
+} else {
+    set tmpdir /tmp
+}
+set dir [file join $tmpdir locks[pid]]
+file mkdir $dir
+set lock [file join $dir test.lock]
+set failures 0
+
+
+# verdict -- Report on a scenario
+#
+#	Check the conditions that should hold at the end of a
+#	scenario and print the result.
+#
+# Arguments:
+#	name	Name of scenario
+#	checks	Even list of descriptions and expressions that should be
+#		true, evaluated at the global level.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Counts failures.
+proc verdict { name checks } {
+    global failures
+
+    set failed [list]
+    foreach {descr cond} $checks {
+	if { [catch {uplevel \#0 [list expr $cond]} ok] || ! $ok } {
+	    lappend failed $descr
+	}
+    }
+    if { [llength $failed] } {
+	puts "FAIL $name: [join $failed {, }]"
+	incr failures
+    } else {
+	puts "ok   $name"
+    }
+}
+
+
+# forge -- Forge a lock
+#
+#	Create a lock file on behalf of a process, as if it had been
+#	modified some time ago.
+#
+# Arguments:
+#	pid	Identifier of owner
+#	age	Number of seconds since last modification
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc forge { pid age } {
+    global lock
+
+    set fd [open $lock w]
+    puts $fd [list $pid [info hostname]]
+    close $fd
+    file mtime $lock [expr {[clock seconds] - $age}]
+}
+
+
+# spawn -- Run a Tcl script in another process
+#
+#	Run a script in another Tcl interpreter, in the background,
+#	with the lockfile library at hand.
+#
+# Arguments:
+#	script	Script to run
+#
+# Results:
+#	Return the process identifier.
+#
+# Side Effects:
+#	None.
+proc spawn { script } {
+    global dir here
+
+    set fname [file join $dir script[incr ::nscripts].tcl]
+    set fd [open $fname w]
+    puts $fd [list set auto_path [linsert $::auto_path 0 [file dirname $here]]]
+    puts $fd {package require lockfile}
+    puts $fd $script
+    close $fd
+    return [exec [info nameofexecutable] $fname &]
+}
+
+
+# Locks cannot be acquired twice, not even by their owner.
+set first [::lockfile::acquire $lock -wait 0]
+set second [::lockfile::acquire $lock -wait 100]
+::lockfile::release $lock
+set third [::lockfile::acquire $lock -wait 0]
+::lockfile::release $lock
+verdict "acquire and release" {
+    "acquired"                     {$first}
+    "not acquired twice"           {!$second}
+    "acquired after release"       {$third}
+    "removed at release"           {![file exists $lock]}
+}
+
+# Old locks of processes that are gone are broken, recent ones are not.
+set gone [exec [info nameofexecutable] << {puts [pid]}]
+forge $gone 1
+set recent [::lockfile::acquire $lock -wait 0 -stale 10]
+forge $gone 60
+set old [::lockfile::acquire $lock -wait 0 -stale 10]
+::lockfile::release $lock
+verdict "stale lock of dead process" {
+    "recent lock kept"             {!$recent}
+    "old lock broken"              {$old}
+}
+
+# Old locks of processes that still run are kept, e.g. during long
+# operations that do not touch their lock.
+set runs [spawn {after 5000}]
+forge $runs 60
+set taken [::lockfile::acquire $lock -wait 0 -stale 10]
+file delete $lock
+catch {exec kill $runs}
+verdict "old lock of running process" {
+    "kept"                         {!$taken}
+}
+
+# Processes racing for a stale lock: no two of them hold it at the
+# same time.
+set journal [file join $dir journal]
+forge $gone 60
+set pids [list]
+for { set i 0 } { $i < 8 } { incr i } {
+    lappend pids [spawn [string map [list @L@ [list $lock] @J@ [list $journal]] {
+	if { [::lockfile::acquire @L@ -wait 10000 -stale 10] } {
+	    set fd [open @J@ a]
+	    puts $fd "enter [pid]"
+	    close $fd
+	    after 50
+	    set fd [open @J@ a]
+	    puts $fd "leave [pid]"
+	    close $fd
+	    ::lockfile::release @L@
+	}
+    }]]
+}
+set end [expr {[clock seconds] + 30}]
+while { [clock seconds] < $end } {
+    set running 0
+    foreach pid $pids {
+	if { [::lockfile::__alive $lock [list $pid [info hostname]]] == 1 } {
+	    incr running
+	}
+    }
+    if { !$running } {
+	break
+    }
+    after 100
+}
+set overlaps 0
+set entered 0
+set holder ""
+set fd [open $journal]
+foreach line [split [string trim [read $fd]] "\n"] {
+    foreach {what pid} $line break
+    if { $what eq "enter" } {
+	incr entered
+	if { $holder ne "" } {
+	    incr overlaps
+	}
+	set holder $pid
+    } elseif { $holder eq $pid } {
+	set holder ""
+    }
+}
+close $fd
+verdict "processes racing for stale lock" {
+    "all entered"                  {$entered == [llength $pids]}
+    "one at a time"                {$overlaps == 0}
+    "released"                     {![file exists $lock]}
+}
+
+# Requests from the event loop: the callback is called once the lock
+# is released by its holder, or once the request has waited for too
+# long.
+set holder [spawn [string map [list @L@ [list $lock]] {
+    ::lockfile::acquire @L@
+    after 500
+    ::lockfile::release @L@
+}]]
+while { ![file exists $lock] } {
+    after 10
+}
+set results [list]
+::lockfile::lock $lock [list lappend results long] -wait 5000
+::lockfile::lock $lock [list lappend results short] -wait 100
+set cancelled [::lockfile::lock $lock [list lappend results cancelled]]
+::lockfile::cancel $cancelled
+set sync [llength $results]
+set end [expr {[clock seconds] + 10}]
+while { [llength $results] < 4 && [clock seconds] < $end } {
+    after 20 [list set tick 1]
+    vwait tick
+}
+::lockfile::release $lock
+verdict "requests from event loop" {
+    "not called back at once"      {$sync == 0}
+    "short request failed first"   {[lrange $results 0 1] eq {short 0}}
+    "long request acquired"        {[lrange $results 2 3] eq {long 1}}
+    "cancelled request silent"     {[lsearch $results cancelled] < 0}
+}
+
+file delete -force -- $dir
+if { $failures } {
+    puts "$failures scenario(s) failed"
+    exit 1
+}
+exit 0
@@ -10,6 +10,7 @@
 
 package require Tk
 package require logger
+package require frameclock
 
 namespace eval ::notifier {
     # Initialise the global state
@@ -242,7 +243,9 @@ proc ::notifier::__initpos { top } {
 # ::notifier::__animate -- Performs one animation step
 #
 #	This procedure performs one animation step for the notifier
-#	and automatically changes state whenever necessary.
+#	and automatically changes state whenever necessary.  Steps
+#	are run by the shared animation clock and moves of the
+#	notifier are deferred to the end of the frame.
 #
 # Arguments:
 #	top	Window name of the notifier
@@ -271,11 +274,11 @@ proc ::notifier::__animate { top { stopat "" } } {
 		wm deiconify $top
 		update idletasks
 		__initpos $top
-		set NF(startanim) [clock clicks -milliseconds]
+		set NF(startanim) [::frameclock::now]
 		set NF(state) "SHOWING"
 	    }
 	    "SHOWING" {
-		set now [clock clicks -milliseconds]
+		set now [::frameclock::now]
 		set elapsed [expr {$now - $NF(startanim)}]
 		set sp [lindex $NF(-keyframes) 0]
 		if { $elapsed >= $sp } {
@@ -294,10 +297,10 @@ proc ::notifier::__animate { top { stopat "" } } {
 				     + $NF(starty)}]
 		}
 		wm deiconify $NF(top)
-		wm geometry $NF(top) +$x+$y
+		::frameclock::defer $NF(top),geometry wm geometry $NF(top) +$x+$y
 	    }
 	    "SHOWN" {
-		set now [clock clicks -milliseconds]
+		set now [::frameclock::now]
 		set elapsed [expr {$now - $NF(startanim)}]
 		set sp [lindex $NF(-keyframes) 1]
 		if { $sp == "" } { set sp [lindex $NF(-keyframes) 0] }
@@ -308,10 +311,10 @@ proc ::notifier::__animate { top { stopat "" } } {
 		set x $NF(endx)
 		set y $NF(endy)
 		wm deiconify $NF(top)
-		wm geometry $NF(top) +$x+$y
+		::frameclock::defer $NF(top),geometry wm geometry $NF(top) +$x+$y
 	    }
 	    "HIDING" {
-		set now [clock clicks -milliseconds]
+		set now [::frameclock::now]
 		set elapsed [expr {$now - $NF(startanim)}]
 		set sp [lindex $NF(-keyframes) 2]
 		if { $sp == "" } { set sp [lindex $NF(-keyframes) 1] }
@@ -331,7 +334,8 @@ proc ::notifier::__animate { top { stopat "" } } {
 						       - $NF(endy))/$sp)) \
 				     + $NF(endy)}]
 		    wm deiconify $NF(top)
-		    wm geometry $NF(top) +$x+$y
+		    ::frameclock::defer $NF(top),geometry \
+			wm geometry $NF(top) +$x+$y
 		}
 	    }
 	}
@@ -342,8 +346,8 @@ proc ::notifier::__animate { top { stopat "" } } {
 	    if { $NF(state) == $stopat } {
 		set NF(timer) ""
 	    } else {
-		set NF(timer) \
-		    [after $NF(-animation) ::notifier::__animate $top $stopat]
+		set NF(timer) [::frameclock::schedule $NF(-animation) \
+				   ::notifier::__animate $top $stopat]
 	    }
 	}
     }
@@ -373,7 +377,7 @@ proc ::notifier::__hide { top { atonce off } } {
 	upvar \#0 $varname NF
 
 	if { $NF(timer) != "" } {
-	    after cancel $NF(timer)
+	    ::frameclock::cancel $NF(timer)
 	    set NF(timer) ""
 	}
 
@@ -468,7 +472,7 @@ proc ::notifier::__delete { w } {
 	upvar \#0 $varname NF
 
 	if { $NF(timer) != "" } {
-	    after cancel $NF(timer)
+	    ::frameclock::cancel $NF(timer)
 	}
 	
 	set NOTIF(notifiers) [lreplace $NOTIF(notifiers) $idx $idx]
@@ -10,12 +10,12 @@
 
 package require Tk
 package require logger
-package require fileutil::magic::mimetype
-package require fileutil
 
 package require uobj
 package require imgop
 package require argutil
+package require diskutil
+package require picbrowser::thumbcache
 
 namespace eval ::picbrowser {
     # Initialise the global state
@@ -27,6 +27,13 @@ namespace eval ::picbrowser {
 	    browsers       ""
 	    forcetclresize 0
 	    dnd            0
+	    threadcapable  0
+	    pool           ""
+	    poolsize       0
+	    poolidle       60
+	    cachefiles     20000
+	    cachedirs      256
+	    cached         ""
 	    -thumbsize     "64x64"
 	    -root          ""
 	    -files         "*.{gif,ppm,png,jpg,pbm,bmp,lnk}"
@@ -39,7 +46,14 @@ namespace eval ::picbrowser {
 	    -home          on
 	    -maxtitlechar  40
 	    -title         "%nicedir%"
+	    -workers       4
+	    -thumbcache    on
+	    -scanbatch     64
 	}
+	variable DIRCACHE;  # Directory -> {mtime dirs files}
+	array set DIRCACHE {}
+	variable FTYPES;    # Full path to file -> image format, empty if none
+	array set FTYPES {}
 	variable libdir [file dirname [file normalize [info script]]]
 	::uobj::install_log picbrowser PB; # Creates 'log' namespace variable
 	::uobj::install_defaults picbrowser PB
@@ -53,6 +67,64 @@ if { [catch {package require tkdnd 2.0} ver] == 0 } {
     set ::picbrowser::PB(dndcapable) 1
 }
 
+# Create thumbnails and scan directories in worker threads whenever
+# possible.  Workers only run ImageMagick, list directories and sniff
+# files, and report back to the main thread, which is the only one to
+# create Tk images.  Sniffing is performed by imgop::sniff, which does
+# not require Tk.
+if { [catch {package require Thread 2.6} ver] == 0 } {
+    set ::picbrowser::PB(threadcapable) 1
+    set ::picbrowser::PB(workerinit) [list set ::auto_path $::auto_path]
+    append ::picbrowser::PB(workerinit) {
+	package require imgop::sniff
+	proc ::__picbrowser_job { main pool job } {
+	    catch {uplevel \#0 $job}
+	    ::thread::send -async $main [list ::picbrowser::__jobdone $pool]
+	}
+	proc ::__picbrowser_thumb { main top fm fname cmd dst } {
+	    if { [catch {eval exec $cmd} err] == 0 } {
+		set err ""
+	    }
+	    ::thread::send -async $main \
+		[list ::picbrowser::__thumbdone $top $fm $fname $dst $err]
+	}
+	proc ::__picbrowser_scan { main top token dir ptn batch } {
+	    # Nobody would see errors in this detached job, always end
+	    # the scan with a last batch that carries them instead.
+	    set chunk [list]
+	    set types [list]
+	    if { [catch {
+		set mtime [file mtime $dir]
+		set dirs [lsort [glob -nocomplain -tails -directory $dir \
+				     -type d *]]
+		::thread::send -async $main \
+		    [list ::picbrowser::__scanned $top $token $dir \
+			 $dirs {} {} "" ""]
+		set files [lsort [glob -nocomplain -tails -directory $dir \
+				      -type f $ptn]]
+		foreach fname $files {
+		    lappend chunk $fname
+		    lappend types [::imgop::sniff [file join $dir $fname]]
+		    if { [llength $chunk] >= $batch } {
+			::thread::send -async $main \
+			    [list ::picbrowser::__scanned $top $token $dir \
+				 {} $chunk $types "" ""]
+			set chunk [list]
+			set types [list]
+		    }
+		}
+	    } err] } {
+		set mtime ""
+	    } else {
+		set err ""
+	    }
+	    ::thread::send -async $main \
+		[list ::picbrowser::__scanned $top $token $dir \
+		     {} $chunk $types $mtime $err]
+	}
+    }
+}
+
 
 # ::picbrowser::__readimg -- Make an icon out of a picture
 #
@@ -75,42 +147,438 @@ proc ::picbrowser::__readimg { fm fname } {
     variable PB
     variable log
 
-    if { [winfo exists $fm] } {
+    # Icons are recycled, check that it still represents the picture.
+    if { [winfo exists $fm] && [$fm.ico cget -text] eq $fname } {
 	set top .[lindex [split $fm "."] 1]
 	set varname "::picbrowser::browser_${top}"
 	upvar \#0 $varname BROWSER
 	
 	foreach {tw th} [split $BROWSER(-thumbsize) "x"] {}
-	foreach {iw ih} [::imgop::size $fname] {}
-	if { $iw eq "" } {
-	    ${log}::warn "Could not read size of $fname!"
-	    return
-	}
-	set sx [expr double($tw)/double($iw)]
-	set sy [expr double($th)/double($ih)]
-	if { $sx < $sy } { set scale $sx } else { set scale $sy }
-	if { $scale < 1.0 } {
-	    set dw [expr round($iw * $scale)]
-	    set dh [expr round($ih * $scale)]
-	    if { [catch {::imgop::resize $fname $dw $dh} img] } {
-		${log}::warn "Error when reading image at $fname: $img"
-		set img ""
-	    }
-	} else {
-	    set img [::imgop::loadimage $fname]
+	if { [catch {::imgop::acquire $fname $tw $th} img] } {
+	    ${log}::warn "Error when reading image at $fname: $img"
+	    set img ""
 	}
 	if { $img ne "" } {
-	    if { [winfo exists $fm.ico] } {
+	    if { [string is true $BROWSER(-thumbcache)] } {
+		set prefix [namespace tail [namespace current]]
+		set thumb [::diskutil::temporary_file $prefix png]
+		if { [catch {$img write $thumb -format png} err] } {
+		    ${log}::warn "Could not encode thumbnail of $fname: $err"
+		} else {
+		    __cachestore $top $fname $thumb
+		}
+		catch {file delete $thumb}
+	    }
+	    if { [winfo exists $fm.ico] && [$fm.ico cget -text] eq $fname } {
 		$fm.ico configure -image $img
 		__trigger $top IconInstall $fname $fm $img
 	    } else {
-		image delete $img
+		::imgop::release $img
 	    }
 	}
     }
 }
 
 
+# ::picbrowser::__cachestore -- Store a thumbnail in the persistent cache
+#
+#	This procedure stores the encoded content of a thumbnail in
+#	the persistent thumbnail cache, when enabled.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	fname	Full path to the picture.
+#	thumb	Path to file containing the (encoded) thumbnail.
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__cachestore { top fname thumb } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    if { ![string is true $BROWSER(-thumbcache)] } {
+	return
+    }
+    if { [catch {open $thumb r} fd] } {
+	${log}::warn "Could not read thumbnail at $thumb: $fd"
+	return
+    }
+    fconfigure $fd -translation binary
+    set data [read $fd]
+    close $fd
+    ::picbrowser::thumbcache::put \
+	[::picbrowser::thumbcache::key $fname $BROWSER(-thumbsize)] $data
+}
+
+
+# ::picbrowser::__cachedimg -- Get a thumbnail from the caches
+#
+#	This procedure returns the thumbnail of a picture from the
+#	image cache of imgop, if it is still there.  Otherwise, it
+#	creates a Tk image out of the thumbnail that was stored in the
+#	persistent thumbnail cache, if any.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	fname	Full path to the picture.
+#
+# Results:
+#	Return the name of the image, an empty string when the
+#	thumbnail is not in the cache.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__cachedimg { top fname } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    foreach {tw th} [split $BROWSER(-thumbsize) "x"] {}
+    set img [::imgop::lookup $fname $tw $th]
+    if { $img ne "" || ![string is true $BROWSER(-thumbcache)] } {
+	return $img
+    }
+    set data [::picbrowser::thumbcache::get \
+		  [::picbrowser::thumbcache::key $fname $BROWSER(-thumbsize)]]
+    if { $data eq "" } {
+	return ""
+    }
+    if { [catch {image create photo -data $data} img] } {
+	${log}::warn "Could not decode cached thumbnail of $fname: $img"
+	return ""
+    }
+    return [::imgop::adopt $img $fname $tw $th]
+}
+
+
+# ::picbrowser::__enqueue -- Queue the creation of a thumbnail
+#
+#	This procedure queues the creation of the thumbnail for an
+#	icon.  Thumbnails are created in the order of their distance
+#	to the visible part of the browser, see __dispatch.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	fm	Frame container for the icon.
+#	fname	Full path to the picture.
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__enqueue { top fm fname } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    lappend BROWSER(pending) [list $fm $fname]
+    set BROWSER(queued,$fm) $fname
+    set BROWSER(viewport) ""; # Force priorities to be recomputed
+    if { $BROWSER(dispatch) eq "" } {
+	set BROWSER(dispatch) [after idle ::picbrowser::__dispatch $top]
+    }
+}
+
+
+# ::picbrowser::__prioritise -- Order pending thumbnails
+#
+#	This procedure sorts the queue of pending thumbnails by their
+#	distance to the visible part of the canvas.  The queue is only
+#	sorted again when the visible region has changed (scrolling,
+#	resizing) or when icons have been queued or destroyed.
+#	Thumbnails of icons that have been destroyed since they were
+#	queued are removed from the queue.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__prioritise { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    set c $top.canvas
+    set vtop [expr {int([$c canvasy 0])}]
+    set vbot [expr {int([$c canvasy [winfo height $c]])}]
+    if { $BROWSER(viewport) eq [list $vtop $vbot] } {
+	return
+    }
+    set BROWSER(viewport) [list $vtop $vbot]
+
+    set prioritised [list]
+    foreach job $BROWSER(pending) {
+	foreach {fm fname} $job break
+	if { ![info exists BROWSER(queued,$fm)] \
+		 || $BROWSER(queued,$fm) ne $fname } {
+	    continue
+	}
+	set y [lindex [$c coords $fm] 1]
+	if { $y eq "" } {
+	    set dist 0x7FFFFFFF; # Not yet placed on the canvas
+	} elseif { $y > $vbot } {
+	    set dist [expr {int($y) - $vbot}]
+	} elseif { $y + [winfo height $fm] < $vtop } {
+	    set dist [expr {$vtop - int($y)}]
+	} else {
+	    set dist 0
+	}
+	lappend prioritised [list $dist $fm $fname]
+    }
+    set BROWSER(pending) [list]
+    foreach job [lsort -integer -index 0 $prioritised] {
+	lappend BROWSER(pending) [lrange $job 1 end]
+    }
+}
+
+
+# ::picbrowser::__pool -- Pool of worker threads
+#
+#	This procedure returns the pool of worker threads that is
+#	shared by all browsers, creating it if necessary.  The pool
+#	is sized after the largest -workers option of the browsers
+#	that have used it, each browser keeps at most -workers of its
+#	own thumbnails in the pool (see __dispatch).  All workers are
+#	started at once, since jobs are posted without waiting for
+#	idle workers.  Pools cannot be resized, so a larger pool
+#	replaces the current one when a browser asks for more workers.
+#	The old pool is released once the jobs that it still has are
+#	done, see __jobdone.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	Return the identifier of the pool.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__pool { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    if { $BROWSER(-workers) > $PB(poolsize) } {
+	set old $PB(pool)
+	set PB(pool) [::tpool::create -minworkers $BROWSER(-workers) \
+			  -maxworkers $BROWSER(-workers) \
+			  -idletime $PB(poolidle) -initcmd $PB(workerinit)]
+	set PB(jobs,$PB(pool)) 0
+	set PB(poolsize) $BROWSER(-workers)
+	${log}::notice "Created pool of $PB(poolsize) workers $PB(pool)"
+	if { $old ne "" } {
+	    ${log}::notice "Retiring pool $old once its $PB(jobs,$old)\
+                            job(s) are done"
+	    __jobdone $old 0
+	}
+    }
+    return $PB(pool)
+}
+
+
+# ::picbrowser::__post -- Post a job to the pool of worker threads
+#
+#	This procedure posts a job to the pool of worker threads,
+#	counting the jobs of the pool until they are done, see
+#	__jobdone.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	job	Script to execute in a worker thread
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__post { top job } {
+    variable PB
+
+    set pool [__pool $top]
+    incr PB(jobs,$pool)
+    ::tpool::post -detached -nowait $pool \
+	[list ::__picbrowser_job [::thread::id] $pool $job]
+}
+
+
+# ::picbrowser::__jobdone -- Account for the end of a job
+#
+#	This procedure is called in the main thread by the workers
+#	once they are done with a job, after the job itself has
+#	reported to the main thread.  Pools that have been replaced
+#	are released once all their jobs are done, releasing them
+#	earlier would drop these jobs.
+#
+# Arguments:
+#	pool	Identifier of the pool that ran the job
+#	done	Number of jobs that are done
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	Worker threads of retired pools exit.
+proc ::picbrowser::__jobdone { pool { done 1 } } {
+    variable PB
+    variable log
+
+    incr PB(jobs,$pool) -$done
+    if { $pool ne $PB(pool) && $PB(jobs,$pool) <= 0 } {
+	unset PB(jobs,$pool)
+	::tpool::release $pool
+	${log}::notice "Released retired pool $pool"
+    }
+}
+
+
+# ::picbrowser::__dispatch -- Dispatch thumbnail creation
+#
+#	This procedure hands out the pending thumbnails that are
+#	closest to the visible part of the browser to the pool of
+#	worker threads, until -workers thumbnails are being computed.
+#	Icons that have been destroyed or recycled for other entries
+#	since they were queued are silently dropped.  When threads or
+#	ImageMagick are not available, or when -workers is 0,
+#	thumbnails are created one at a time from the event loop
+#	instead.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__dispatch { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    if { ![info exists BROWSER] } {
+	return
+    }
+    set BROWSER(dispatch) ""
+    if { ![winfo exists $top.canvas] } {
+	return
+    }
+
+    __prioritise $top
+    set pooled [expr {$PB(threadcapable) && $BROWSER(-workers) > 0}]
+    while { [llength $BROWSER(pending)] > 0 } {
+	if { $pooled && $BROWSER(inflight) >= $BROWSER(-workers) } {
+	    break
+	}
+	foreach {fm fname} [lindex $BROWSER(pending) 0] break
+	set BROWSER(pending) [lrange $BROWSER(pending) 1 end]
+	if { ![info exists BROWSER(queued,$fm)] \
+		 || $BROWSER(queued,$fm) ne $fname } {
+	    continue
+	}
+	unset BROWSER(queued,$fm)
+	if { ![winfo exists $fm] || [$fm.ico cget -text] ne $fname } {
+	    continue
+	}
+
+	if { $pooled } {
+	    set prefix [namespace tail [namespace current]]
+	    set dst [::diskutil::temporary_file $prefix png]
+	    foreach {tw th} [split $BROWSER(-thumbsize) "x"] {}
+	    set cmd [::imgop::thumbcommand $fname $tw $th $dst]
+	    if { $cmd ne "" } {
+		incr BROWSER(inflight)
+		__post $top [list ::__picbrowser_thumb [::thread::id] \
+				 $top $fm $fname $cmd $dst]
+		continue
+	    }
+	    set pooled 0
+	}
+
+	# No pool, create this thumbnail and come back for the next
+	# one once pending events have been handled.
+	__readimg $fm $fname
+	break
+    }
+
+    if { !$pooled && [llength $BROWSER(pending)] > 0 } {
+	set BROWSER(dispatch) [after idle ::picbrowser::__dispatch $top]
+    }
+}
+
+
+# ::picbrowser::__thumbdone -- Thumbnail computed by worker
+#
+#	This procedure is called in the main thread by the workers
+#	once they have written a thumbnail to a temporary file.  The
+#	Tk photo is created and installed, if the icon still exists,
+#	and more thumbnails are dispatched.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	fm	Frame container for the icon.
+#	fname	Full path to the picture.
+#	dst	Temporary file containing the thumbnail
+#	err	Error from the worker, empty on success
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	Removes the temporary file.
+proc ::picbrowser::__thumbdone { top fm fname dst err } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    if { $err ne "" } {
+	${log}::warn "Error when creating thumbnail of $fname: $err"
+    } elseif { [info exists BROWSER] } {
+	__cachestore $top $fname $dst
+    }
+    if { $err eq "" && [winfo exists $fm.ico] \
+	     && [$fm.ico cget -text] eq $fname } {
+	set img [::imgop::loadimage $dst]
+	if { $img ne "" } {
+	    foreach {tw th} [split $BROWSER(-thumbsize) "x"] {}
+	    ::imgop::adopt $img $fname $tw $th
+	    $fm.ico configure -image $img
+	    __trigger $top IconInstall $fname $fm $img
+	}
+    }
+    catch {file delete $dst}
+
+    if { [info exists BROWSER] } {
+	incr BROWSER(inflight) -1
+	if { $BROWSER(dispatch) eq "" } {
+	    set BROWSER(dispatch) [after idle ::picbrowser::__dispatch $top]
+	}
+    }
+}
+
+
 # ::picbrowser::__select -- Select
 #
 #	This procedure is called when an icon is selected.  It changes
@@ -153,11 +621,15 @@ proc ::picbrowser::__select { top fm fullpath } {
 }
 
 
-# ::picbrowser::__freeicon -- Destroy an icon
+# ::picbrowser::__destroyicon -- Release an icon
 #
-#	This procedure destroys an icon and all the resources that are
-#	associated to it, i.e. the image if it is not one of the
-#	standard images.
+#	This procedure releases an icon and all the resources that
+#	are associated to it, i.e. the image if it is not one of the
+#	standard images.  The widgets composing the icon are removed
+#	from the canvas and kept in a pool, so that they can be
+#	recycled by __picicon.  The thumbnail of the icon is removed
+#	from the queue, if it was pending, so that recycled icons
+#	never carry thumbnails of their previous pictures.
 #
 # Arguments:
 #	top	Top picbrowser widget
@@ -181,24 +653,33 @@ proc ::picbrowser::__destroyicon { top ico } {
 
     set varname "::picbrowser::browser_${top}"
     upvar \#0 $varname BROWSER
+    upvar \#0 ::picbrowser::icons_${top} ICONS
 
     if { [winfo exists $ico] } {
-	if { $PB(dndcapable) && [string is true $BROWSER(-dnd)] } {
-	    foreach w [list $ico.ico $ico.lbl] {
-		::tkdnd::drag_source unregister $w
+	set img [$ico.ico cget -image]
+	set fullpath [$ico.ico cget -text]
+	if { [info exists BROWSER(entry,$ico)] } {
+	    unset ICONS($BROWSER(entry,$ico))
+	    unset BROWSER(entry,$ico)
+	}
+	if { [info exists BROWSER(queued,$ico)] } {
+	    unset BROWSER(queued,$ico)
+	    set BROWSER(viewport) ""; # Prune the queue at next dispatch
+	    if { $BROWSER(dispatch) eq "" } {
+		set BROWSER(dispatch) \
+		    [after idle ::picbrowser::__dispatch $top]
 	    }
 	}
-	set img [$ico.ico cget -image]
-	set fullpath [$ico.lbl cget -text]
 	__trigger $top IconDestroy $fullpath
-	::destroy $ico
+	catch {$top.canvas delete $ico}
+	$ico.ico configure -image "" -text ""
 	if { $img ne "" \
 		 && [lsearch [list $PB(ico_up) $PB(ico_folder) \
 				  $PB(ico_unknown) $PB(ico_image) \
 				  $PB(ico_home)] $img] < 0 } {
-	    catch {image delete $img}
+	    ::imgop::release $img
 	}
-	catch {$top.canvas delete $ico}
+	lappend BROWSER(pool) $ico
     }
 }
 
@@ -237,6 +718,101 @@ proc ::picbrowser::__dragsource { top fullpath } {
 }
 
 
+# ::picbrowser::__filetype -- Image format of a file
+#
+#	This procedure returns the image format of a file, as sniffed
+#	from its first bytes.  Results are cached, and the cache for a
+#	directory is invalidated whenever the directory is scanned
+#	again after its modification time has changed.
+#
+# Arguments:
+#	fullpath	Full path to the file
+#
+# Results:
+#	Return the image format, an empty string if the file is not
+#	a (known) image.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__filetype { fullpath } {
+    variable FTYPES
+
+    if { ![info exists FTYPES($fullpath)] } {
+	set FTYPES($fullpath) [::imgop::sniff $fullpath]
+	__remember [file dirname $fullpath]
+    }
+    return $FTYPES($fullpath)
+}
+
+
+# ::picbrowser::__remember -- Bound the caches of directories
+#
+#	This procedure marks a directory as the most recently used in
+#	the caches of listings and file types.  The least recently used
+#	directories are forgotten once the caches hold more than
+#	PB(cachefiles) file types or PB(cachedirs) directories.
+#
+# Arguments:
+#	dir	Path to directory
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__remember { dir } {
+    variable PB
+    variable FTYPES
+    variable DIRCACHE
+    variable log
+
+    if { [lindex $PB(cached) end] ne $dir } {
+	set idx [lsearch -exact $PB(cached) $dir]
+	if { $idx >= 0 } {
+	    set PB(cached) [lreplace $PB(cached) $idx $idx]
+	}
+	lappend PB(cached) $dir
+    }
+    while { [llength $PB(cached)] > 1 \
+		&& ([array size FTYPES] > $PB(cachefiles) \
+			|| [llength $PB(cached)] > $PB(cachedirs)) } {
+	set old [lindex $PB(cached) 0]
+	set PB(cached) [lrange $PB(cached) 1 end]
+	__forget $old
+	if { [info exists DIRCACHE($old)] } {
+	    unset DIRCACHE($old)
+	}
+	${log}::debug "Forgot cached listing and file types of $old"
+    }
+}
+
+
+# ::picbrowser::__iconsize -- Size of icons
+#
+#	This procedure computes the size of the icons of a browser,
+#	i.e. the size of the thumbnails and the height of the label
+#	under them.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	Return a list with the width and height of the icons.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__iconsize { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    foreach {tw th} [split $BROWSER(-thumbsize) "x"] {}
+    return [list $tw [expr {$th+[font metrics $BROWSER(-font) -linespace]}]]
+}
+
+
 # ::picbrowser::__picicon -- Create an icon for a file
 #
 #	This procedure creates a widget that will serve as an icon for
@@ -305,20 +881,17 @@ proc ::picbrowser::__picicon { top fullpath {sizeestimate_p ""}} {
     if { $sizeestimate_p ne "" } {
 	upvar $sizeestimate_p ico_size
 
-	set ico_size \
-	    [list $tw [expr {$th+[font metrics $BROWSER(-font) -linespace]}]]
+	set ico_size [__iconsize $top]
     }
 
     # Check in case we don't already have an icon for that image, if
     # so return it.
-    foreach w [winfo children ${top}.canvas] {
-	if { [string match "*.ico*" $w]} {
-	    if { [winfo exists $w.ico] && [$w.ico cget -text] eq $fullpath } {
-		return $w
-	    }
-	}
+    upvar \#0 ::picbrowser::icons_${top} ICONS
+    if { [info exists ICONS($fullpath)] } {
+	return $ICONS($fullpath)
     }
-    
+    set entry $fullpath
+
     # Decide upon the icon to use for the file/directory which is
     # passed as an argument.  At this point even picture files are
     # represented by a picture icon, this icon will be replaced later
@@ -337,23 +910,41 @@ proc ::picbrowser::__picicon { top fullpath {sizeestimate_p ""}} {
 	    set img $PB(ico_folder)
 	}
     } else {
-	set mtype [::fileutil::magic::mimetype $fullpath]
-	if { [string tolower [lindex [split $mtype "/"] 0]] eq "image" } {
-	    set img $PB(ico_image)
+	if { [__filetype $fullpath] ne "" } {
+	    set img [__cachedimg $top $fullpath]
+	    if { $img eq "" } {
+		set img $PB(ico_image)
+	    } else {
+		set cached 1
+	    }
 	} else {
 	    set img $PB(ico_unknown)
 	}
     }
 
     # Now create a frame as a container widget for the icon
-    # representation of the file and for its name.
-    set fm ${top}.canvas.ico[incr PB(idgene)]
-    frame $fm -border 0 -highlightthickness 0
-    label $fm.ico -image $img -width $tw -height $th \
-	-border 0 -highlightthickness 0 -text "$fullpath" \
-	-activebackground white
-    label $fm.lbl -font $BROWSER(-font) -border 0 -highlightthickness 0 \
-	-activebackground white
+    # representation of the file and for its name, or recycle one of
+    # the icons that have been released.
+    if { [llength $BROWSER(pool)] > 0 } {
+	set fm [lindex $BROWSER(pool) end]
+	set BROWSER(pool) [lrange $BROWSER(pool) 0 end-1]
+	$fm.ico configure -image $img -text $fullpath -state normal
+	$fm.lbl configure -state normal
+	set fresh 0
+    } else {
+	set fm ${top}.canvas.ico[incr PB(idgene)]
+	frame $fm -border 0 -highlightthickness 0
+	label $fm.ico -image $img -width $tw -height $th \
+	    -border 0 -highlightthickness 0 -text "$fullpath" \
+	    -activebackground white
+	label $fm.lbl -font $BROWSER(-font) -border 0 -highlightthickness 0 \
+	    -activebackground white
+	pack $fm.ico -side top -fill both -expand no
+	pack $fm.lbl -side bottom -expand no -fill both
+	set fresh 1
+    }
+    set ICONS($entry) $fm
+    set BROWSER(entry,$fm) $entry
 
     # Compute the maximum text that we can fit under the thumbnail
     # icon, we should be more intelligent about which characters to
@@ -364,28 +955,30 @@ proc ::picbrowser::__picicon { top fullpath {sizeestimate_p ""}} {
 	set lbltxt [string range $lbltxt 0 end-1]
     }
     $fm.lbl configure -text $lbltxt
-    pack $fm.ico -side top -fill both -expand no
-    pack $fm.lbl -side bottom -expand no -fill both
 
+    # (Re)bind, replacing the bindings of recycled icons.
     foreach w [list $fm.ico $fm.lbl] {
 	if { [file isdirectory $fullpath] } {
 	    if { [string is true $BROWSER(-singlebrowse)] } {
+		bind $w <Double-Button-1> {}
 		bind $w <Button-1> \
-		    +[list ::picbrowser::__choose $top $fullpath]
+		    [list ::picbrowser::__choose $top $fullpath]
 	    } else {
 		bind $w <Double-Button-1> \
-		    +[list ::picbrowser::__choose $top $fullpath]
+		    [list ::picbrowser::__choose $top $fullpath]
 		bind $w <Button-1> \
-		    +[list ::picbrowser::__select $top $fm $fullpath]
+		    [list ::picbrowser::__select $top $fm $fullpath]
 	    }
 	} else {
 	    bind $w <Double-Button-1> \
-		+[list ::picbrowser::__choose $top $fullpath]
+		[list ::picbrowser::__choose $top $fullpath]
 	    bind $w <Button-1> \
-		+[list ::picbrowser::__select $top $fm $fullpath]
+		[list ::picbrowser::__select $top $fm $fullpath]
 	}
 	if { $PB(dndcapable) && [string is true $BROWSER(-dnd)] } {
-	    ::tkdnd::drag_source register $w
+	    if { $fresh } {
+		::tkdnd::drag_source register $w
+	    }
 	    bind $w <<DragInitCmd>> \
 		[list ::picbrowser::__dragsource $top $fullpath]
 	}
@@ -393,13 +986,13 @@ proc ::picbrowser::__picicon { top fullpath {sizeestimate_p ""}} {
 
     # Schedule the replacement of the standard picture icon by a
     # thumbnail of the original picture.  Since thumbnail creation
-    # takes time, we do this in an asynchronous manner.  We really
-    # should be using some other tricks here, for example using a
-    # queue not to convert too many images at once and/or using the
-    # "database" of thumbnails that windows explorer sometimes leaves
-    # behind in the directories.
+    # takes time, we do this in an asynchronous manner, through a
+    # queue that favours visible icons.  Thumbnails that were found
+    # in the persistent cache are installed at once.
     if { $img eq $PB(ico_image) } {
-	after idle ::picbrowser::__readimg $fm [list $fullpath]
+	__enqueue $top $fm $fullpath
+    } elseif { [info exists cached] } {
+	__trigger $top IconInstall $fullpath $fm $img
     }
 
     return $fm
@@ -441,12 +1034,17 @@ proc ::picbrowser::__destroy { top } {
 	}
 
 	# Remove all current icons.
-	foreach ico [winfo children ${top}.canvas] {
-	    if { [string match "*.ico*" $ico] } {
-		__destroyicon $top $ico
+	upvar \#0 ::picbrowser::icons_${top} ICONS
+	foreach {entry ico} [array get ICONS] {
+	    __destroyicon $top $ico
+	}
+	unset ICONS
+
+	foreach id [list $BROWSER(dispatch) $BROWSER(layout)] {
+	    if { $id ne "" } {
+		after cancel $id
 	    }
 	}
-	
 	__trigger $top BrowserDestroy
 
 	unset BROWSER
@@ -572,6 +1170,7 @@ proc ::picbrowser::__settitle { top } {
 #	None.
 proc ::picbrowser::__fill { top } {
     variable PB
+    variable DIRCACHE
     variable log
 
     # Check that this is one of our browsers
@@ -584,90 +1183,334 @@ proc ::picbrowser::__fill { top } {
     set varname "::picbrowser::browser_${top}"
     upvar \#0 $varname BROWSER
 
-    # Remember all old icons for later removal
-    set oldicons [list]
-    foreach w [winfo children ${top}.canvas] {
-	if { [string match "*.ico*" $w] } {
-	    lappend oldicons $w
+    __trigger $top BrowserFill \$BROWSER(curdir)
+    __settitle $top
+
+    # Entries that are not part of the directory listing come first.
+    set dir $BROWSER(curdir)
+    set homepath [file normalize $BROWSER(-root)]
+    set BROWSER(entries) [list]
+    if { [string is true $BROWSER(-home)] } {
+	lappend BROWSER(entries) $homepath
+    }
+    if { [file normalize $dir] ne $homepath } {
+	lappend BROWSER(entries) [file join $dir ".."]
+    }
+
+    # Reuse the listing of the directory if it has not changed since
+    # it was last scanned, otherwise scan it in a worker thread, which
+    # will deliver entries in batches, or at once when threads are not
+    # available.
+    if { [catch {file mtime $dir} mtime] } {
+	set mtime ""
+    }
+    set BROWSER(scan) [incr PB(idgene)]
+    if { [info exists DIRCACHE($dir)] \
+	     && [lindex $DIRCACHE($dir) 0] eq $mtime } {
+	foreach {mtime dirs files} $DIRCACHE($dir) break
+	__remember $dir
+	__addentries $top $dir $dirs $files
+    } else {
+	__forget $dir
+	if { $PB(threadcapable) && $BROWSER(-workers) > 0 } {
+	    ${log}::debug "Scanning $dir in the background"
+	    set BROWSER(scandirs) [list]
+	    set BROWSER(scanfiles) [list]
+	    __post $top [list ::__picbrowser_scan [::thread::id] $top \
+			     $BROWSER(scan) $dir $BROWSER(-files) \
+			     $BROWSER(-scanbatch)]
+	} else {
+	    set dirs [lsort [glob -nocomplain -tails \
+				 -directory $dir -type d *]]
+	    set files [lsort [glob -nocomplain -tails \
+				  -directory $dir -type f $BROWSER(-files)]]
+	    ${log}::debug "Gathered [llength $dirs] directories and\
+                           [llength $files] files in $dir"
+	    set DIRCACHE($dir) [list $mtime $dirs $files]
+	    __remember $dir
+	    __addentries $top $dir $dirs $files
 	}
     }
 
-    __trigger $top BrowserFill \$BROWSER(curdir)
+    # Remove icons that belonged to another directory, keep the others
+    # since they will be moved to their new location.
+    upvar \#0 ::picbrowser::icons_${top} ICONS
+    if { [array size ICONS] > 0 } {
+	foreach entry $BROWSER(entries) {
+	    set keep($entry) 1
+	}
+	foreach {entry ico} [array get ICONS] {
+	    if { ![info exists keep($entry)] } {
+		__destroyicon $top $ico
+	    }
+	}
+    }
 
-    # Gather all directories under the current directory.
-    set dirs [lsort [glob -nocomplain -tails \
-			 -directory $BROWSER(curdir) -type d *]]
-    if { [file normalize $BROWSER(curdir)] \
-	     ne [file normalize $BROWSER(-root)] } {
-	set dirs [linsert $dirs 0 ".."]
+    __regrid $top
+    if { $BROWSER(filled) ne $BROWSER(curdir) } {
+	$top.canvas yview moveto 0
+	set BROWSER(filled) $BROWSER(curdir)
     }
-    if { [string is true $BROWSER(-home)] } {
-	set dirs [linsert $dirs 0 [file normalize $BROWSER(-root)]]
+    __layout $top
+
+    set BROWSER(scheduledfill) ""
+}
+
+
+# ::picbrowser::__forget -- Forget cached file types
+#
+#	This procedure forgets the cached image formats of all files
+#	in a directory, since the directory is about to be scanned
+#	again.
+#
+# Arguments:
+#	dir	Path to directory
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__forget { dir } {
+    variable FTYPES
+
+    set ptn [string map [list * \\* ? \\? \[ \\\[ \] \\\] \\ \\\\] $dir]
+    array unset FTYPES [file join $ptn *]
+}
+
+
+# ::picbrowser::__addentries -- Add directory entries
+#
+#	This procedure appends directories and files, as listed in a
+#	directory, to the entries of a browser.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	dir	Directory containing the entries
+#	dirs	List of sub-directories
+#	files	List of files
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__addentries { top dir dirs files } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    foreach fname [concat $dirs $files] {
+	lappend BROWSER(entries) [file join $dir $fname]
     }
+}
 
-    # Gather all files under the current directory
-    set files [lsort [glob -nocomplain -tails \
-			  -directory $BROWSER(curdir) -type f $BROWSER(-files)]]
 
-    ${log}::debug "Gathered directories:$dirs and files:$files\
-                   in $BROWSER(curdir)"
-    __settitle $top
-    
-    # Create and order iconic representations for all directories and
-    # files under the current directory.  The icons are widgets that
-    # are ordered on a canvas in a grid-fashion.  The algorithm places
-    # these widgets on the canvas so that only down scrolling will be
-    # possible.
-    set x 0
-    set y 0
+# ::picbrowser::__scanned -- Receive entries from scanner
+#
+#	This procedure is called in the main thread by the worker
+#	that scans a directory, every time it has gathered a batch of
+#	entries.  Sub-directories are delivered first, then the files
+#	together with their image format.  The entries are appended
+#	to the browser and the visible part of it is laid out again.
+#	Batches from obsolete scans are ignored.  The last batch
+#	carries the modification time of the directory, which is then
+#	cached, or the error that stopped the scan.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	token	Identifier of the scan
+#	dir	Directory being scanned
+#	dirs	List of sub-directories
+#	files	List of files
+#	types	Image format of each file
+#	mtime	Modification time of the directory, empty until last batch
+#	err	Error that stopped the scan, empty if none
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__scanned { top token dir dirs files types mtime \
+				   { err "" } } {
+    variable PB
+    variable DIRCACHE
+    variable FTYPES
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    if { ![info exists BROWSER] || $BROWSER(scan) ne $token } {
+	return
+    }
+
+    foreach fname $files fmt $types {
+	set FTYPES([file join $dir $fname]) $fmt
+    }
+    __remember $dir
+    eval [linsert $dirs 0 lappend BROWSER(scandirs)]
+    eval [linsert $files 0 lappend BROWSER(scanfiles)]
+    __addentries $top $dir $dirs $files
+    __regrid $top
+    if { $BROWSER(layout) eq "" } {
+	set BROWSER(layout) [after idle ::picbrowser::__layout $top]
+    }
+
+    if { $err ne "" } {
+	${log}::warn "Could not scan $dir: $err"
+    } elseif { $mtime ne "" } {
+	${log}::debug "Scanned [llength $BROWSER(scandirs)] directories and\
+                       [llength $BROWSER(scanfiles)] files in $dir"
+	set DIRCACHE($dir) \
+	    [list $mtime $BROWSER(scandirs) $BROWSER(scanfiles)]
+    }
+}
+
+
+# ::picbrowser::__regrid -- Compute grid
+#
+#	This procedure computes the grid on which icons are ordered
+#	on the canvas, so that only down scrolling will be possible,
+#	and the scrolling region from the number of entries.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__regrid { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    foreach {sw sh} [__iconsize $top] {}
     set w [winfo width ${top}.canvas]
-    set h [winfo height ${top}.canvas]
-    set newicons [list]
-    set filldir $BROWSER(curdir)
-    set homepath [file normalize $BROWSER(-root)]
-    foreach fname [concat $dirs $files] {
-	if { $filldir ne $BROWSER(curdir) } {
-	    # Get off if we have managed to already change directory
-	    break
+    set BROWSER(cellw) [expr {$sw + $BROWSER(-spacingx)}]
+    set BROWSER(cellh) [expr {$sh + $BROWSER(-spacingy)}]
+    set BROWSER(cols) [expr {($w - $sw) / $BROWSER(cellw) + 1}]
+    if { $BROWSER(cols) < 1 } {
+	set BROWSER(cols) 1
+    }
+    set rows [expr {([llength $BROWSER(entries)] + $BROWSER(cols) - 1) \
+			/ $BROWSER(cols)}]
+    $top.canvas configure \
+	-scrollregion [list 0 0 $w [expr {$rows * $BROWSER(cellh)}]]
+}
+
+
+# ::picbrowser::__layout -- Materialise visible icons
+#
+#	This procedure arranges for the icons of the entries that are
+#	in the visible part of the canvas, plus one screen above and
+#	below, to exist and to be placed on the grid.  Icons that are
+#	further away are released, so that their widgets can be
+#	recycled.  The cost of a layout thus only depends on the size
+#	of the window, not on the number of entries in the directory.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__layout { top } {
+    variable PB
+    variable log
+
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+    upvar \#0 ::picbrowser::icons_${top} ICONS
+
+    if { ![info exists BROWSER] } {
+	return
+    }
+    set BROWSER(layout) ""
+    if { ![winfo exists $top.canvas] || ![info exists BROWSER(cols)] } {
+	return
+    }
+
+    # Compute the range of entries that should have an icon.
+    set c $top.canvas
+    set h [winfo height $c]
+    set vtop [expr {[$c canvasy 0] - $h}]
+    set vbot [expr {[$c canvasy $h] + $h}]
+    set first [expr {int($vtop / $BROWSER(cellh))}]
+    if { $first < 0 } {
+	set first 0
+    }
+    set first [expr {$first * $BROWSER(cols)}]
+    set last [expr {(int($vbot / $BROWSER(cellh)) + 1) * $BROWSER(cols) - 1}]
+    if { $last >= [llength $BROWSER(entries)] } {
+	set last [expr {[llength $BROWSER(entries)] - 1}]
+    }
+
+    # Release icons that are out of range.
+    set visible [lrange $BROWSER(entries) $first $last]
+    foreach entry $visible {
+	set wanted($entry) 1
+    }
+    foreach {entry ico} [array get ICONS] {
+	if { ![info exists wanted($entry)] } {
+	    __destroyicon $top $ico
 	}
-	if { $fname eq $homepath } {
-	    set fullpath $homepath
+    }
+
+    # Create (or move) icons for all entries in range.
+    set i $first
+    foreach entry $visible {
+	set x [expr {($i % $BROWSER(cols)) * $BROWSER(cellw)}]
+	set y [expr {($i / $BROWSER(cols)) * $BROWSER(cellh)}]
+	if { [info exists ICONS($entry)] } {
+	    $c coords $ICONS($entry) $x $y
 	} else {
-	    set fullpath [file join $BROWSER(curdir) $fname]
-	}
-	set ico [__picicon $top $fullpath spacing]
-	lappend newicons $ico
-	foreach {sw sh} $spacing {}
-	#set img [$ico.ico cget -image]
-	#set item [${top}.canvas create image $x $y -anchor nw -image $img]
-	#${top}.canvas raise $item
-	set item [$top.canvas create window $x $y -window $ico -anchor nw \
-		     -tags $ico]
-	update idletasks
-	__trigger $top IconCreate $fullpath $ico
-
-	incr x $sw
-	incr x $BROWSER(-spacingx)
-
-	if { [expr $x + $sw] > $w } {
-	    set x 0
-	    incr y $sh
-	    incr y $BROWSER(-spacingy)
-	    $top.canvas configure -scrollregion [list 0 0 $w [expr {$y + $sh}]]
-	}
-    }
-
-    # Remove all existing icons from the browser, for the time being
-    # no refresh/append is possible.
-    foreach ico $oldicons {
-	if { [lsearch -exact $newicons $ico] < 0 } {
-	    __destroyicon $top $ico
+	    set ico [__picicon $top $entry]
+	    $c create window $x $y -window $ico -anchor nw -tags $ico
+	    __trigger $top IconCreate $entry $ico
 	}
+	incr i
     }
+}
 
 
+# ::picbrowser::__scrolled -- Scrolling callback
+#
+#	This procedure is called whenever the view of the canvas
+#	changes.  It updates the scrollbar and schedules a layout, so
+#	that icons are created for the entries that are scrolled into
+#	view.
+#
+# Arguments:
+#	top	Top picbrowser widget
+#	first	Fraction of the content at the top of the view
+#	last	Fraction of the content at the bottom of the view
+#
+# Results:
+#	None
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::__scrolled { top first last } {
+    variable PB
+    variable log
 
-    set BROWSER(scheduledfill) ""
+    set varname "::picbrowser::browser_${top}"
+    upvar \#0 $varname BROWSER
+
+    $top.scroll set $first $last
+    if { [info exists BROWSER] && $BROWSER(layout) eq "" } {
+	set BROWSER(layout) [after idle ::picbrowser::__layout $top]
+    }
 }
 
 
@@ -785,7 +1628,8 @@ proc ::picbrowser::__redraw { top } {
 
     # Create the container for all icons if necessary.
     if { ![winfo exist $top.canvas] } {
-	canvas ${top}.canvas -yscrollcommand "${top}.scroll set"
+	canvas ${top}.canvas \
+	    -yscrollcommand [list ::picbrowser::__scrolled $top]
 	scrollbar ${top}.scroll -command "${top}.canvas yview"
 	#grid ${top}.canvas -row 0 -column 0 -sticky news
 	#grid ${top}.scroll -row 0 -column 1 -sticky ns
@@ -850,6 +1694,16 @@ proc ::picbrowser::new { args } {
 	set BROWSER(curwidth) 0
 	set BROWSER(curheight) 0
 	set BROWSER(cbs) ""
+	set BROWSER(pending) [list]
+	set BROWSER(viewport) ""
+	set BROWSER(dispatch) ""
+	set BROWSER(inflight) 0
+	set BROWSER(entries) [list]
+	set BROWSER(pool) [list]
+	set BROWSER(layout) ""
+	set BROWSER(filled) ""
+	set BROWSER(scan) ""
+	array set ::picbrowser::icons_${top} {}
 	lappend PB(browsers) $top
 
 	::uobj::inherit PB BROWSER
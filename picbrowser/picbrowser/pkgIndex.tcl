@@ -9,3 +9,4 @@
 # full path name of this file's directory.
 
 package ifneeded picbrowser 0.2 [list source [file join $dir picbrowser.tcl]]
+package ifneeded picbrowser::thumbcache 0.1 [list source [file join $dir thumbcache.tcl]]
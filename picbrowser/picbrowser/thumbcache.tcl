@@ -0,0 +1,700 @@
+# thumbcache.tcl -- Persistent thumbnail cache
+#
+#	This module implements a persistent cache of thumbnails for
+#	the picture browser.  Thumbnails are keyed by the normalized
+#	path of the picture, its modification time, its size and the
+#	size of the thumbnail, so that modified pictures are never
+#	served from the cache.  Thumbnails are stored one after the
+#	other in a pack file, and an index file maps keys to offsets
+#	in the pack.  New thumbnails, and access times that have
+#	changed, are appended to the index, where later records
+#	supersede earlier ones, so that using the cache does not
+#	rewrite the index each time.  Both files can be shared between
+#	browsers and between processes: all modifications happen
+#	under a lock file (see the lockfile library), rewritten
+#	indices are atomically renamed into place, and each entry in
+#	the pack repeats its key so that readers with a stale index
+#	detect the mismatch.  The lock is waited for from the event
+#	loop, thumbnails that are put in the cache are kept in memory
+#	until then and written in batches.  The pack is compacted,
+#	keeping the most recently used thumbnails, whenever it grows
+#	beyond its byte budget.  Compaction also runs in slices from
+#	the event loop.
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+package require Tcl 8.4
+
+package require uobj
+package require lockfile
+
+namespace eval ::picbrowser::thumbcache {
+    variable TC
+    if { ![info exists TC] } {
+	array set TC {
+	    loaded       ""
+	    checked      0
+	    flush        ""
+	    busy         0
+	    records      0
+	    -dir         "~/.picbrowser"
+	    -budget      67108864
+	    -lowmark     75
+	    -flushdelay  5000
+	    -touchgrain  600
+	    -slice       20
+	    -lockwait    2000
+	    -lockstale   10
+	}
+	variable INDEX;    # Key -> {offset length atime}
+	array set INDEX {}
+	variable TOUCHED;  # Keys which access time should be written -> atime
+	array set TOUCHED {}
+	variable QUEUE;    # Key -> thumbnail not yet written to the pack
+	array set QUEUE {}
+	variable COMPACT;  # State of compaction in progress
+	array set COMPACT {}
+	::uobj::install_log [namespace current] TC; # Creates 'log' variable
+	::uobj::install_defaults [namespace current] TC
+    }
+}
+
+
+# ::picbrowser::thumbcache::__path -- Path to cache files
+#
+#	Return the path to one of the files composing the cache.
+#
+# Arguments:
+#	type	One of pack, idx or lock
+#
+# Results:
+#	Full path to the file.
+#
+# Side Effects:
+#	Creates the cache directory if necessary.
+proc ::picbrowser::thumbcache::__path { type } {
+    variable TC
+
+    set dir [file normalize $TC(-dir)]
+    if { ![file isdirectory $dir] } {
+	file mkdir $dir
+    }
+    return [file join $dir thumbs.$type]
+}
+
+
+# ::picbrowser::thumbcache::key -- Compute cache key for a picture
+#
+#	Compute the key under which the thumbnail of a picture is
+#	stored.  The key captures the identity of the picture file so
+#	that modified pictures lead to new keys.
+#
+# Arguments:
+#	fname	Path to picture
+#	tsize	Size of thumbnail, e.g. 64x64
+#
+# Results:
+#	Return the key, an empty string if the file cannot be accessed.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::key { fname tsize } {
+    if { [catch {file stat $fname stat}] } {
+	return ""
+    }
+    return [list [file normalize $fname] $stat(mtime) $stat(size) $tsize]
+}
+
+
+# ::picbrowser::thumbcache::__load -- (Re)load index
+#
+#	Read the index from disk whenever it has changed since it was
+#	last read, e.g. because another process has added thumbnails.
+#	Access times of entries that have been used since the last
+#	write of the index are kept.
+#
+# Arguments:
+#	force	Reload even if the index file seems unchanged.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__load { { force 0 } } {
+    variable TC
+    variable INDEX
+    variable TOUCHED
+    variable log
+
+    set idx [__path idx]
+    if { [catch {file stat $idx stat}] } {
+	set id ""
+    } else {
+	set id [list $stat(mtime) $stat(size) $stat(ino)]
+    }
+    if { !$force && $id eq $TC(loaded) } {
+	return
+    }
+
+    array unset INDEX
+    array set INDEX {}
+    set TC(records) 0
+    if { $id ne "" } {
+	if { [catch {open $idx r} fd] } {
+	    ${log}::warn "Could not read index $idx: $fd"
+	} else {
+	    fconfigure $fd -encoding utf-8
+	    set content [read $fd]
+	    close $fd
+	    if { [catch {array set INDEX $content} err] } {
+		# Keep the records that are valid, e.g. when an append
+		# was interrupted.
+		${log}::warn "Corrupted index at $idx, skipping broken\
+                              records: $err"
+		foreach line [split $content "\n"] {
+		    if { [catch {llength $line} len] == 0 && $len == 2 } {
+			set INDEX([lindex $line 0]) [lindex $line 1]
+			incr TC(records)
+		    }
+		}
+	    } else {
+		set TC(records) [expr {[llength $content] / 2}]
+	    }
+	}
+    }
+    foreach key [array names TOUCHED] {
+	if { [info exists INDEX($key)] } {
+	    lset INDEX($key) 2 $TOUCHED($key)
+	}
+    }
+    set TC(loaded) $id
+    ${log}::debug "Loaded [array size INDEX] entries from $idx"
+}
+
+
+# ::picbrowser::thumbcache::__loaded -- Remember index state
+#
+#	Remember the state of the index file after this process has
+#	modified it, so that it is not read again.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__loaded { } {
+    variable TC
+
+    if { [catch {file stat [__path idx] stat}] == 0 } {
+	set TC(loaded) [list $stat(mtime) $stat(size) $stat(ino)]
+    }
+}
+
+
+# ::picbrowser::thumbcache::__save -- Write index
+#
+#	Write the index to disk, atomically replacing the existing
+#	one.  This should only be called with the lock held.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__save { } {
+    variable TC
+    variable INDEX
+    variable TOUCHED
+    variable log
+
+    set idx [__path idx]
+    set tmp $idx.[pid]
+    if { [catch {open $tmp w} fd] } {
+	${log}::warn "Could not write index to $tmp: $fd"
+	return
+    }
+    fconfigure $fd -encoding utf-8
+    foreach key [array names INDEX] {
+	puts $fd [list $key $INDEX($key)]
+    }
+    close $fd
+    file rename -force $tmp $idx
+
+    array unset TOUCHED
+    array set TOUCHED {}
+    set TC(records) [array size INDEX]
+    __loaded
+}
+
+
+# ::picbrowser::thumbcache::__append -- Append to index
+#
+#	Append the records of entries to the index on disk, later
+#	records supersede earlier ones when the index is loaded.  This
+#	should only be called with the lock held and with an index
+#	that is up to date.
+#
+# Arguments:
+#	keys	Keys of entries
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__append { keys } {
+    variable TC
+    variable INDEX
+    variable log
+
+    if { [llength $keys] == 0 } {
+	return
+    }
+    set idx [__path idx]
+    if { [catch {open $idx {WRONLY CREAT APPEND}} fd] } {
+	${log}::warn "Could not append to index $idx: $fd"
+	return
+    }
+    fconfigure $fd -encoding utf-8
+    foreach key $keys {
+	puts $fd [list $key $INDEX($key)]
+    }
+    close $fd
+    incr TC(records) [llength $keys]
+    __loaded
+}
+
+
+# ::picbrowser::thumbcache::__flush -- Write pending modifications
+#
+#	Request the lock in order to write the thumbnails that have
+#	been put in the cache and the access times that have changed
+#	since last write, unless this is already in progress.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__flush { } {
+    variable TC
+    variable QUEUE
+    variable TOUCHED
+
+    set TC(flush) ""
+    if { $TC(busy) || ([array size QUEUE] == 0 && [array size TOUCHED] == 0) } {
+	return
+    }
+    set TC(busy) 1
+    ::lockfile::lock [__path lock] [namespace current]::__locked \
+	-wait $TC(-lockwait) -stale $TC(-lockstale)
+}
+
+
+# ::picbrowser::thumbcache::__schedule -- Schedule write
+#
+#	Schedule the writing of pending modifications.
+#
+# Arguments:
+#	now	Write as soon as possible rather than after -flushdelay
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::picbrowser::thumbcache::__schedule { { now 0 } } {
+    variable TC
+
+    if { $TC(flush) ne "" } {
+	if { ! $now } {
+	    return
+	}
+	after cancel $TC(flush)
+    }
+    if { $now } {
+	set TC(flush) [after idle [namespace current]::__flush]
+    } else {
+	set TC(flush) [after $TC(-flushdelay) [namespace current]::__flush]
+    }
+}
+
+
+# ::picbrowser::thumbcache::__locked -- Write under lock
+#
+#	Called back once the lock has been acquired, or could not be.
+#	Append the pending thumbnails to the pack, and their records
+#	and changed access times to the index.  The pack is compacted
+#	when it goes over budget, and the index is rewritten when it
+#	mostly contains superseded records.
+#
+# Arguments:
+#	ok	1 if the lock was acquired, 0 otherwise
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Modifies the pack and index files.
+proc ::picbrowser::thumbcache::__locked { ok } {
+    variable TC
+    variable INDEX
+    variable QUEUE
+    variable TOUCHED
+    variable log
+
+    if { ! $ok } {
+	${log}::warn "Dropping [array size QUEUE] thumbnail(s), cache is\
+                      locked"
+	array unset QUEUE
+	array set QUEUE {}
+	set TC(busy) 0
+	if { [array size TOUCHED] } {
+	    __schedule
+	}
+	return
+    }
+
+    if { [catch {__write} size] } {
+	${log}::warn "Could not write to thumbnail cache: $size"
+	__done
+    } elseif { $size > $TC(-budget) } {
+	__compact
+    } else {
+	if { $TC(records) > 2 * [array size INDEX] + 64 } {
+	    __save
+	}
+	__done
+    }
+}
+
+
+# ::picbrowser::thumbcache::__write -- Write pending modifications
+#
+#	Append the pending thumbnails to the pack, and their records
+#	and changed access times to the index.  This should only be
+#	called with the lock held.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return the size of the pack.
+#
+# Side Effects:
+#	Modifies the pack and index files.
+proc ::picbrowser::thumbcache::__write { } {
+    variable INDEX
+    variable QUEUE
+    variable TOUCHED
+
+    __load
+
+    set pack [__path pack]
+    set fd [open $pack {WRONLY CREAT}]
+    fconfigure $fd -translation binary
+    seek $fd 0 end
+    set ofs [tell $fd]
+    set now [clock seconds]
+    set keys [list]
+    foreach key [array names QUEUE] {
+	set entry [encoding convertto utf-8 $key]
+	append entry "\n" $QUEUE($key)
+	puts -nonewline $fd $entry
+	set INDEX($key) [list $ofs [string length $entry] $now]
+	incr ofs [string length $entry]
+	lappend keys $key
+    }
+    close $fd
+    array unset QUEUE
+    array set QUEUE {}
+
+    foreach key [array names TOUCHED] {
+	if { [info exists INDEX($key)] && [lsearch -exact $keys $key] < 0 } {
+	    lappend keys $key
+	}
+    }
+    array unset TOUCHED
+    array set TOUCHED {}
+    __append $keys
+
+    return $ofs
+}
+
+
+# ::picbrowser::thumbcache::__done -- Release lock
+#
+#	Release the lock and schedule the writing of modifications
+#	that have happened meanwhile.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Removes the lock file.
+proc ::picbrowser::thumbcache::__done { } {
+    variable TC
+    variable QUEUE
+    variable TOUCHED
+
+    ::lockfile::release [__path lock]
+    set TC(busy) 0
+    if { [array size QUEUE] } {
+	__schedule 1
+    } elseif { [array size TOUCHED] } {
+	__schedule
+    }
+}
+
+
+# ::picbrowser::thumbcache::__compact -- Evict least recently used entries
+#
+#	Start rewriting the pack with the most recently used
+#	thumbnails only, until -lowmark percent of the -budget is
+#	reached.  The pack is copied in slices of at most -slice
+#	milliseconds from the event loop, see __compactstep.  This
+#	should only be called with the lock held, which is released
+#	once compaction has ended.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Replaces the pack and index files.
+proc ::picbrowser::thumbcache::__compact { } {
+    variable TC
+    variable INDEX
+    variable COMPACT
+    variable log
+
+    set pack [__path pack]
+    set entries [list]
+    foreach key [array names INDEX] {
+	lappend entries [list [lindex $INDEX($key) 2] $key]
+    }
+
+    if { [catch {open $pack r} in] } {
+	${log}::warn "Could not open $pack for compaction: $in"
+	__done
+	return
+    }
+    fconfigure $in -translation binary
+    if { [catch {open $pack.[pid] w} out] } {
+	${log}::warn "Could not create compacted pack: $out"
+	close $in
+	__done
+	return
+    }
+    fconfigure $out -translation binary
+
+    array unset COMPACT
+    array set COMPACT [list in $in out $out total 0 kept [list] \
+			   target [expr {wide($TC(-budget)) * $TC(-lowmark) / 100}] \
+			   entries [lsort -integer -decreasing -index 0 $entries]]
+    after idle [namespace current]::__compactstep
+}
+
+
+# ::picbrowser::thumbcache::__compactstep -- Compact a slice
+#
+#	Copy entries to the compacted pack for at most -slice
+#	milliseconds, then come back from the event loop.  The lock is
+#	refreshed at each slice, so that it never looks stale to other
+#	processes.  Once done, the compacted pack replaces the pack and
+#	the index is rewritten.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Replaces the pack and index files.
+proc ::picbrowser::thumbcache::__compactstep { } {
+    variable TC
+    variable INDEX
+    variable TOUCHED
+    variable COMPACT
+    variable log
+
+    set pack [__path pack]
+    ::lockfile::touch [__path lock]
+    set end [expr {[clock clicks -milliseconds] + $TC(-slice)}]
+    if { [catch {
+	while { [llength $COMPACT(entries)] } {
+	    set key [lindex $COMPACT(entries) 0 1]
+	    set COMPACT(entries) [lrange $COMPACT(entries) 1 end]
+	    if { ![info exists INDEX($key)] } {
+		continue
+	    }
+	    foreach {ofs len atime} $INDEX($key) break
+	    if { $COMPACT(total) + $len > $COMPACT(target) } {
+		set COMPACT(entries) [list]
+		break
+	    }
+	    seek $COMPACT(in) $ofs start
+	    lappend COMPACT(kept) $key \
+		[list [tell $COMPACT(out)] $len $atime]
+	    puts -nonewline $COMPACT(out) [read $COMPACT(in) $len]
+	    incr COMPACT(total) $len
+	    if { [clock clicks -milliseconds] >= $end } {
+		break
+	    }
+	}
+	set done [expr {[llength $COMPACT(entries)] == 0}]
+	if { $done } {
+	    close $COMPACT(out)
+	    file rename -force $pack.[pid] $pack
+	}
+    } err] } {
+	${log}::warn "Could not compact $pack: $err"
+	catch {close $COMPACT(out)}
+	catch {file delete $pack.[pid]}
+	close $COMPACT(in)
+	array unset COMPACT
+	__done
+	return
+    }
+    if { ! $done } {
+	after idle [list after 0 [namespace current]::__compactstep]
+	return
+    }
+
+    close $COMPACT(in)
+    ${log}::info "Compacted thumbnail cache from [array size INDEX] to\
+                  [expr {[llength $COMPACT(kept)] / 2}] entries\
+                  ($COMPACT(total) bytes)"
+    array unset INDEX
+    array set INDEX $COMPACT(kept)
+    array unset COMPACT
+    # Thumbnails used while compacting were used last.
+    foreach key [array names TOUCHED] {
+	if { [info exists INDEX($key)] } {
+	    lset INDEX($key) 2 $TOUCHED($key)
+	}
+    }
+    __save
+    __done
+}
+
+
+# ::picbrowser::thumbcache::get -- Get a thumbnail from the cache
+#
+#	Look for a thumbnail in the cache and return its (encoded)
+#	content.
+#
+# Arguments:
+#	key	Key of thumbnail, as returned by key.
+#
+# Results:
+#	Return the content of the thumbnail, an empty string when the
+#	thumbnail is not in the cache.
+#
+# Side Effects:
+#	Marks the thumbnail as recently used.
+proc ::picbrowser::thumbcache::get { key } {
+    variable TC
+    variable INDEX
+    variable TOUCHED
+    variable QUEUE
+    variable log
+
+    if { $key eq "" } {
+	return ""
+    }
+    if { [info exists QUEUE($key)] } {
+	return $QUEUE($key)
+    }
+
+    # Look for changes made by others at most once per second.
+    set now [clock seconds]
+    if { $now != $TC(checked) } {
+	__load
+	set TC(checked) $now
+    }
+
+    for { set attempt 0 } { $attempt < 2 } { incr attempt } {
+	if { ![info exists INDEX($key)] } {
+	    return ""
+	}
+	foreach {ofs len atime} $INDEX($key) break
+	set data ""
+	if { [catch {open [__path pack] r} fd] == 0 } {
+	    fconfigure $fd -translation binary
+	    seek $fd $ofs start
+	    set data [read $fd $len]
+	    close $fd
+	}
+
+	# Check that the entry really is ours, the pack might have
+	# been compacted by another process.
+	set ekey [encoding convertto utf-8 $key]
+	set nl [string length $ekey]
+	if { [string range $data 0 $nl] eq "$ekey\n" } {
+	    # Access times only need to be precise enough for eviction,
+	    # do not write them at every access.
+	    if { $now - $atime >= $TC(-touchgrain) } {
+		set INDEX($key) [list $ofs $len $now]
+		set TOUCHED($key) $now
+		__schedule
+	    }
+	    return [string range $data [expr {$nl + 1}] end]
+	}
+	${log}::debug "Stale index entry for $key, reloading index"
+	__load 1
+    }
+
+    return ""
+}
+
+
+# ::picbrowser::thumbcache::put -- Store a thumbnail in the cache
+#
+#	Put a thumbnail in the cache.  The thumbnail is kept in memory
+#	(and served from there) until the lock could be acquired, it is
+#	then appended to the pack and recorded at the end of the
+#	index.
+#
+# Arguments:
+#	key	Key of thumbnail, as returned by key.
+#	data	Encoded content of the thumbnail
+#
+# Results:
+#	Return 1 if the thumbnail will be stored, 0 otherwise.
+#
+# Side Effects:
+#	Modifies the pack and index files, later.
+proc ::picbrowser::thumbcache::put { key data } {
+    variable QUEUE
+
+    if { $key eq "" } {
+	return 0
+    }
+    set QUEUE($key) $data
+    __schedule 1
+
+    return 1
+}
+
+
+package provide picbrowser::thumbcache 0.1
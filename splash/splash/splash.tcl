@@ -29,6 +29,7 @@ namespace eval ::splash {
 	    -autoraise         on
 	    -topmost           on
 	    -alpha             1.0
+	    -refresh           40
 	    idgene             0
 	    prefix             splash
 	    wins               ""
@@ -64,7 +65,9 @@ namespace eval ::splash {
 #	main (.) window and make it automatically appear once
 #	destroyed.  -autoraise is a boolean which can force the window
 #	to raise on top of all other windows every time the
-#	initialisiation progresses.
+#	initialisiation progresses.  -refresh is the minimum number of
+#	milliseconds between two refreshes of the screen when the
+#	initialisation progresses.
 #
 # Arguments:
 #	args	list of options, see above
@@ -93,6 +96,8 @@ proc ::splash::new { args } {
     set Splash(img) ""
     set Splash(destruction) ""
     set Splash(progress) 0
+    set Splash(refreshed) 0
+    set Splash(refresh) ""
 
     # Copy default options
     foreach opt [array names SPLASH "-*"] {
@@ -280,11 +285,55 @@ proc ::splash::redraw { wname } {
 }
 
 
+# ::splash::__refresh -- Refresh a splash window
+#
+#	This command brings the progress bar of a splash window up to
+#	date, raising the window if necessary.  When called from the
+#	progress command, it also lets Tk refresh the screen, since
+#	initialisation typically is running outside the event loop.
+#
+# Arguments:
+#	wname	Name of splash window, as returned by ::splash::new
+#	update	Should we let Tk update the screen at once.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Will modify the appearance of the splash window.
+proc ::splash::__refresh { wname { update on } } {
+    if { ! [info exists ::splash::$wname] } {
+	return
+    }
+
+    set varname ::splash::$wname
+    upvar \#0 $varname Splash
+
+    if { $Splash(refresh) ne "" } {
+	after cancel $Splash(refresh)
+	set Splash(refresh) ""
+    }
+
+    if { $Splash(-progress) >= 0 && [winfo exists ${wname}.pgess] } {
+	progressbar:set ${wname}.pgess $Splash(progress)
+    }
+    if { [string is true $Splash(-autoraise)] && [winfo exists $wname] } {
+	raise $wname
+	if { [string is true $update] } {
+	    update
+	}
+    }
+    set Splash(refreshed) [clock clicks -milliseconds]
+}
+
+
 # ::splash::progress -- Modify progress in a splash window
 #
 #	This command will modify the progress level of a given splash
 #	window and update both the progress bar and text if possible
-#	and necessary.
+#	and necessary.  The screen is refreshed at most once every
+#	-refresh milliseconds, progress made in between is shown on
+#	the next refresh, or when the application becomes idle.
 #
 # Arguments:
 #	wname	Name of splash window, as returned by ::splash::new
@@ -325,16 +374,22 @@ proc ::splash::progress { wname {txt ""} {pgs_n 1}} {
 
     if { $Splash(-progress) >= 0 } {
 	incr Splash(progress) $pgs_n
-	progressbar:set ${wname}.pgess $Splash(progress)
 	lappend res "PROGRESS"
     }
 
     if { [string is true $Splash(-autoraise)] } {
-	raise $wname
-	update
 	lappend res "RAISE"
     }
 
+    # Refresh at once if it is time to, otherwise arrange for the
+    # latest state to be shown when idle.
+    set now [clock clicks -milliseconds]
+    if { $now - $Splash(refreshed) >= $Splash(-refresh) } {
+	__refresh $wname
+    } elseif { $Splash(refresh) eq "" } {
+	set Splash(refresh) [after idle [list ::splash::__refresh $wname off]]
+    }
+
     return $res
 }
 
@@ -373,6 +428,9 @@ proc ::splash::destroy { wname } {
 	if { [array names Splash img] ne "" && $Splash(img) ne "" } {
 	    image delete $Splash(img)
 	}
+	if { [array names Splash refresh] ne "" && $Splash(refresh) ne "" } {
+	    after cancel $Splash(refresh)
+	}
 	if { [array names Splash -hidemain] ne "" \
 		 && [string is true $Splash(-hidemain)] } {
 	    wm deiconify .
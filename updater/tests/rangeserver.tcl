@@ -0,0 +1,263 @@
+# rangeserver.tcl -- Local HTTP server with range support
+#
+#	A minimal HTTP/1.0 server that serves the files of a directory
+#	and honours single byte range requests, so that the delta
+#	updates and chunked downloads of the updater can be exercised
+#	without a real web server.  The server can be told not to
+#	support range requests, or to ignore them while advertising
+#	them, as some servers do, and to drop the connection of given
+#	requests, in order to simulate interrupted downloads.  It is
+#	either sourced, see ::rangeserver::start, or run on its own:
+#
+#	tclsh rangeserver.tcl ?-port port? ?-root dir? ?-ranges mode?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+namespace eval ::rangeserver {
+    variable RS
+    if { ! [info exists RS] } {
+	array set RS {
+	    server   ""
+	    port     0
+	    nreq     0
+	    requests {}
+	    -root    .
+	    -ranges  on
+	    -drop    {}
+	}
+    }
+}
+
+
+# ::rangeserver::start -- Start serving
+#
+#	Start serving the files of a directory on a port of the local
+#	host.  Options that are not given take their default values.
+#	The options are:
+#	-root    Directory to serve files from
+#	-ranges  on to honour range requests, off to not support them,
+#	         ignore to advertise them but answer with the whole file
+#	-drop    List of request numbers (starting from 1) which
+#	         connection is closed without answering
+#
+# Arguments:
+#	port	Port to listen on, 0 for any free port
+#	args	Dash-led options and their values, see above
+#
+# Results:
+#	Return the port that the server listens on.
+#
+# Side Effects:
+#	Opens a server socket.
+proc ::rangeserver::start { { port 0 } args } {
+    variable RS
+
+    array set RS { -root . -ranges on -drop {} }
+    foreach {opt val} $args {
+	if { ![info exists RS($opt)] } {
+	    return -code error "Unknown option $opt, should be\
+                                [join [lsort [array names RS -*]] {, }]"
+	}
+	set RS($opt) $val
+    }
+    set RS(nreq) 0
+    set RS(requests) [list]
+    set RS(server) [socket -server ::rangeserver::__accept \
+			-myaddr 127.0.0.1 $port]
+    set RS(port) [lindex [fconfigure $RS(server) -sockname] 2]
+
+    return $RS(port)
+}
+
+
+# ::rangeserver::stop -- Stop serving
+#
+#	Stop listening for new connections.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Closes the server socket.
+proc ::rangeserver::stop { } {
+    variable RS
+
+    if { $RS(server) ne "" } {
+	close $RS(server)
+	set RS(server) ""
+    }
+}
+
+
+# ::rangeserver::requests -- Requests served
+#
+#	Return the requests that were received since the server was
+#	started, in order.  Each request is described by a list
+#	composed of its method, path, range (empty or first and last
+#	byte) and status code (empty when the connection was dropped).
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	List of requests.
+#
+# Side Effects:
+#	None.
+proc ::rangeserver::requests { } {
+    variable RS
+
+    return $RS(requests)
+}
+
+
+# ::rangeserver::__accept -- Accept connection
+#
+#	Prepare to read the request of a new connection.
+#
+# Arguments:
+#	sock	Socket to client
+#	addr	Address of client
+#	port	Port of client
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::rangeserver::__accept { sock addr port } {
+    fconfigure $sock -translation crlf -blocking 0 -buffering line
+    fileevent $sock readable [list ::rangeserver::__read $sock [list]]
+}
+
+
+# ::rangeserver::__read -- Read request
+#
+#	Read the request line and headers of a request, then answer
+#	it once the empty line that ends the headers has arrived.
+#
+# Arguments:
+#	sock	Socket to client
+#	lines	Lines read so far
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::rangeserver::__read { sock lines } {
+    while { [gets $sock line] >= 0 } {
+	if { $line eq "" } {
+	    fileevent $sock readable {}
+	    __answer $sock $lines
+	    return
+	}
+	lappend lines $line
+    }
+    if { [eof $sock] } {
+	close $sock
+	return
+    }
+    fileevent $sock readable [list ::rangeserver::__read $sock $lines]
+}
+
+
+# ::rangeserver::__answer -- Answer request
+#
+#	Answer a GET or HEAD request, with the whole file or with the
+#	range requested.
+#
+# Arguments:
+#	sock	Socket to client
+#	lines	Request line and headers
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Closes the socket.
+proc ::rangeserver::__answer { sock lines } {
+    variable RS
+
+    foreach {method path} [lindex $lines 0] break
+    set range [list]
+    foreach line [lrange $lines 1 end] {
+	if { [regexp -nocase {^Range:\s*bytes=(\d+)-(\d+)\s*$} $line \
+		  -> from to] } {
+	    set range [list $from $to]
+	}
+    }
+
+    set nreq [incr RS(nreq)]
+    if { [lsearch -exact $RS(-drop) $nreq] >= 0 } {
+	lappend RS(requests) [list $method $path $range ""]
+	close $sock
+	return
+    }
+
+    regsub {\?.*$} $path "" path
+    set fname [file join $RS(-root) [string trimleft $path /]]
+    set data ""
+    if { [catch {open $fname} fd] } {
+	set code "404 Not Found"
+    } else {
+	fconfigure $fd -translation binary
+	set data [read $fd]
+	close $fd
+	set size [string length $data]
+	set code "200 OK"
+	if { [llength $range] && $RS(-ranges) eq "on" } {
+	    foreach {from to} $range break
+	    if { $to >= $size } {
+		set to [expr {$size - 1}]
+	    }
+	    if { $from > $to } {
+		set code "416 Requested Range Not Satisfiable"
+		set data ""
+	    } else {
+		set code "206 Partial Content"
+		set data [string range $data $from $to]
+	    }
+	}
+    }
+    lappend RS(requests) [list $method $path $range [lindex $code 0]]
+
+    puts $sock "HTTP/1.0 $code"
+    puts $sock "Content-Type: application/octet-stream"
+    puts $sock "Content-Length: [string length $data]"
+    if { $RS(-ranges) ne "off" } {
+	puts $sock "Accept-Ranges: bytes"
+    }
+    if { [lindex $code 0] == 206 } {
+	puts $sock "Content-Range: bytes $from-$to/$size"
+    }
+    puts $sock ""
+    fconfigure $sock -translation binary -blocking 1
+    if { $method ne "HEAD" } {
+	puts -nonewline $sock $data
+    }
+    close $sock
+}
+
+
+# Run on our own when called as a script.
+if { [info exists argv0] \
+	 && [file normalize $argv0] eq [file normalize [info script]] } {
+    set port 8080
+    set opts [list]
+    foreach {opt val} $argv {
+	if { $opt eq "-port" } {
+	    set port $val
+	} else {
+	    lappend opts $opt $val
+	}
+    }
+    puts "Serving on port [eval [list ::rangeserver::start $port] $opts]"
+    vwait forever
+}
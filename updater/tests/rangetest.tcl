@@ -0,0 +1,315 @@
+# rangetest.tcl -- Exercise delta updates and chunked downloads
+#
+#	Run updater contracts against a local HTTP server (see
+#	rangeserver.tcl) in order to exercise the delta update of a
+#	file from its block signature, chunked downloads through
+#	range requests, the fallback to a single stream when the
+#	server does not honour ranges, and the resumption of
+#	interrupted chunked downloads from their state file.  Files
+#	are created in a temporary directory that is removed at the
+#	end.  The script exits with a non-zero code when a scenario
+#	fails:
+#
+#	tclsh rangetest.tcl
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set here [file dirname [file normalize [info script]]]
+lappend auto_path [file dirname $here]
+source [file join $here rangeserver.tcl]
+package require updater
+
+::updater::defaults -sumcache "" -chunksize 65536 -chunks 3
+
+if { [info exists env(TMP)] } {
+    set tmpdir $env(TMP)
+} else {
+    set tmpdir /tmp
+}
+set dir [file join $tmpdir rangetest[pid]]
+set www [file join $dir www]
+set local [file join $dir local app.bin]
+file mkdir $www [file dirname $local]
+
+# Old version: 600kB of pseudo-random bytes.  New version: bytes
+# inserted and removed in the middle and appended at the end, so that
+# most blocks can be reused but not at their original offset.
+expr {srand(36)}
+set old ""
+for { set i 0 } { $i < 614400 } { incr i } {
+    append old [binary format c [expr {int(rand() * 256)}]]
+}
+set new [string range $old 0 99999]INSERTED[string range $old 100000 299999]
+append new [string range $old 310000 end] APPENDED
+foreach {fname data} [list [file join $dir app.old] $old \
+			  [file join $www app.bin] $new] {
+    set fd [open $fname w]
+    fconfigure $fd -translation binary
+    puts -nonewline $fd $data
+    close $fd
+}
+set sum [::updater::__digest [file join $www app.bin] md5]
+set fd [open [file join $www app.md5] w]
+puts $fd "$sum  app.bin"
+close $fd
+::updater::signature [file join $www app.bin] [file join $www app.sig] 4096 md5
+
+set failures 0
+
+
+# wait -- Wait for a condition
+#
+#	Serve events until a condition is true.
+#
+# Arguments:
+#	cond	Expression to wait for, evaluated at the global level
+#	timeout	Maximum number of milliseconds to wait
+#
+# Results:
+#	Return 1 if the condition became true, 0 on timeout.
+#
+# Side Effects:
+#	Serves events.
+proc wait { cond { timeout 20000 } } {
+    set end [expr {[clock clicks -milliseconds] + $timeout}]
+    while { ! [uplevel \#0 [list expr $cond]] } {
+	if { [clock clicks -milliseconds] > $end } {
+	    return 0
+	}
+	after 20 [list set ::tick 1]
+	vwait ::tick
+    }
+    return 1
+}
+
+
+# installed -- Check installed version
+#
+#	Check whether the new version has been installed.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return 1 if the local file is the new version, 0 otherwise.
+#
+# Side Effects:
+#	None.
+proc installed { } {
+    global local sum
+
+    return [expr {[file exists $local] \
+		      && [::updater::__digest $local md5] eq $sum}]
+}
+
+
+# contract -- Create a contract for the served file
+#
+#	Prepare the local file and create a contract that checks for
+#	the served file, this starts a first check.
+#
+# Arguments:
+#	port	Port of server
+#	start	Initial local file, empty for none
+#	args	Additional options of the contract
+#
+# Results:
+#	Return the identifier of the contract.
+#
+# Side Effects:
+#	Replaces the local file, removes partial downloads.
+proc contract { port start args } {
+    global local dir
+
+    file delete -force -- $local $local.part $local.part.state
+    if { $start ne "" } {
+	file copy -force -- [file join $dir $start] $local
+    }
+    return [eval [list ::updater::new "" \
+		      -source http://127.0.0.1:$port/app.bin \
+		      -sums app.md5 -target $local -period ""] $args]
+}
+
+
+# verdict -- Report on a scenario
+#
+#	Check the conditions that should hold at the end of a
+#	scenario and print the result.
+#
+# Arguments:
+#	name	Name of scenario
+#	checks	Even list of descriptions and expressions that should be
+#		true, evaluated at the global level.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Counts failures.
+proc verdict { name checks } {
+    global failures
+
+    set failed [list]
+    foreach {descr cond} $checks {
+	if { ! [uplevel \#0 [list expr $cond]] } {
+	    lappend failed $descr
+	}
+    }
+    if { [llength $failed] } {
+	puts "FAIL $name: [join $failed {, }]"
+	puts "     requests: [::rangeserver::requests]"
+	incr failures
+    } else {
+	puts "ok   $name"
+    }
+}
+
+
+# fetched -- Analyse requests for the served file
+#
+#	Count the requests for the served file that the server has
+#	received.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return an even list with the number of HEAD requests (head),
+#	of range requests (ranges), of range requests answered with
+#	partial content (partial), of bytes answered to range
+#	requests (bytes), and of requests for the whole file (whole).
+#
+# Side Effects:
+#	None.
+proc fetched { } {
+    array set F { head 0 ranges 0 partial 0 bytes 0 whole 0 }
+    foreach r [::rangeserver::requests] {
+	foreach {method path range code} $r break
+	if { $path ne "/app.bin" } {
+	    continue
+	}
+	if { $method eq "HEAD" } {
+	    incr F(head)
+	} elseif { [llength $range] } {
+	    incr F(ranges)
+	    if { $code == 206 } {
+		incr F(partial)
+		incr F(bytes) [expr {[lindex $range 1] - [lindex $range 0] + 1}]
+	    }
+	} else {
+	    incr F(whole)
+	}
+    }
+    return [array get F]
+}
+
+
+# Delta update: only the blocks missing from the old version are
+# fetched, and the file is rebuilt from both.
+set port [::rangeserver::start 0 -root $www -ranges on]
+contract $port app.old -signature app.sig
+wait {[installed]}
+array set F [fetched]
+verdict "delta update" {
+    "new version installed"        {[installed]}
+    "only ranges fetched"          {$F(whole) == 0 && $F(ranges) > 0}
+    "all ranges partial"           {$F(partial) == $F(ranges)}
+    "less than a tenth fetched"    {$F(bytes) < [string length $new] / 10}
+}
+::rangeserver::stop
+
+# Chunked download: no local version, the file is fetched in chunks
+# of -chunksize bytes, all answered with 206.
+set port [::rangeserver::start 0 -root $www -ranges on]
+contract $port ""
+wait {[installed]}
+array set F [fetched]
+verdict "chunked download" {
+    "new version installed"        {[installed]}
+    "size probed"                  {$F(head) == 1}
+    "fetched in chunks"            {$F(whole) == 0 && $F(ranges) == ([string length $new] + 65535) / 65536}
+    "all chunks partial"           {$F(partial) == $F(ranges)}
+    "all bytes fetched once"       {$F(bytes) == [string length $new]}
+}
+::rangeserver::stop
+
+# Server advertising ranges but answering with the whole file: the
+# chunked download is abandoned for a single stream.
+set port [::rangeserver::start 0 -root $www -ranges ignore]
+contract $port app.old
+wait {[installed]}
+array set F [fetched]
+verdict "ranges ignored by server" {
+    "new version installed"        {[installed]}
+    "no partial content"           {$F(partial) == 0}
+    "fell back to one stream"      {$F(whole) == 1}
+    "no partial download left"     {![file exists $local.part.state]}
+}
+::rangeserver::stop
+
+# Server without range support: a single stream from the start.
+set port [::rangeserver::start 0 -root $www -ranges off]
+contract $port app.old
+wait {[installed]}
+array set F [fetched]
+verdict "no range support" {
+    "new version installed"        {[installed]}
+    "one stream"                   {$F(ranges) == 0 && $F(whole) == 1}
+}
+::rangeserver::stop
+
+# Delta update from a server without range support: the first range
+# requests fail and the file is fetched in a single stream instead.
+set port [::rangeserver::start 0 -root $www -ranges off]
+contract $port app.old -signature app.sig
+wait {[installed]}
+array set F [fetched]
+verdict "delta without range support" {
+    "new version installed"        {[installed]}
+    "no partial content"           {$F(partial) == 0}
+    "fell back to one stream"      {$F(whole) == 1}
+    "no partial download left"     {![file exists $local.part.state]}
+}
+::rangeserver::stop
+
+# Interrupted download: the connection of one of the chunks is dropped,
+# the download stops with its state recorded and is resumed at the
+# next check, fetching the missing chunks only.
+set port [::rangeserver::start 0 -root $www -ranges on -drop 5]
+set upd [contract $port app.old]
+wait {[file exists $local.part.state] && ![set ${upd}(downloading)]}
+array set F [fetched]
+set nchunks [expr {([string length $new] + 65535) / 65536}]
+set first $F(partial)
+set recorded -1
+if { [catch {open $local.part.state} fd] == 0 } {
+    # First line is a header, then one line per chunk.
+    set recorded [expr {[llength [split [string trim [read $fd]] "\n"]] - 1}]
+    close $fd
+}
+verdict "interrupted download" {
+    "old version kept"             {![installed]}
+    "partial download kept"        {[file exists $local.part]}
+    "chunks recorded"              {$recorded == $first && $first > 0}
+}
+::rangeserver::stop
+set port [::rangeserver::start $port -root $www -ranges on]
+::updater::check $upd
+wait {[installed]}
+array set F [fetched]
+verdict "resumed download" {
+    "new version installed"        {[installed]}
+    "missing chunks only"          {$F(ranges) == $nchunks - $first}
+    "state removed"                {![file exists $local.part.state]}
+}
+::rangeserver::stop
+
+file delete -force -- $dir
+if { $failures } {
+    puts "$failures scenario(s) failed"
+    exit 1
+}
+exit 0
@@ -5,9 +5,10 @@
 #	concept of contracts, which are tiny files that describe where
 #	new versions of the program/component can be found and where
 #	they should be installed.  Contracts can also be created from
-#	the command line.  The module will update as soon as the MD5
-#	announced on the remote location differs from the one that is
-#	currently installed and pointed at by a contract.  Contracts
+#	the command line.  The module will update as soon as the
+#	digest (MD5, SHA-1 or SHA-256) announced on the remote
+#	location differs from the one that is currently installed and
+#	pointed at by a contract.  Contracts
 #	are lively and can be checked on a regular basis.
 #
 # Copyright (c) 2004-2007 by the Swedish Institute of Computer Science.
@@ -25,6 +26,7 @@ package require autoconnect
 
 package require md5
 package require uri
+package require http
 
 namespace eval ::updater {
     variable UPD
@@ -32,15 +34,41 @@ namespace eval ::updater {
 	array set UPD {
 	    idgene            0
 	    comments          "\#!;"
-	    blocksize         65536
+	    blocksize         1048576
+	    -native           on
+	    -sumcache         "~/.updater/digests"
+	    -reverify         86400
+	    -deltascan        8388608
+	    -slice            50
+	    -timeout          30000
+	    -chunks           4
+	    -chunksize        1048576
+	    cacheloaded       0
 	    -source           ""
 	    -sums             ""
+	    -signature        ""
 	    -target           ""
 	    -destroy          ""
 	    -period           600
 	    -install_attempts 5
 	    -install_wait     500
 	}
+	# Digest algorithms: package, init, update and final commands
+	# for the Tcl implementation, length of hex digest and name of
+	# coreutils command.
+	variable DIGESTS
+	array set DIGESTS {
+	    md5    {md5 ::md5::MD5Init ::md5::MD5Update ::md5::MD5Final
+	            32 md5sum}
+	    sha1   {sha1 ::sha1::SHA1Init ::sha1::SHA1Update ::sha1::SHA1Final
+	            40 sha1sum}
+	    sha256 {sha256 ::sha2::SHA256Init ::sha2::SHA256Update
+	            ::sha2::SHA256Final 64 sha256sum}
+	}
+	variable NATIVE;  # Algorithm -> native command, empty if none
+	array set NATIVE {}
+	variable SUMCACHE; # {path algo} -> {{size mtime inode} digest verified}
+	array set SUMCACHE {}
 	variable libdir [file dirname [file normalize [info script]]]
 	::uobj::install_log updater UPD; # Creates log namespace variable
 	::uobj::install_defaults updater UPD; # Creates defaults procedure
@@ -60,17 +88,28 @@ namespace eval ::updater {
 # the file should be placed.
 #
 # -sums is a (relative or absolute) URL that points to the location of
-# a file that contains MD5 sums for (among others) the source.  When
+# a file that contains digests for (among others) the source.  When
 # the URL is relative, it will be resolved to the URL of the source,
 # which allows to keep the source and the sums in the same directory
 # on a server.  The file can contain any number of lines (commented
 # and empty lines being ignored) and is understood as follows: the
-# first item in lines is the MD5 sum, the second a file name.  This
-# file name will be matched against the one pointed at by the source.
+# first item in lines is the digest, the second a file name.  The
+# algorithm (MD5, SHA-1 or SHA-256) is deduced from the length of the
+# digest.  Lines can also declare their algorithm explicitely using
+# the tagged format, e.g. SHA256 (fname) = digest, as output by
+# sha256sum --tag.  This file name will be matched against the one
+# pointed at by the source.
 # This (somewhat) complicated scheme allows to keep a number of
 # sources and index these by a single MD5 sum description file if
 # necessary.
 #
+# -signature is a (relative or absolute) URL that points to the block
+# signature of the source, as created by ::updater::signature.  When
+# the URL is relative, it will be resolved to the URL of the source.
+# When a signature is provided, only the blocks of the source that
+# are not already present in the installed version are downloaded.
+# The server must support range requests.
+#
 # -target is the full path to where the remote file should be placed
 # when the remote differs from the installed version.  The target
 # recognises idioms such as %progdir% and %user%, the complete list
@@ -104,38 +143,105 @@ namespace eval ::updater {
 # installation attempts.
 
 
-# ::updater::__digest -- Compute MD5 digest of a file
+# ::updater::__native -- Find native digest command
+#
+#	Find an external command able to compute digests using a given
+#	algorithm.  openssl is preferred since it uses the hardware
+#	extensions of the processor when they are available, the
+#	coreutils commands are used otherwise.  Results are cached.
+#
+# Arguments:
+#	algo	Digest algorithm, one of md5, sha1 or sha256
+#
+# Results:
+#	Return a list suitable for exec, empty if there is no native
+#	command for the algorithm.
+#
+# Side Effects:
+#	None.
+proc ::updater::__native { algo } {
+    variable DIGESTS
+    variable NATIVE
+    variable log
+
+    if { ![info exists NATIVE($algo)] } {
+	set NATIVE($algo) ""
+	set openssl [auto_execok openssl]
+	if { $openssl ne "" } {
+	    set NATIVE($algo) [concat $openssl [list dgst -$algo -r]]
+	} else {
+	    set NATIVE($algo) [auto_execok [lindex $DIGESTS($algo) 5]]
+	}
+	${log}::debug "Native $algo digests via '$NATIVE($algo)'"
+    }
+    return $NATIVE($algo)
+}
+
+
+# ::updater::__digest -- Compute digest of a file
 #
-#	This procedure computes the MD5 digest of a file, acting like
-#	::md5::md5 -hex -file.  The reason for this procedure to exist
-#	is that computing the digest of a binary from that same binary
-#	will have the disastrous effect to block for ever.  This
-#	routine safely returns a digest in all situations (even though
-#	it will be *erroneous* in the case described above).
+#	This procedure computes the digest of a file, acting like
+#	::md5::md5 -hex -file.  Files that are on the native
+#	filesystem are handed to a native command whenever possible,
+#	see __native.  Otherwise, the file is read in large blocks
+#	that are fed to the Tcl implementation of the algorithm
+#	(which will use its accelerators when they are installed).
+#	The reason for this procedure to exist is that computing the
+#	digest of a binary from that same binary will have the
+#	disastrous effect to block for ever.  This routine safely
+#	returns a digest in all situations (even though it will be
+#	*erroneous* in the case described above).
 #
 # Arguments:
 #	fname	Path to file
+#	algo	Digest algorithm, one of md5, sha1 or sha256
 #
 # Results:
-#	The MD5 digest of the file in hexadecimal, or an empty string
-#	on errors.
+#	The digest of the file in hexadecimal, or an empty string on
+#	errors.
 #
 # Side Effects:
 #	None.
-proc ::updater::__digest { fname } {
+proc ::updater::__digest { fname { algo md5 } } {
     variable UPD
+    variable DIGESTS
     variable log
 
+    if { ![info exists DIGESTS($algo)] } {
+	${log}::warn "$algo is not a known digest algorithm"
+	return ""
+    }
+    foreach {pkg init update final len tool} $DIGESTS($algo) break
+
+    ${log}::info "Computing $algo digest for file $fname"
+    if { [string is true $UPD(-native)] \
+	     && [lindex [file system $fname] 0] eq "native" } {
+	set cmd [__native $algo]
+	if { $cmd ne "" } {
+	    if { [catch {eval exec $cmd \
+			     [list [file nativename $fname]]} res] == 0 \
+		     && [regexp {^([0-9a-fA-F]+)} $res -> md] \
+		     && [string length $md] == $len } {
+		return [string tolower $md]
+	    }
+	    ${log}::notice "Native $algo digest failed, reverting to Tcl: $res"
+	}
+    }
+
+    if { [catch {package require $pkg} err] } {
+	${log}::warn "Cannot compute $algo digests: $err"
+	return ""
+    }
+
     set md ""
-    ${log}::info "Computing digest for file $fname"
     if { [catch {open $fname} fd] == 0 } {
-	set mdid [::md5::MD5Init]
+	set mdid [$init]
 	fconfigure $fd -translation binary -encoding binary
 	while { ! [eof $fd] } {
 	    set dta [read $fd $UPD(blocksize)]
-	    ::md5::MD5Update $mdid $dta
+	    $update $mdid $dta
 	}
-	set md [::md5::Hex [::md5::MD5Final $mdid]]
+	binary scan [$final $mdid] H* md
 	close $fd
     } else {
 	${log}::warn "Could not open file at $fname: $fd"
@@ -144,6 +250,191 @@ proc ::updater::__digest { fname } {
     return $md
 }
 
+
+# ::updater::__sumline -- Parse a line of a digests file
+#
+#	Parse a (non-commented) line of a digests file.  Lines either
+#	are in the tagged format, i.e. ALGO (fname) = digest, or start
+#	with the digest followed by the file name, in which case the
+#	algorithm is deduced from the length of the digest.
+#
+# Arguments:
+#	line	Line to parse
+#
+# Results:
+#	Return a list composed of the algorithm, the digest and the
+#	file name, an empty list if the line cannot be understood.
+#
+# Side Effects:
+#	None.
+proc ::updater::__sumline { line } {
+    variable DIGESTS
+    variable log
+
+    if { [regexp {^([A-Za-z0-9-]+)\s*\((.*)\)\s*=\s*([0-9a-fA-F]+)$} \
+	      $line -> algo fname sum] } {
+	set algo [string map [list "-" ""] [string tolower $algo]]
+	if { ![info exists DIGESTS($algo)] } {
+	    ${log}::warn "$algo is not a known digest algorithm"
+	    return [list]
+	}
+    } else {
+	set sum [lindex $line 0]
+	# Leading star marks binary mode in coreutils output.
+	set fname [string trimleft [lrange $line 1 end] "*"]
+	set algo ""
+	foreach a [array names DIGESTS] {
+	    if { [string length $sum] == [lindex $DIGESTS($a) 4] } {
+		set algo $a
+	    }
+	}
+	if { $algo eq "" } {
+	    ${log}::warn "Cannot guess digest algorithm of '$sum'"
+	    return [list]
+	}
+    }
+
+    return [list $algo $sum $fname]
+}
+
+# ::updater::__loadsums -- Load digest cache
+#
+#	Load the persistent digest cache from the file pointed at by
+#	the -sumcache option, once and only once.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__loadsums { } {
+    variable UPD
+    variable SUMCACHE
+    variable log
+
+    if { $UPD(cacheloaded) || $UPD(-sumcache) eq "" } {
+	return
+    }
+    set UPD(cacheloaded) 1
+
+    set fname [::diskutil::fname_resolv $UPD(-sumcache)]
+    if { ![file exists $fname] } {
+	return
+    }
+    if { [catch {open $fname} fd] } {
+	${log}::warn "Could not read digest cache at $fname: $fd"
+	return
+    }
+    fconfigure $fd -encoding utf-8
+    if { [catch {array set SUMCACHE [read $fd]} err] } {
+	${log}::warn "Corrupted digest cache at $fname, ignoring: $err"
+	array unset SUMCACHE
+	array set SUMCACHE {}
+    }
+    close $fd
+    ${log}::debug "Loaded [array size SUMCACHE] digest(s) from $fname"
+}
+
+
+# ::updater::__savesums -- Save digest cache
+#
+#	Write the digest cache to the file pointed at by the -sumcache
+#	option, atomically replacing the existing file.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__savesums { } {
+    variable UPD
+    variable SUMCACHE
+    variable log
+
+    if { $UPD(-sumcache) eq "" } {
+	return
+    }
+
+    set fname [::diskutil::fname_resolv $UPD(-sumcache)]
+    set tmp $fname.[pid]
+    if { [catch {
+	file mkdir [file dirname $fname]
+	set fd [open $tmp w]
+	fconfigure $fd -encoding utf-8
+	foreach key [array names SUMCACHE] {
+	    puts $fd [list $key $SUMCACHE($key)]
+	}
+	close $fd
+	file rename -force -- $tmp $fname
+    } err] } {
+	${log}::warn "Could not write digest cache at $fname: $err"
+	catch {file delete -- $tmp}
+    }
+}
+
+
+# ::updater::__cachedigest -- Compute digest of a file, using the cache
+#
+#	Return the digest of a file, only recomputing it when the
+#	identity of the file (size, modification time and inode) has
+#	changed since it was last computed, or when the digest was
+#	verified more than -reverify seconds ago.  Digests are kept in
+#	a persistent cache, see -sumcache.
+#
+# Arguments:
+#	fname	Path to file
+#	algo	Digest algorithm, one of md5, sha1 or sha256
+#
+# Results:
+#	The digest of the file in hexadecimal, or an empty string
+#	on errors.
+#
+# Side Effects:
+#	Updates the digest cache.
+proc ::updater::__cachedigest { fname { algo md5 } } {
+    variable UPD
+    variable SUMCACHE
+    variable log
+
+    if { $UPD(-sumcache) eq "" || [catch {file stat $fname stat}] } {
+	return [__digest $fname $algo]
+    }
+    __loadsums
+
+    set now [clock seconds]
+    set id [list $stat(size) $stat(mtime) $stat(ino)]
+    set key [list [file normalize $fname] $algo]
+    if { [info exists SUMCACHE($key)] } {
+	foreach {cid md verified} $SUMCACHE($key) break
+	if { $cid ne $id } {
+	    ${log}::info "Digest cache miss for $fname: file has changed"
+	} elseif { $UPD(-reverify) ne "" && $UPD(-reverify) > 0 \
+		       && $now - $verified >= $UPD(-reverify) } {
+	    ${log}::info "Digest cache miss for $fname: forcing verification"
+	} else {
+	    ${log}::info "Digest cache hit for $fname: $algo $md"
+	    return $md
+	}
+    } else {
+	${log}::info "Digest cache miss for $fname: not in cache"
+    }
+
+    set md [__digest $fname $algo]
+    if { $md ne "" } {
+	set SUMCACHE($key) [list $id $md $now]
+	__savesums
+    }
+
+    return $md
+}
+
+
 # ::updater::__read -- Read updater contract
 #
 #	This procedure will read the content of a file and fill an
@@ -279,7 +570,8 @@ proc ::updater::__copydone { upd tgt in_fd out_fd bytes {err {}} } {
 # Arguments:
 #	upd	Identifier of updater, as returned by ::updater::new
 #	tgt	Path to file that contains the newer version
-#	sum	MD5 sum of the file that we should have loaded
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file that we should have loaded
 #	cxid	::massgeturl identifier
 #	url	URL that was downloaded (probably the source)
 #	status	Status of the download
@@ -292,7 +584,7 @@ proc ::updater::__copydone { upd tgt in_fd out_fd bytes {err {}} } {
 #	Will attempt to "kill" the locally running process according
 #	to the method described in the contract and to install the new
 #	version in place.
-proc ::updater::__downloaded { upd tgt sum cxid url status token } {
+proc ::updater::__downloaded { upd tgt algo sum cxid url status token } {
     variable UPD
     variable log
 
@@ -301,11 +593,12 @@ proc ::updater::__downloaded { upd tgt sum cxid url status token } {
     }
 
     upvar #0 $upd UPDATER
+    set UPDATER(downloading) 0
     if { $status eq "OK" } {
-	# Check MD5 sum of downloaded file against what the server
+	# Check digest of downloaded file against what the server
 	# said that we should have, discard on failure.
-	set md5 [__digest $tgt]
-	if { [string equal -nocase $md5 $sum] } {
+	set md [__digest $tgt $algo]
+	if { [string equal -nocase $md $sum] } {
 	    ${log}::notice "Downloaded file from $url successful, trying to\
                             replace current file at $UPDATER(destination)"
 	    set method [string toupper [lindex $UPDATER(-destroy) 0]]
@@ -414,91 +707,1128 @@ proc ::updater::__downloaded { upd tgt sum cxid url status token } {
 }
 
 
-proc ::updater::__dn_progress { upd cxid furl url current total } {
+# ::updater::__hash -- Digest of a block of data
+#
+#	Compute the digest of some data using the Tcl implementation
+#	of an algorithm.
+#
+# Arguments:
+#	algo	Digest algorithm, one of md5, sha1 or sha256
+#	data	Binary data
+#
+# Results:
+#	The digest of the data in hexadecimal.
+#
+# Side Effects:
+#	None.
+proc ::updater::__hash { algo data } {
+    variable DIGESTS
+
+    foreach {pkg init update final} $DIGESTS($algo) break
+    package require $pkg
+    set mdid [$init]
+    $update $mdid $data
+    binary scan [$final $mdid] H* md
+
+    return $md
+}
+
+
+# ::updater::__hashes -- Digests of blocks of data
+#
+#	Compute the digests of a number of blocks of data.  Whenever
+#	possible, the blocks are written to temporary files that are
+#	all handed at once to the native command for the algorithm,
+#	see __native.  The Tcl implementation is used otherwise.
+#
+# Arguments:
+#	algo	Digest algorithm, one of md5, sha1 or sha256
+#	blocks	List of binary blocks
+#
+# Results:
+#	The list of the digests of the blocks in hexadecimal.
+#
+# Side Effects:
+#	None.
+proc ::updater::__hashes { algo blocks } {
+    variable UPD
+    variable DIGESTS
     variable log
 
-    ${log}::debug "$furl: Fetched $current bytes of $total"
+    set cmd ""
+    if { [string is true $UPD(-native)] && [llength $blocks] > 0 } {
+	set cmd [__native $algo]
+    }
+    if { $cmd ne "" } {
+	set len [lindex $DIGESTS($algo) 4]
+	set base [::diskutil::temporary_file updater blk]
+	set fnames [list]
+	foreach dta $blocks {
+	    set fname $base.[llength $fnames]
+	    if { [catch {open $fname w} fd] } {
+		break
+	    }
+	    fconfigure $fd -translation binary -encoding binary
+	    puts -nonewline $fd $dta
+	    close $fd
+	    lappend fnames $fname
+	}
+	set sums [list]
+	if { [llength $fnames] == [llength $blocks] } {
+	    set natives [list]
+	    foreach fname $fnames {
+		lappend natives [file nativename $fname]
+	    }
+	    if { [catch {eval exec $cmd $natives} res] == 0 } {
+		foreach line [split $res "\n"] {
+		    if { [regexp {^\\?([0-9a-fA-F]+)} $line -> md] \
+			     && [string length $md] == $len } {
+			lappend sums [string tolower $md]
+		    }
+		}
+	    }
+	}
+	foreach fname $fnames {
+	    catch {file delete -- $fname}
+	}
+	if { [llength $sums] == [llength $blocks] } {
+	    return $sums
+	}
+	${log}::notice "Native $algo digests of blocks failed, reverting to Tcl"
+    }
+
+    set sums [list]
+    foreach dta $blocks {
+	lappend sums [__hash $algo $dta]
+    }
+    return $sums
 }
 
-# ::updater::__checksums -- Compute check sums and trigger download
+
+# ::updater::__weak -- Weak checksum of a block
 #
-#	This procedure is called when the remote check sums file has
-#	been downloaded.  It looks for the check sum of the source and
-#	verifies it against the one of the file on disk.  On
-#	difference, it triggers the download of the new file, which
-#	will then proceed with the update.
+#	Compute the two 16 bits sums that compose the rsync weak
+#	checksum of a block.  The sums can be rolled, one byte at a
+#	time, see __match.
 #
 # Arguments:
-#	upd	Identifier of updater, as returned by ::updater::new
-#	cxid	::massgeturl identifier
-#	url	URL that was downloaded (probably the MD5 file)
-#	status	Status of the download
-#	token	Pointer to the content of the data
+#	bytes	List of (signed) bytes, as of binary scan c*
+#	first	Index of first byte of block in list
+#	last	Index of last byte of block in list
 #
 # Results:
+#	Return a list composed of both sums.
+#
+# Side Effects:
 #	None.
+proc ::updater::__weak { bytes first last } {
+    set a 0
+    set b 0
+    set l [expr {$last - $first + 1}]
+    foreach x [lrange $bytes $first $last] {
+	set x [expr {$x & 0xff}]
+	incr a $x
+	incr b [expr {$l * $x}]
+	incr l -1
+    }
+    return [list [expr {$a & 0xffff}] [expr {$b & 0xffff}]]
+}
+
+
+# ::updater::signature -- Create block signature of a file
+#
+#	Create the block signature of a file, to be placed along the
+#	file on the server so that clients can perform delta updates,
+#	see -signature.  The signature contains the size of the file,
+#	the size of the blocks and the digest algorithm, followed by
+#	the weak checksum and digest of each block of the file.
+#	Blocks are digested in batches of about blocksize bytes, see
+#	__hashes.  This is meant for the publishing side and blocks
+#	the caller until the whole file has been read.
+#
+# Arguments:
+#	fname	Path to file
+#	sigfile	Path to signature file, defaults to fname with .sig appended
+#	bsize	Size of blocks
+#	algo	Digest algorithm, one of md5, sha1 or sha256
+#
+# Results:
+#	Return the path to the signature file, an empty string on
+#	errors.
 #
 # Side Effects:
 #	None.
-proc ::updater::__checksums { upd cxid url status token } {
+proc ::updater::signature { fname { sigfile "" } { bsize 65536 } { algo md5 } } {
     variable UPD
+    variable DIGESTS
     variable log
 
-    if { $status eq "OK" } {
-	if { [info vars $upd] eq "" } {
-	    return -code error "$upd is not a known updater context"
+    if { ![info exists DIGESTS($algo)] } {
+	${log}::warn "$algo is not a known digest algorithm"
+	return ""
+    }
+    if { $sigfile eq "" } {
+	set sigfile "${fname}.sig"
+    }
+    if { [catch {open $fname} in] } {
+	${log}::warn "Could not open file at $fname: $in"
+	return ""
+    }
+    if { [catch {open $sigfile w} out] } {
+	${log}::warn "Could not create signature at $sigfile: $out"
+	close $in
+	return ""
+    }
+
+    ${log}::notice "Computing signature of $fname into $sigfile"
+    fconfigure $in -translation binary -encoding binary
+    puts $out "size [file size $fname]"
+    puts $out "blocksize $bsize"
+    puts $out "algo $algo"
+    set batch [expr {$UPD(blocksize) / $bsize}]
+    if { $batch < 1 } {
+	set batch 1
+    }
+    set eof 0
+    while { ! $eof } {
+	set dtas [list]
+	set weaks [list]
+	while { [llength $dtas] < $batch } {
+	    set dta [read $in $bsize]
+	    if { $dta eq "" } {
+		set eof 1
+		break
+	    }
+	    binary scan $dta c* bytes
+	    foreach {a b} [__weak $bytes 0 [expr {[llength $bytes] - 1}]] break
+	    lappend dtas $dta
+	    lappend weaks [expr {($b << 16) | $a}]
+	}
+	foreach w $weaks strong [__hashes $algo $dtas] {
+	    puts $out "$w $strong"
 	}
+    }
+    close $in
+    close $out
 
-	upvar #0 $upd UPDATER
+    return $sigfile
+}
 
-	# Decide of the name of the file on the remote server
-	array set src [::uri::split $UPDATER(-source)]
-	set src_fname [file tail $src(path)]
 
-	# Decide of the destination on the local disk.  If that is a
-	# directory, append it the same name as the file on the remote
-	# server (the most usual case).
-	set dst [::diskutil::fname_resolv $UPDATER(-target)]
-	if { [file isdirectory $dst] } {
-	    set dst [file join $dst $src_fname]
+# ::updater::__sigparse -- Parse a block signature
+#
+#	Parse the content of a block signature, see signature.
+#
+# Arguments:
+#	dta	Content of the signature
+#
+# Results:
+#	Return a list composed of the size of the file, the size of
+#	the blocks, the digest algorithm and a list of weak checksums
+#	and digests, one pair per block.  Return an empty list on
+#	errors.
+#
+# Side Effects:
+#	None.
+proc ::updater::__sigparse { dta } {
+    variable UPD
+    variable DIGESTS
+    variable log
+
+    array set SIG {size "" blocksize "" algo md5}
+    set blocks [list]
+    foreach line [split $dta "\n"] {
+	set line [string trim $line]
+	if { $line eq "" \
+		 || [string first [string index $line 0] $UPD(comments)] >= 0 } {
+	    continue
 	}
-	set UPDATER(destination) $dst
+	foreach {k v} $line break
+	if { [string is integer -strict $k] } {
+	    lappend blocks $k $v
+	} else {
+	    set SIG($k) $v
+	}
+    }
 
-	# Now parse the result, i.e. the content of the MD5 sum file
-	# coming from the server.
-	upvar #0 $token result
-	foreach line [split $result(body) "\n"] {
-	    if { $line ne "" } {
-		set firstchar [string index $line 0]
-		# Skip all lines that are commented.
-		if { [string first $firstchar $UPD(comments)] < 0 } {
-		    set sum [lindex $line 0]
-		    set fname [lrange $line 1 end]
-		    # We have found a file name that matches the one
-		    # from the contract.  Compute MD5 of file on local
-		    # disk and trigger downloading of remote source if
-		    # they are different.
-		    if { $fname eq $src_fname } {
-			${log}::debug "Computing MD5 for local file $dst"
-			set md5 [__digest $dst]
-			if { ! [string equal -nocase $md5 $sum] } {
-			    set tgt [::diskutil::temporary_file updater \
-					 [file extension $UPDATER(destination)]]
-			    ${log}::notice "New version available for\
-                                            $UPDATER(destination), downloading\
-                                            into $tgt and replacing"
-			    ::massgeturl::infile $UPDATER(-source) $tgt \
-				[list ::updater::__downloaded $upd $tgt $sum] \
-				-progress [list ::updater::__dn_progress $upd]
+    if { ![string is integer -strict $SIG(size)] \
+	     || ![string is integer -strict $SIG(blocksize)] \
+	     || $SIG(blocksize) <= 0 \
+	     || ![info exists DIGESTS($SIG(algo))] \
+	     || [llength $blocks] / 2 \
+	         != ($SIG(size) + $SIG(blocksize) - 1) / $SIG(blocksize) } {
+	${log}::warn "Invalid block signature"
+	return [list]
+    }
+
+    return [list $SIG(size) $SIG(blocksize) $SIG(algo) $blocks]
+}
+
+
+# ::updater::__match -- Find blocks of a signature in a local file
+#
+#	Start finding which blocks of a remote file, described by its
+#	signature, are already present in a local file and where.
+#	Blocks are looked for at all offsets of the local file using
+#	the rolling weak checksum, confirmed by their digest.  Since
+#	rolling is expensive, no more than -deltascan bytes are
+#	rolled over, after which blocks are only looked for next to
+#	each other.  The file is scanned in slices of at most -slice
+#	milliseconds from the event loop, see __matchstep, and the
+#	command is called with the blocks found once done.
+#
+# Arguments:
+#	fname	Path to local file
+#	bsize	Size of blocks
+#	algo	Digest algorithm
+#	blocks	Weak checksums and digests of the blocks
+#	cmd	Command to call with an even list of block indices and
+#		offsets in the local file.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__match { fname bsize algo blocks cmd } {
+    variable UPD
+    variable log
+
+    if { [catch {open $fname} fd] } {
+	${log}::warn "Could not open file at $fname: $fd"
+	after idle [linsert $cmd end [list]]
+	return
+    }
+    fconfigure $fd -translation binary -encoding binary
+
+    set id [incr UPD(idgene)]
+    upvar \#0 [namespace current]::match_$id MATCH
+    set i 0
+    foreach {w strong} $blocks {
+	lappend MATCH(weak,$w) $i
+	set MATCH(strong,$i) $strong
+	incr i
+    }
+    set chunk [expr {$UPD(blocksize) > $bsize ? $UPD(blocksize) : $bsize}]
+    array set MATCH [list \
+			 fd     $fd \
+			 cmd    $cmd \
+			 bsize  $bsize \
+			 algo   $algo \
+			 chunk  $chunk \
+			 size   [file size $fname] \
+			 budget $UPD(-deltascan) \
+			 buf    "" \
+			 bytes  [list] \
+			 bufofs 0 \
+			 valid  0 \
+			 a      0 \
+			 b      0 \
+			 pos    0]
+    after idle [list [namespace current]::__matchstep $id]
+}
+
+
+# ::updater::__matchstep -- Scan a slice of a local file
+#
+#	Look for the blocks of a signature in a local file for at most
+#	-slice milliseconds, see __match, then come back from the
+#	event loop.  Once the whole file has been scanned, the command
+#	of the scan is called with the blocks found.
+#
+# Arguments:
+#	id	Identifier of the scan
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__matchstep { id } {
+    variable UPD
+    variable log
+
+    upvar \#0 [namespace current]::match_$id MATCH
+    foreach k {bsize size budget buf bytes bufofs valid a b pos} {
+	set $k $MATCH($k)
+    }
+
+    set end [expr {[clock clicks -milliseconds] + $UPD(-slice)}]
+    if { [catch {
+	while { $pos + $bsize <= $size } {
+	    if { [clock clicks -milliseconds] >= $end } {
+		break
+	    }
+	    # Make sure the block and the byte after are in the buffer.
+	    if { $pos < $bufofs \
+		     || $pos + $bsize + 1 > $bufofs + [string length $buf] } {
+		seek $MATCH(fd) $pos start
+		set buf [read $MATCH(fd) [expr {$MATCH(chunk) + $bsize}]]
+		binary scan $buf c* bytes
+		set bufofs $pos
+	    }
+	    set o [expr {$pos - $bufofs}]
+	    if { ! $valid } {
+		foreach {a b} [__weak $bytes $o [expr {$o + $bsize - 1}]] break
+		set valid 1
+	    }
+
+	    set w [expr {($b << 16) | $a}]
+	    set found 0
+	    if { [info exists MATCH(weak,$w)] } {
+		set strong [lindex [__hashes $MATCH(algo) \
+					[list [string range $buf $o \
+						   [expr {$o + $bsize - 1}]]]] 0]
+		foreach i $MATCH(weak,$w) {
+		    if { ![info exists MATCH(have,$i)] \
+			     && $MATCH(strong,$i) eq $strong } {
+			set MATCH(have,$i) $pos
+			set found 1
+		    }
+		}
+	    }
+
+	    if { $found } {
+		incr pos $bsize
+		set valid 0
+	    } elseif { $budget > 0 && $pos + $bsize < $size } {
+		set out [expr {[lindex $bytes $o] & 0xff}]
+		set in [expr {[lindex $bytes [expr {$o + $bsize}]] & 0xff}]
+		set a [expr {($a - $out + $in) & 0xffff}]
+		set b [expr {($b - $bsize * $out + $a) & 0xffff}]
+		incr pos
+		incr budget -1
+	    } else {
+		incr pos $bsize
+		set valid 0
+	    }
+	}
+    } err] } {
+	${log}::warn "Could not scan local file for blocks: $err"
+	set pos $size
+    }
+
+    if { $pos + $bsize <= $size } {
+	foreach k {budget buf bytes bufofs valid a b pos} {
+	    set MATCH($k) [set $k]
+	}
+	after idle [list after 0 [list [namespace current]::__matchstep $id]]
+	return
+    }
+
+    close $MATCH(fd)
+    set have [list]
+    foreach k [array names MATCH have,*] {
+	lappend have [string range $k 5 end] $MATCH($k)
+    }
+    set cmd $MATCH(cmd)
+    unset MATCH
+    eval $cmd [list $have]
+}
+
+
+# ::updater::__geturl -- Issue a range or validation request
+#
+#	Issue a HTTP request that the massgeturl interface used by this
+#	module (get and infile) cannot express, i.e. range requests and
+#	validation (HEAD) requests.  All such requests go through this
+#	procedure, so that they can be handed to massgeturl at a single
+#	place.  Requests are binary and time out after -timeout
+#	milliseconds, so that a stalled server cannot hold a download
+#	for ever.
+#
+# Arguments:
+#	url	URL to request
+#	cmd	Command to call with the HTTP token on completion
+#	args	Additional options to ::http::geturl
+#
+# Results:
+#	Return the HTTP token, raise an error when the request could
+#	not be issued.
+#
+# Side Effects:
+#	None.
+proc ::updater::__geturl { url cmd args } {
+    variable UPD
+
+    return [eval [list ::http::geturl $url -binary 1 -timeout $UPD(-timeout) \
+		      -command $cmd] $args]
+}
+
+
+# ::updater::__range -- Fetch a range of bytes
+#
+#	Fetch a range of bytes from a remote URL using an HTTP range
+#	request.  The command is called with the data fetched and an
+#	error message, empty on success.
+#
+# Arguments:
+#	url	URL to fetch from
+#	from	Offset of first byte
+#	to	Offset of last byte
+#	cmd	Command to call on completion
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__range { url from to cmd } {
+    if { [catch {__geturl $url [list ::updater::__ranged $from $to $cmd] \
+		     -headers [list Range "bytes=${from}-${to}"]} err] } {
+	eval $cmd [list "" $err]
+    }
+}
+
+
+# ::updater::__ranged -- Range request completion
+#
+#	Called when a range request initiated by __range has
+#	completed, checks that the server answered with the range
+#	that was requested and forwards the data to the command.
+#
+# Arguments:
+#	from	Offset of first byte
+#	to	Offset of last byte
+#	cmd	Command to call
+#	token	HTTP token
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__ranged { from to cmd token } {
+    set dta ""
+    set err ""
+    if { [::http::status $token] ne "ok" } {
+	set err "[::http::status $token] [::http::error $token]"
+    } elseif { [::http::ncode $token] != 206 } {
+	set err "no partial content: [::http::code $token]"
+    } else {
+	set dta [::http::data $token]
+	if { [string length $dta] != $to - $from + 1 } {
+	    set err "got [string length $dta] bytes,\
+                     expected [expr {$to - $from + 1}]"
+	    set dta ""
+	}
+    }
+    ::http::cleanup $token
+    eval $cmd [list $dta $err]
+}
+
+
+# ::updater::__fetch -- Download the source of a contract
+#
+#	Download the whole source of an updater contract into a
+#	temporary file, in one stream.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__fetch { upd algo sum } {
+    variable log
+
+    upvar #0 $upd UPDATER
+
+    set tgt [::diskutil::temporary_file updater \
+		 [file extension $UPDATER(destination)]]
+    ${log}::info "Downloading $UPDATER(-source) into $tgt"
+    if { [catch {::massgeturl::infile $UPDATER(-source) $tgt \
+		     [list ::updater::__downloaded $upd $tgt $algo $sum] \
+		     -progress [list ::updater::__dn_progress $upd]} err] } {
+	${log}::warn "Could not download $UPDATER(-source): $err"
+	set UPDATER(downloading) 0
+    }
+}
+
+
+# ::updater::__partial -- Path to partial download
+#
+#	Return the path to the file where chunked downloads of the
+#	source of a contract are performed.  The path is constant so
+#	that interrupted downloads can be resumed.  Progress is kept
+#	in a state file with the same name and the .state extension.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#
+# Results:
+#	Return the path to the file.
+#
+# Side Effects:
+#	None.
+proc ::updater::__partial { upd } {
+    upvar #0 $upd UPDATER
+    return "$UPDATER(destination).part"
+}
+
+
+# ::updater::__probe -- Start a chunked download
+#
+#	Find out the size of the source of a contract and whether the
+#	server supports range requests.  Large sources are downloaded
+#	in chunks, see __chunked, others in one stream.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__probe { upd algo sum } {
+    upvar #0 $upd UPDATER
+
+    if { [catch {__geturl $UPDATER(-source) \
+		     [list ::updater::__probed $upd $algo $sum] -validate 1}] } {
+	__fetch $upd $algo $sum
+    }
+}
+
+
+# ::updater::__probed -- Decide upon chunked download
+#
+#	Called when the headers of the source of a contract have been
+#	fetched, decides whether to download the source in chunks.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#	token	HTTP token
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__probed { upd algo sum token } {
+    variable UPD
+    variable log
+
+    set size -1
+    set ranges 0
+    if { [::http::status $token] eq "ok" && [::http::ncode $token] == 200 } {
+	foreach {k v} [::http::meta $token] {
+	    switch -- [string tolower $k] {
+		content-length { set size [string trim $v] }
+		accept-ranges { set ranges [string equal [string trim $v] bytes] }
+	    }
+	}
+    }
+    ::http::cleanup $token
+
+    if { !$ranges || ![string is integer -strict $size] \
+	     || $size < 2 * $UPD(-chunksize) } {
+	${log}::debug "Downloading source of $upd in one stream"
+	__fetch $upd $algo $sum
+	return
+    }
+
+    set chunks [list]
+    for { set from 0 } { $from < $size } { incr from $UPD(-chunksize) } {
+	set to [expr {$from + $UPD(-chunksize) - 1}]
+	if { $to >= $size } {
+	    set to [expr {$size - 1}]
+	}
+	lappend chunks [list $from $to]
+    }
+    __chunked $upd $algo $sum $size $chunks
+}
+
+
+# ::updater::__chunked -- Download ranges of the source in parallel
+#
+#	Download ranges of the source of a contract into the partial
+#	download file, performing up to -chunks range requests at
+#	once.  The file is preallocated to its final size.  Ranges
+#	that have been stored are recorded in the state file, so that
+#	downloads that were interrupted are resumed at the next check
+#	(provided the digest of the source has not changed since).
+#	When the block signature is known, the digest of each block
+#	of a range is verified before it is stored.  Blocks that
+#	already are available locally can be copied into the file
+#	before downloading starts.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#	size	Size of the source
+#	chunks	List of byte ranges to download (first and last byte)
+#	local	Even list of block indices and offsets in the destination
+#	sig	Block size, digest algorithm and list of weak checksums
+#		and digests (from the signature), empty if unknown
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Creates the partial download file and its state file.
+proc ::updater::__chunked { upd algo sum size chunks { local {} } { sig {} } } {
+    variable UPD
+    variable log
+
+    upvar #0 $upd UPDATER
+    set tgt [__partial $upd]
+    set state "${tgt}.state"
+
+    # Read what was downloaded during previous attempts, provided
+    # these were for the same version of the source.
+    array set done {}
+    if { [file exists $tgt] && [catch {open $state} fd] == 0 } {
+	set lines [split [read $fd] "\n"]
+	close $fd
+	if { [lindex $lines 0] eq [list $algo $sum $size] } {
+	    foreach r [lrange $lines 1 end] {
+		if { [llength $r] == 2 } {
+		    set done($r) 1
+		}
+	    }
+	}
+    }
+
+    if { [array size done] > 0 } {
+	set mode {RDWR CREAT}
+    } else {
+	set mode {RDWR CREAT TRUNC}
+    }
+    if { [catch {open $tgt $mode} out] \
+	     || [catch {open $state [expr {[array size done] ? "a" : "w"}]} sfd] } {
+	${log}::warn "Could not open $tgt for chunked download"
+	catch {close $out}
+	__fetch $upd $algo $sum
+	return
+    }
+    fconfigure $out -translation binary -encoding binary
+    if { [array size done] == 0 } {
+	puts $sfd [list $algo $sum $size]
+	flush $sfd
+	# Preallocate the file to its final size.
+	if { $size > 0 } {
+	    seek $out [expr {$size - 1}] start
+	    puts -nonewline $out "\0"
+	}
+    }
+
+    # Copy the blocks that we already have, at their final position.
+    if { [llength $local] > 0 } {
+	set bsize [lindex $sig 0]
+	if { [catch {open $UPDATER(destination)} in] == 0 } {
+	    fconfigure $in -translation binary -encoding binary
+	    foreach {i ofs} $local {
+		seek $in $ofs start
+		seek $out [expr {$i * $bsize}] start
+		puts -nonewline $out [read $in $bsize]
+	    }
+	    close $in
+	}
+    }
+
+    upvar #0 ${upd}_dl DL
+    array set DL [list \
+		      fd      $out \
+		      state   $sfd \
+		      tgt     $tgt \
+		      algo    $algo \
+		      sum     $sum \
+		      sig     $sig \
+		      queue   [list] \
+		      running 0 \
+		      failed  "" \
+		      current 0 \
+		      total   0]
+    foreach r $chunks {
+	set len [expr {[lindex $r 1] - [lindex $r 0] + 1}]
+	incr DL(total) $len
+	if { [info exists done($r)] } {
+	    incr DL(current) $len
+	} else {
+	    lappend DL(queue) $r
+	}
+    }
+    ${log}::notice "Downloading [llength $DL(queue)] chunk(s) of\
+                    $UPDATER(-source) into $tgt,\
+                    [expr {[llength $chunks] - [llength $DL(queue)]}]\
+                    already done"
+    __chunknext $upd
+}
+
+
+# ::updater::__chunknext -- Start next range requests
+#
+#	Start range requests for the next chunks of a download, until
+#	-chunks requests are pending.  Finishes the download once all
+#	requests have ended.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__chunknext { upd } {
+    variable UPD
+    variable log
+
+    upvar #0 $upd UPDATER
+    upvar #0 ${upd}_dl DL
+
+    while { $DL(failed) eq "" && $DL(running) < $UPD(-chunks) \
+		&& [llength $DL(queue)] > 0 } {
+	foreach {from to} [lindex $DL(queue) 0] break
+	set DL(queue) [lrange $DL(queue) 1 end]
+	incr DL(running)
+	__range $UPDATER(-source) $from $to \
+	    [list ::updater::__chunkdone $upd $from $to]
+    }
+    if { $DL(running) > 0 } {
+	return
+    }
+
+    close $DL(fd)
+    close $DL(state)
+    set tgt $DL(tgt)
+    set algo $DL(algo)
+    set sum $DL(sum)
+    set failed $DL(failed)
+    unset DL
+    switch -- $failed {
+	"" {
+	    file delete -- "${tgt}.state"
+	    __downloaded $upd $tgt $algo $sum "" $UPDATER(-source) OK ""
+	}
+	"noranges" {
+	    file delete -- $tgt "${tgt}.state"
+	    __fetch $upd $algo $sum
+	}
+	default {
+	    ${log}::warn "Download of $UPDATER(-source) interrupted, will\
+                          resume at next check"
+	    set UPDATER(downloading) 0
+	}
+    }
+}
+
+
+# ::updater::__chunkdone -- Store a chunk
+#
+#	Verify and store a chunk that was fetched by a range request
+#	into the partial download file, and record it in the state
+#	file.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	from	Offset of first byte of chunk
+#	to	Offset of last byte of chunk
+#	dta	Content of chunk
+#	err	Error message, empty on success
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__chunkdone { upd from to dta err } {
+    variable log
+
+    upvar #0 $upd UPDATER
+    upvar #0 ${upd}_dl DL
+
+    incr DL(running) -1
+
+    # Verify the digest of all blocks within the chunk against the
+    # signature.
+    if { $err eq "" && [llength $DL(sig)] > 0 } {
+	foreach {bsize balgo blocks} $DL(sig) break
+	set blks [list]
+	for { set ofs $from } { $ofs <= $to } { incr ofs $bsize } {
+	    lappend blks [string range $dta [expr {$ofs - $from}] \
+			      [expr {$ofs - $from + $bsize - 1}]]
+	}
+	set i [expr {$from / $bsize}]
+	foreach strong [__hashes $balgo $blks] {
+	    if { $strong ne [lindex $blocks [expr {2*$i+1}]] } {
+		set err "digest mismatch for block $i"
+		break
+	    }
+	    incr i
+	}
+    }
+
+    if { $err ne "" } {
+	${log}::warn "Could not fetch bytes $from-$to of\
+                      $UPDATER(-source): $err"
+	if { [string match "no partial content*" $err] } {
+	    set DL(failed) "noranges"
+	} elseif { $DL(failed) eq "" } {
+	    set DL(failed) "error"
+	}
+    } else {
+	seek $DL(fd) $from start
+	puts -nonewline $DL(fd) $dta
+	flush $DL(fd)
+	puts $DL(state) [list $from $to]
+	flush $DL(state)
+	incr DL(current) [string length $dta]
+	__dn_progress $upd "" $UPDATER(-source) $UPDATER(-source) \
+	    $DL(current) $DL(total)
+    }
+    __chunknext $upd
+}
+
+
+# ::updater::__delta -- Start a delta update
+#
+#	Start a delta update by fetching the block signature of the
+#	source of an updater contract.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__delta { upd algo sum } {
+    upvar #0 $upd UPDATER
+
+    set sig [::uri::resolve $UPDATER(-source) $UPDATER(-signature)]
+    if { [catch {::massgeturl::get $sig \
+		     [list ::updater::__signature $upd $algo $sum] \
+		     -progress [list ::updater::__dn_progress $upd]}] } {
+	__probe $upd $algo $sum
+    }
+}
+
+
+# ::updater::__signature -- Reconstruct source from signature
+#
+#	Called when the block signature of the source of a contract
+#	has been fetched.  Starts looking for the blocks that are
+#	present in the local version of the file, to be reused, see
+#	__matched.  Reverts to downloading the whole source on
+#	errors.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#	cxid	::massgeturl identifier
+#	url	URL that was downloaded (the signature)
+#	status	Status of the download
+#	token	Pointer to the content of the data
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__signature { upd algo sum cxid url status token } {
+    variable UPD
+    variable log
+
+    if { [info vars $upd] eq "" } {
+	return -code error "$upd is not a known updater context"
+    }
+
+    upvar #0 $upd UPDATER
+    set sig [list]
+    if { $status eq "OK" } {
+	upvar #0 $token result
+	set sig [__sigparse $result(body)]
+    } else {
+	${log}::warn "Could not get the block signature at $url"
+    }
+    if { [llength $sig] == 0 } {
+	__probe $upd $algo $sum
+	return
+    }
+    foreach {size bsize balgo blocks} $sig break
+
+    # Find the blocks that we already have
+    set cmd [list ::updater::__matched $upd $algo $sum $sig]
+    if { [file exists $UPDATER(destination)] } {
+	__match $UPDATER(destination) $bsize $balgo $blocks $cmd
+    } else {
+	eval $cmd [list [list]]
+    }
+}
+
+
+# ::updater::__matched -- Fetch the blocks that are missing
+#
+#	Called once the blocks of the block signature that are
+#	present in the local version of the source of a contract have
+#	been found, see __match.  The missing blocks are fetched from
+#	the source using range requests, see __chunked.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	algo	Digest algorithm used by sum
+#	sum	Digest of the file to download
+#	sig	Parsed block signature, see __sigparse
+#	local	Even list of block indices and offsets in the destination
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__matched { upd algo sum sig local } {
+    variable UPD
+    variable log
+
+    if { [info vars $upd] eq "" } {
+	${log}::debug "$upd was removed while looking for its blocks"
+	return
+    }
+
+    upvar #0 $upd UPDATER
+    foreach {size bsize balgo blocks} $sig break
+    array set have $local
+
+    # Compute the byte ranges to fetch, coalescing consecutive
+    # missing blocks into ranges of about -chunksize bytes.
+    set ranges [list]
+    set nblocks [expr {[llength $blocks] / 2}]
+    set from -1
+    for { set i 0 } { $i <= $nblocks } { incr i } {
+	set start [expr {$i * $bsize}]
+	if { $from >= 0 \
+		 && ($i == $nblocks || [info exists have($i)] \
+			 || $start - $from >= $UPD(-chunksize)) } {
+	    set to [expr {$start > $size ? $size : $start}]
+	    lappend ranges [list $from [expr {$to - 1}]]
+	    set from -1
+	}
+	if { $i < $nblocks && $from < 0 && ![info exists have($i)] } {
+	    set from $start
+	}
+    }
+
+    set missing 0
+    foreach r $ranges {
+	incr missing [expr {[lindex $r 1] - [lindex $r 0] + 1}]
+    }
+    ${log}::notice "Delta update of $UPDATER(destination):\
+                    [array size have]/$nblocks block(s) present locally,\
+                    fetching $missing byte(s) in [llength $ranges] range(s)"
+
+    __chunked $upd $algo $sum $size $ranges [array get have] \
+	[list $bsize $balgo $blocks]
+}
+
+
+proc ::updater::__dn_progress { upd cxid furl url current total } {
+    variable log
+
+    ${log}::debug "$furl: Fetched $current bytes of $total"
+}
+
+# ::updater::__checksums -- Compute check sums and trigger download
+#
+#	This procedure is called when the remote check sums file has
+#	been downloaded.  It looks for the check sum of the source and
+#	verifies it against the one of the file on disk.  On
+#	difference, it triggers the download of the new file, which
+#	will then proceed with the update.
+#
+# Arguments:
+#	upd	Identifier of updater, as returned by ::updater::new
+#	cxid	::massgeturl identifier
+#	url	URL that was downloaded (probably the MD5 file)
+#	status	Status of the download
+#	token	Pointer to the content of the data
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::updater::__checksums { upd cxid url status token } {
+    variable UPD
+    variable log
+
+    if { $status eq "OK" } {
+	if { [info vars $upd] eq "" } {
+	    return -code error "$upd is not a known updater context"
+	}
+
+	upvar #0 $upd UPDATER
+
+	# Decide of the name of the file on the remote server
+	array set src [::uri::split $UPDATER(-source)]
+	set src_fname [file tail $src(path)]
+
+	# Decide of the destination on the local disk.  If that is a
+	# directory, append it the same name as the file on the remote
+	# server (the most usual case).
+	set dst [::diskutil::fname_resolv $UPDATER(-target)]
+	if { [file isdirectory $dst] } {
+	    set dst [file join $dst $src_fname]
+	}
+	set UPDATER(destination) $dst
+
+	# Now parse the result, i.e. the content of the digests file
+	# coming from the server.
+	upvar #0 $token result
+	foreach line [split $result(body) "\n"] {
+	    if { $line ne "" } {
+		set firstchar [string index $line 0]
+		# Skip all lines that are commented.
+		if { [string first $firstchar $UPD(comments)] < 0 } {
+		    set sumline [__sumline $line]
+		    if { [llength $sumline] == 0 } {
+			continue
+		    }
+		    foreach {algo sum fname} $sumline break
+		    # We have found a file name that matches the one
+		    # from the contract.  Compute digest of file on
+		    # local disk and trigger downloading of remote
+		    # source if they are different.
+		    if { $fname eq $src_fname } {
+			${log}::debug "Computing $algo for local file $dst"
+			set md [__cachedigest $dst $algo]
+			if { $UPDATER(downloading) } {
+			    ${log}::debug "Download for $dst still in progress"
+			} elseif { ! [string equal -nocase $md $sum] } {
+			    ${log}::notice "New version available for\
+                                            $UPDATER(destination), downloading\
+                                            and replacing"
+			    # Cleared once the download has ended, whichever
+			    # way it was performed, see __downloaded.
+			    set UPDATER(downloading) 1
+			    if { $UPDATER(-signature) ne "" } {
+				__delta $upd $algo $sum
+			    } else {
+				__probe $upd $algo $sum
+			    }
 			} else {
-			    ${log}::debug "$dst still has MD5 $sum at remote"
+			    ${log}::debug "$dst still has $algo $sum at remote"
 			}
 		    }
 		}
 	    }	    
 	}
     } else {
-	${log}::warn "Could not get the MD5 sums at $url"
+	${log}::warn "Could not get the digests at $url"
     }
 }
 
@@ -593,6 +1923,7 @@ proc ::updater::new { fname args } {
     set UPDATER(id) $upd
     set UPDATER(start) [clock seconds]
     set UPDATER(next) ""
+    set UPDATER(downloading) 0
     ::uobj::inherit UPD UPDATER
 
     if { $fname ne "" } {
@@ -5,6 +5,16 @@ namespace eval ::uuidhash {
     if { ! [info exists UUIDHASH] } {
 	array set UUIDHASH {
 	    generator  ""
+	    -version   compat
+	    -namespace ""
+	}
+	# Well-known namespaces from RFC 4122, appendix C.
+	variable NAMESPACES
+	array set NAMESPACES {
+	    dns   6ba7b810-9dad-11d1-80b4-00c04fd430c8
+	    url   6ba7b811-9dad-11d1-80b4-00c04fd430c8
+	    oid   6ba7b812-9dad-11d1-80b4-00c04fd430c8
+	    x500  6ba7b814-9dad-11d1-80b4-00c04fd430c8
 	}
     }
 }
@@ -22,32 +32,144 @@ proc ::uuidhash::__init {} {
 }
 
 
-proc ::uuidhash::uuid { str } {
+# ::uuidhash::__hasher -- Hashing command for a UUID version
+#
+#	Return the command to compute the (hexadecimal) hash of some
+#	data for a given UUID version.  The commands from tcllib
+#	automatically use their compiled accelerators (tcllibc, Trf)
+#	whenever these are installed.
+#
+# Arguments:
+#	version	3 (MD5) or 5 (SHA-1)
+#
+# Results:
+#	Return a command prefix, the data should be appended to it.
+#
+# Side Effects:
+#	Loads the hashing package.
+proc ::uuidhash::__hasher { version } {
+    switch -- $version {
+	3 {
+	    if { [catch {package require md5 2} err] } {
+		return -code error "Cannot generate version 3 UUIDs: $err"
+	    }
+	    return [list ::md5::md5 -hex --]
+	}
+	5 {
+	    if { [catch {package require sha1 2} err] } {
+		return -code error "Cannot generate version 5 UUIDs: $err"
+	    }
+	    return [list ::sha1::sha1 -hex --]
+	}
+    }
+    return -code error "$version is not a name-based UUID version, should\
+                        be 3 or 5"
+}
+
+
+# ::uuidhash::uuids -- Generate UUIDs for a list of names
+#
+#	Generate name-based UUIDs for all the names of a list.
+#	Options are resolved and the hashing package is looked up
+#	once for the whole list.  The -version option selects the
+#	kind of UUIDs to generate: 3 and 5 generate RFC 4122 version
+#	3 (MD5) and version 5 (SHA-1) UUIDs of the names (encoded in
+#	UTF-8) within the namespace given by -namespace; compat (the
+#	default) generates the same UUIDs as previous versions of
+#	this library, i.e. the hash of the names, without namespace
+#	and variant, using SHA-1 when available and MD5 otherwise.
+#	The namespace is either a UUID or one of the well-known
+#	namespaces dns, url, oid or x500, it defaults to the null
+#	UUID.
+#
+# Arguments:
+#	names	List of names
+#	args	Dash-led options and their values, see above.
+#
+# Results:
+#	Return the list of UUIDs, in the same order as the names.
+#
+# Side Effects:
+#	None.
+proc ::uuidhash::uuids { names args } {
     variable UUIDHASH
+    variable NAMESPACES
 
-    if { $UUIDHASH(generator) eq "" } {
-	if { [::uuidhash::__init] eq "" } {
-	    return -code error "Cannot find an appropriate UUID generator"
+    array set OPTS [array get UUIDHASH -*]
+    foreach {opt val} $args {
+	if { ![info exists OPTS($opt)] } {
+	    return -code error "Unknown option $opt, should be\
+                                [join [lsort [array names OPTS]] {, }]"
 	}
+	set OPTS($opt) $val
     }
 
-    set uid ""
-    set version 0
-    switch $UUIDHASH(generator) {
-	md5 {
-	    set uid [string tolower [::md5::md5 -hex $str]]
-	    set version 3
+    set uuids [list]
+    if { $OPTS(-version) eq "compat" } {
+	if { $UUIDHASH(generator) eq "" } {
+	    if { [::uuidhash::__init] eq "" } {
+		return -code error "Cannot find an appropriate UUID generator"
+	    }
 	}
-	sha1 {
-	    set uid [string tolower [::sha1::sha1 -hex $str]]
+	if { $UUIDHASH(generator) eq "sha1" } {
 	    set version 5
+	} else {
+	    set version 3
 	}
+	set hash [list ::$UUIDHASH(generator)::$UUIDHASH(generator) -hex]
+	foreach str $names {
+	    set uid [string tolower [eval $hash [list $str]]]
+	    lappend uuids "[string range $uid 0 7]-[string range $uid 8 11]-${version}[string range $uid 13 15]-[string range $uid 16 19]-[string range $uid 20 31]"
+	}
+	return $uuids
+    }
+
+    set version $OPTS(-version)
+    set hash [__hasher $version]
+
+    # Namespace in binary form, to be prepended to all names.
+    set ns $OPTS(-namespace)
+    if { [info exists NAMESPACES($ns)] } {
+	set ns $NAMESPACES($ns)
+    } elseif { $ns eq "" } {
+	set ns 00000000-0000-0000-0000-000000000000
+    }
+    set nshex [string map [list "-" ""] $ns]
+    if { [string length $nshex] != 32 || ![string is xdigit $nshex] } {
+	return -code error "$ns is not a valid namespace UUID"
     }
+    set nsbin [binary format H32 $nshex]
 
-    if { $uid ne "" } {
-	return "[string range $uid 0 7]-[string range $uid 8 11]-${version}[string range $uid 13 15]-[string range $uid 16 19]-[string range $uid 20 31]"
+    foreach str $names {
+	set uid [eval $hash [list $nsbin[encoding convertto utf-8 $str]]]
+	# Set version in the high nibble of byte 6 and the RFC 4122
+	# variant in the two high bits of byte 8.
+	scan [string range $uid 16 17] %x var
+	set var [format %02x [expr {($var & 0x3f) | 0x80}]]
+	set uid [string tolower $uid]
+	lappend uuids "[string range $uid 0 7]-[string range $uid 8 11]-${version}[string range $uid 13 15]-${var}[string range $uid 18 19]-[string range $uid 20 31]"
     }
-    return ""; # Should never be reached.
+
+    return $uuids
+}
+
+
+# ::uuidhash::uuid -- Generate a UUID for a name
+#
+#	Generate a name-based UUID for a name, see uuids for the
+#	options.
+#
+# Arguments:
+#	str	Name
+#	args	Dash-led options and their values.
+#
+# Results:
+#	Return the UUID.
+#
+# Side Effects:
+#	None.
+proc ::uuidhash::uuid { str args } {
+    return [lindex [eval [list uuids [list $str]] $args] 0]
 }
 
 
@@ -0,0 +1,108 @@
+# keysym_bench.tcl -- Keysym database micro-benchmark
+#
+#	Measure the startup cost of the keysym database, i.e. parsing
+#	keysym.map against loading the precompiled keysym.tbl, and the
+#	throughput of ::winop::keysym2ucs and ::winop::ucs2keysym once
+#	the database is loaded.  The keysym database does not depend on
+#	the windowing system, Tk and winapix are pretended to be
+#	present when they cannot be loaded so that the benchmark also
+#	runs without a display and on other platforms than Windows.
+#	Pass the path to another copy of the winop library to measure
+#	it instead, e.g. an older version:
+#
+#	tclsh tools/keysym_bench.tcl ?libdir? ?iterations?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set libdir [lindex $argv 0]
+if { $libdir eq "" } {
+    set libdir [file join [file dirname [file dirname [info script]]] winop]
+}
+set iterations [lindex $argv 1]
+if { $iterations eq "" } {
+    set iterations 20
+}
+
+foreach pkg { Tk winapix } {
+    if { [catch {package require $pkg}] } {
+	package provide $pkg 0
+    }
+}
+source [file join $libdir winop.tcl]
+
+
+# reset -- Forget keysym database
+#
+#	Empty the keysym database so that it is loaded anew at next
+#	use.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc reset { } {
+    array unset ::winop::KeySymDB
+    array unset ::winop::KeySymRev
+    set ::winop::KeySymList [list]
+    set ::winop::WOP(ks_loaded) 0
+}
+
+
+# rate -- Operations per second
+#
+#	Evaluate a script a number of times at the global level.
+#
+# Arguments:
+#	script	Script to evaluate
+#	n	Number of evaluations
+#
+# Results:
+#	Return the number of evaluations per second.
+#
+# Side Effects:
+#	Whatever the script does.
+proc rate { script n } {
+    set t [lindex [uplevel \#0 [list time $script $n]] 0]
+    return [expr {int(1e6 / $t)}]
+}
+
+
+# Older versions of the library lack the table and the lookup
+# procedures, these measures are reported as missing.
+set map [file join $libdir $::winop::WOP(dft_ks_name)]
+set t [time {reset; ::winop::__ks_read $map} $iterations]
+puts [format "%-24s %10.0f us" "parse keysym.map" [lindex $t 0]]
+puts [format "%-24s %10s" "([array size ::winop::KeySymDB] keysyms)" ""]
+if { [info exists ::winop::WOP(dft_ks_table)] \
+	 && [file readable [file join $libdir $::winop::WOP(dft_ks_table)]] } {
+    set t [time {reset; ::winop::__ks_load} $iterations]
+    puts [format "%-24s %10.0f us" "load keysym.tbl" [lindex $t 0]]
+} else {
+    puts [format "%-24s %10s" "load keysym.tbl" "missing"]
+}
+
+if { [info commands ::winop::ucs2keysym] eq "" } {
+    puts [format "%-24s %10s" "keysym2ucs/ucs2keysym" "missing"]
+    exit
+}
+reset
+set t [time {::winop::ucs2keysym 228} 1]
+puts [format "%-24s %10.0f us" "first ucs2keysym" [lindex $t 0]]
+
+set n [expr {$iterations * 5000}]
+puts [format "%-24s %10d /s" "keysym2ucs" \
+	  [rate {::winop::keysym2ucs adiaeresis} $n]]
+puts [format "%-24s %10d /s" "keysym2ucs (unknown)" \
+	  [rate {::winop::keysym2ucs nosuchkeysym} $n]]
+puts [format "%-24s %10d /s" "ucs2keysym" \
+	  [rate {::winop::ucs2keysym 228} $n]]
+puts [format "%-24s %10d /s" "ucs2keysym (unknown)" \
+	  [rate {::winop::ucs2keysym 0x10ffff} $n]]
+exit
@@ -0,0 +1,47 @@
+# keysym_compile.tcl -- Precompile the keysym database
+#
+#	Compile the keysym map (in the format of the xterm source
+#	distribution) that comes with winop into the table that winop
+#	loads on first use.  The table contains one keysym name and
+#	its Unicode code point per line, in the order of the map, so
+#	that it can be loaded with a single 'array set'.  Run this
+#	script whenever keysym.map has changed:
+#
+#	tclsh tools/keysym_compile.tcl ?map? ?table?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set dir [file join [file dirname [file dirname [info script]]] winop]
+set map [lindex $argv 0]
+if { $map eq "" } {
+    set map [file join $dir keysym.map]
+}
+set tbl [lindex $argv 1]
+if { $tbl eq "" } {
+    set tbl [file join $dir keysym.tbl]
+}
+
+set in [open $map]
+set table ""
+set nb 0
+while { [gets $in line] >= 0 } {
+    # Lines look like: 0x0020   U0020   # space
+    if { [scan $line " 0x%*x U%x # %s" val keysym] == 2 && $val != 0 } {
+	append table [list $keysym $val] \n
+	incr nb
+    }
+}
+close $in
+
+# Write to a temporary file and rename into place, so that winop
+# never loads a half-written table.
+set out [open $tbl.tmp w]
+fconfigure $out -translation lf
+puts -nonewline $out $table
+close $out
+file rename -force $tbl.tmp $tbl
+
+puts "Compiled $nb keysyms from $map into $tbl"
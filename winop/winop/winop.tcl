@@ -22,15 +22,20 @@ namespace eval ::winop {
 	    maxreceivers      -1
 	    wins              ""
 	    dft_ks_name       "keysym.map"
+	    dft_ks_table      "keysym.tbl"
+	    ks_loaded         0
 	    -dclick_precision 10
 	    -clickwholetree   off
 	}
 	variable log [::logger::init [string trimleft [namespace current] ::]]
 	variable libdir [file dirname [file normalize [info script]]]
 	${log}::setlevel $WOP(loglevel)
-	array set KeySymDB {}
+	array set KeySymDB {};	# Keysym name -> Unicode
+	array set KeySymRev {};	# Unicode -> keysym name, built on demand
+	set KeySymList [list];	# Keysym names and Unicode, in map order
     }
-    namespace export new loglevel config defaults capture
+    namespace export new loglevel config defaults capture \
+	keysym2ucs ucs2keysym
 }
 
 
@@ -150,6 +155,8 @@ proc ::winop::__ks_read { { fname "" } } {
     variable log
     variable libdir
     variable KeySymDB
+    variable KeySymRev
+    variable KeySymList
 
     if { $fname eq "" } {
 	set fname [file join $libdir $WOP(dft_ks_name)]
@@ -161,36 +168,139 @@ proc ::winop::__ks_read { { fname "" } } {
 	${log}::warn "Could not read keysym database from '$fname': $fd"
     } else {
 	set nbread 0
-	while { ! [eof $fd] } {
-	    set line [string trim [gets $fd]]
-	    if { $line ne "" } {
-		set firstchar [string index $line 0]
-		if { [string first $firstchar "\#!;"] < 0 } {
-		    set keysym_d [lindex $line 0]
-		    set unicode_d [lindex $line 1]
-		    set keysym_s [lindex $line 3]
-		    
-		    if { $unicode_d ne "U0000" } {
-			set str [subst [string map {U \\u} $unicode_d]]
-			set val [expr [string map {U 0x} $unicode_d]]
-			set KeySymDB($keysym_s) $val
-			incr nbread
-			if { 0 } {
-			    ${log}::debug \
-				"Added $keysym_s -> $unicode_d ($str)\
-                                 to keysym database"
-			}
-		    }
-		}
+	while { [gets $fd line] >= 0 } {
+	    # Lines look like: 0x0020   U0020   # space
+	    if { [scan $line " 0x%*x U%x # %s" val keysym_s] == 2 \
+		     && $val != 0 } {
+		set KeySymDB($keysym_s) $val
+		lappend KeySymList $keysym_s $val
+		incr nbread
 	    }
 	}
 	close $fd
+	array unset KeySymRev
     }
 
     return $nbread
 }
 
 
+# ::winop::__ks_load -- Load keysym database on first use
+#
+#	This procedure loads the default keysym database.  The
+#	database is loaded from the table that tools/keysym_compile.tcl
+#	precompiles from the keysym map, a table that is simply a
+#	list of keysym names and Unicode code points.  The map itself
+#	is only parsed when the table is missing or older than the
+#	map.
+#
+# Arguments:
+#	None.
+#
+# Results:
+#	Return the number of keysym entries that were loaded, a
+#	negative number on error.
+#
+# Side Effects:
+#	None.
+proc ::winop::__ks_load { } {
+    variable WOP
+    variable log
+    variable libdir
+    variable KeySymDB
+    variable KeySymList
+
+    set WOP(ks_loaded) 1
+    set map [file join $libdir $WOP(dft_ks_name)]
+    set tbl [file join $libdir $WOP(dft_ks_table)]
+    if { [file readable $tbl] \
+	     && ( ! [file exists $map] \
+		      || [file mtime $tbl] >= [file mtime $map] ) } {
+	if { [catch {open $tbl} fd] == 0 } {
+	    set list [read $fd]
+	    close $fd
+	    if { [catch {array set KeySymDB $list} err] == 0 } {
+		set KeySymList $list
+		${log}::debug "Loaded keysym database from '$tbl'"
+		return [expr {[llength $list] / 2}]
+	    }
+	    ${log}::warn "Corrupted keysym table at '$tbl': $err"
+	}
+    } else {
+	${log}::notice "Keysym table '$tbl' is missing or older than '$map',\
+                        run tools/keysym_compile.tcl"
+    }
+
+    return [__ks_read $map]
+}
+
+
+# ::winop::keysym2ucs -- Convert a keysym to Unicode
+#
+#	This procedure looks up the Unicode code point of a keysym
+#	(as in X11) in the keysym database.
+#
+# Arguments:
+#	keysym	Name of keysym, e.g. Return or adiaeresis.
+#
+# Results:
+#	Return the Unicode code point (an integer), an empty string if
+#	the keysym is unknown.
+#
+# Side Effects:
+#	Loads the keysym database on first use.
+proc ::winop::keysym2ucs { keysym } {
+    variable WOP
+    variable KeySymDB
+
+    if { ! $WOP(ks_loaded) } {
+	__ks_load
+    }
+    if { [info exists KeySymDB($keysym)] } {
+	return $KeySymDB($keysym)
+    }
+    return ""
+}
+
+
+# ::winop::ucs2keysym -- Convert Unicode to a keysym
+#
+#	This procedure looks up the keysym (as in X11) of a Unicode
+#	code point in the keysym database.  When several keysyms map
+#	to the same code point, the first one of the map is returned.
+#
+# Arguments:
+#	ucs	Unicode code point (an integer)
+#
+# Results:
+#	Return the name of the keysym, an empty string if there is
+#	none.
+#
+# Side Effects:
+#	Loads the keysym database on first use.
+proc ::winop::ucs2keysym { ucs } {
+    variable WOP
+    variable KeySymRev
+    variable KeySymList
+
+    if { ! $WOP(ks_loaded) } {
+	__ks_load
+    }
+    if { [array size KeySymRev] == 0 } {
+	foreach {keysym val} $KeySymList {
+	    if { ! [info exists KeySymRev($val)] } {
+		set KeySymRev($val) $keysym
+	    }
+	}
+    }
+    if { [string is integer -strict $ucs] \
+	     && [info exists KeySymRev([expr {$ucs}])] } {
+	return $KeySymRev([expr {$ucs}])
+    }
+    return ""
+}
+
+
 # ::winop::__init -- Initialise window state
 #
 #	This procedure installs the context for one of the window
@@ -208,12 +318,6 @@ proc ::winop::__ks_read { { fname "" } } {
 proc ::winop::__init { whnd } {
     variable WOP
     variable log
-    variable KeySymDB
-
-    # Read in keysym database once for all
-    if { [llength [array names KeySymDB]] == 0 } {
-	__ks_read
-    }
 
     # Guess if the handle corresponds to a Windows handle
     set windows_hnd ""
@@ -1419,7 +1523,6 @@ proc ::winop::motion { whnd btn x y } {
 proc ::winop::key { whnd action keysym keycode } {
     variable WOP
     variable log
-    variable KeySymDB
 
     set id [__init $whnd]
     if { $id ne "" && [exists $whnd] } {
@@ -1468,8 +1571,8 @@ proc ::winop::key { whnd action keysym keycode } {
 		} else {
 		    if { $keycode eq "" } {
 			if { $keysym ne "" } {
-			    if { [array names KeySymDB $keysym] ne "" } {
-				set uchar $KeySymDB($keysym)
+			    set uchar [keysym2ucs $keysym]
+			    if { $uchar ne "" } {
 				set keycode [::winapi::VkKeyScan $uchar]
 			    }
 			}
@@ -1489,10 +1592,11 @@ proc ::winop::key { whnd action keysym keycode } {
 			# Send the translated keysym to the window as
 			# a WM_CHAR. Maybe could we use the keycode
 			# instead here, dunno really.
-			if { [array names KeySymDB $keysym] ne "" } {
+			set uchar [keysym2ucs $keysym]
+			if { $uchar ne "" } {
 			    foreach w $receivers {
 				set res [::winapi::SendMessage $w WM_CHAR \
-					     $KeySymDB($keysym) 0]
+					     $uchar 0]
 				if { $res } { break }
 			    }
 			} else {
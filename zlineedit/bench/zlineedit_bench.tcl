@@ -0,0 +1,178 @@
+# zlineedit_bench.tcl -- Line edition micro-benchmark
+#
+#	Measure the cost of dragging a vertex, inserting a vertex and
+#	moving the whole line for editors of increasing number of
+#	vertices.  The dragged vertex is in the middle of the line.
+#	By default, the editors are created on a real Zinc canvas,
+#	which requires a display.  With -mock, they are created on a
+#	stand-in canvas command that only keeps track of coordinates
+#	and counts the canvas operations, so that the cost of the
+#	library itself can be measured without a display.  Pass the
+#	path to another copy of the zlineedit library to measure it
+#	instead, e.g. an older version:
+#
+#	tclsh bench/zlineedit_bench.tcl ?-mock? ?libdir? ?iterations?
+#
+# Copyright (c) 2004-2006 by the Swedish Institute of Computer Science.
+#
+# See the file 'license.terms' for information on usage and redistribution
+# of this file, and for a DISCLAIMER OF ALL WARRANTIES.
+
+set mock 0
+if { [lindex $argv 0] eq "-mock" } {
+    set mock 1
+    set argv [lrange $argv 1 end]
+}
+set libdir [lindex $argv 0]
+if { $libdir eq "" } {
+    set libdir [file join [file dirname [file dirname [info script]]] zlineedit]
+}
+set iterations [lindex $argv 1]
+if { $iterations eq "" } {
+    set iterations 20
+}
+
+set ncalls 0
+if { $mock } {
+    # Pretend Tk and Zinc are there, the library only binds to the
+    # canvas outside of the operations that are measured.
+    package provide Tk 8.4
+    package provide Tkzinc 3.3
+    if { [info commands bind] eq "" } {
+	proc bind { args } {}
+    }
+
+    set ids 0
+    array set COORDS {}
+    array set PARENT {}
+
+    # canvas -- Stand-in Zinc canvas
+    #
+    #	Implement the subset of the Zinc canvas operations that the
+    #	line editor relies on, keeping track of the coordinates and
+    #	groups of items only.
+    #
+    # Arguments:
+    #	cmd	Canvas operation
+    #	args	Arguments to operation
+    #
+    # Results:
+    #	Depends on the operation, as for Zinc.
+    #
+    # Side Effects:
+    #	Counts the operations.
+    proc canvas { cmd args } {
+	global ncalls ids COORDS PARENT
+
+	incr ncalls
+	switch -- $cmd {
+	    add {
+		set id [incr ids]
+		set PARENT($id) [lindex $args 1]
+		set COORDS($id) [lindex $args 2]
+		return $id
+	    }
+	    coords {
+		set id [lindex $args 0]
+		switch [llength $args] {
+		    1 {
+			return $COORDS($id)
+		    }
+		    2 {
+			set COORDS($id) [lindex $args 1]
+		    }
+		    4 {
+			# Single point of a single contour
+			foreach {id contour i xy} $args break
+			set COORDS($id) [lreplace $COORDS($id) \
+					     [expr {2*$i}] [expr {2*$i+1}] \
+					     [lindex $xy 0] [lindex $xy 1]]
+		    }
+		}
+	    }
+	    itemconfigure {
+		if { [llength $args] == 1 } {
+		    return [list [list -linewidth "" "" "" 1]]
+		}
+	    }
+	    group {
+		return $PARENT([lindex $args 0])
+	    }
+	    find {
+		set id [lindex $args 1]
+		if { [info exists COORDS($id)] } {
+		    return $id
+		}
+	    }
+	    remove {
+		foreach id $args {
+		    unset -nocomplain COORDS($id) PARENT($id)
+		}
+	    }
+	}
+	return ""
+    }
+    set zcs canvas
+} else {
+    package require Tk
+    package require Tkzinc
+    set zcs [zinc .zc -width 800 -height 600]
+    pack $zcs -fill both -expand on
+    update
+}
+source [file join $libdir zlineedit.tcl]
+
+
+# usecs -- Average time
+#
+#	Evaluate a script a number of times at the global level.
+#
+# Arguments:
+#	script	Script to evaluate
+#	n	Number of evaluations
+#
+# Results:
+#	Return the average number of microseconds per evaluation.
+#
+# Side Effects:
+#	Whatever the script does.
+proc usecs { script n } {
+    return [lindex [uplevel \#0 [list time $script $n]] 0]
+}
+
+if { $mock } {
+    puts [format "%-10s %12s %8s %12s %12s" \
+	      vertices drag(us) calls insert(us) move(us)]
+} else {
+    puts [format "%-10s %12s %12s %12s" vertices drag(us) insert(us) move(us)]
+}
+foreach n { 100 1000 10000 } {
+    set coords [list]
+    for { set i 0 } { $i < $n } { incr i } {
+	lappend coords [expr {$i % 800}] [expr {100 + ($i % 7) * 10}]
+    }
+    set e [::zlineedit::new $zcs $coords -autostart off]
+    upvar \#0 $e EDITOR
+
+    # Drag the middle vertex, one motion event per iteration.
+    set v [lindex $EDITOR(vertices) [expr {$n / 2}]]
+    set k 0
+    ::zlineedit::__vertexedit $v START 400 100
+    set ncalls 0
+    set drag [usecs {::zlineedit::__vertexedit $v MOTION [incr k] 120} \
+		  $iterations]
+    set calls [expr {$ncalls / $iterations}]
+    ::zlineedit::__vertexedit $v STOP $k 120
+
+    set insert [usecs {::zlineedit::insertvertex $e 5 5 10 on} $iterations]
+    set move [usecs {::zlineedit::move $e 1 1} $iterations]
+
+    if { $mock } {
+	puts [format "%-10d %12.0f %8d %12.0f %12.0f" $n $drag $calls $insert $move]
+    } else {
+	update
+	puts [format "%-10d %12.0f %12.0f %12.0f" $n $drag $insert $move]
+    }
+    ::zlineedit::delete $e
+}
+exit
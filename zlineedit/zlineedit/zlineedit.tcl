@@ -49,9 +49,19 @@ namespace eval ::zlineedit {
 # editor, including for the callers.  Vertices are named similarily,
 # beginning with the keyword 'vertex_'.  Vertices are either created
 # from the ::new command or interactively.  The coordinates of the
-# vertices of the polyline is always uniquely contained in the vertex
-# objects, which allows for the reordering of the vertices within a
-# line.
+# vertices of the polyline is contained in the vertex objects, which
+# allows for the reordering of the vertices within a line.  Editors
+# also keep all coordinates packed in a single list, in the order of
+# the vertices, which is what is given to the Zinc curve.  All
+# modifications of the coordinates go through __setxy, which keeps
+# both in sync.
+#
+# Redrawing is incremental: editors remember which vertices have
+# changed since the last redraw (the dirty list) and if the line has
+# changed shape (vertices inserted or removed).  Only the changed
+# points of the curve and the changed markers are pushed to the
+# canvas, and styles are only applied to items when they have
+# changed.
 #
 # This module tries to centralise activities to a single point and
 # context in the form of (sometimes lengthy) procedures.  This
@@ -246,11 +256,13 @@ proc ::zlineedit::__vertexedit { vertex action { x "" } { y "" }} {
 	"ENTER" {
 	    if { [string is false $VERTEX(lock)] } {
 		set VERTEX(editing) on
+		__dirty $EDITOR(self) $vertex
 		__draw $EDITOR(self)
 	    }
 	}
 	"LEAVE" {
 	    set VERTEX(editing) off
+	    __dirty $EDITOR(self) $vertex
 	    __draw $EDITOR(self)
 	}
 	"START" {
@@ -262,6 +274,8 @@ proc ::zlineedit::__vertexedit { vertex action { x "" } { y "" }} {
 		set VERTEX(__vertexedit_motion) [bind $EDITOR(canvas) <Motion>]
 		set VERTEX(__vertexedit_x) $x
 		set VERTEX(__vertexedit_y) $y
+		set VERTEX(__vertexedit_idx) \
+		    [lsearch -exact $EDITOR(vertices) $vertex]
 		bind $EDITOR(canvas) <Motion> \
 		    "::zlineedit::__vertexedit $vertex MOTION %x %y"
 	    }
@@ -274,8 +288,10 @@ proc ::zlineedit::__vertexedit { vertex action { x "" } { y "" }} {
 	    # clicking on the vertices.
 	    set dx [expr {$x - $VERTEX(__vertexedit_x)}]
 	    set dy [expr {$y - $VERTEX(__vertexedit_y)}]
-	    set VERTEX(x) [expr {$VERTEX(x) + $dx}]
-	    set VERTEX(y) [expr {$VERTEX(y) + $dy}]
+	    set VERTEX(__vertexedit_idx) \
+		[__setxy $EDITOR(self) $vertex \
+		     [expr {$VERTEX(x) + $dx}] [expr {$VERTEX(y) + $dy}] \
+		     $VERTEX(__vertexedit_idx)]
 	    set VERTEX(__vertexedit_x) $x
 	    set VERTEX(__vertexedit_y) $y
 	    __draw $EDITOR(self)
@@ -292,6 +308,7 @@ proc ::zlineedit::__vertexedit { vertex action { x "" } { y "" }} {
 		# point when an unbind operation is issued.
 		unset VERTEX(__vertexedit_x)
 		unset VERTEX(__vertexedit_y)
+		unset VERTEX(__vertexedit_idx)
 		__trigger $EDITOR(self) VertexMove $vertex $VERTEX(x) $VERTEX(y)
 	    }
 	}
@@ -467,12 +484,14 @@ proc ::zlineedit::__lineedit { editor action { x "" } { y "" }} {
 	    # clicking on the vertices.
 	    set dx [expr {$x - $EDITOR(__lineedit_x)}]
 	    set dy [expr {$y - $EDITOR(__lineedit_y)}]
+	    set idx 0
 	    foreach vertex $EDITOR(vertices) {
 		upvar #0 $vertex VERTEX
 		if { [string is false $VERTEX(lock)] } {
-		    set VERTEX(x) [expr {$VERTEX(x) + $dx}]
-		    set VERTEX(y) [expr {$VERTEX(y) + $dy}]
+		    __setxy $editor $vertex \
+			[expr {$VERTEX(x) + $dx}] [expr {$VERTEX(y) + $dy}] $idx
 		}
+		incr idx
 	    }
 	    set EDITOR(__lineedit_x) $x
 	    set EDITOR(__lineedit_y) $y
@@ -667,6 +686,24 @@ proc ::zlineedit::__binding { editor bind } {
     upvar #0 $editor EDITOR
 
     if { [string is true $bind] } {
+	# Nothing has changed in the interaction since last time, only
+	# bind the vertices that were inserted since then.
+	set sig [list $EDITOR(adding) $EDITOR(-interaction) \
+		     [expr {[llength $EDITOR(vertices)] > 1}]]
+	if { $sig eq $EDITOR(bindsig) } {
+	    if { [string is false $EDITOR(adding)] } {
+		foreach vertex $EDITOR(fresh) {
+		    if { [info exists $vertex] } {
+			__vertexedit $vertex BIND
+		    }
+		}
+	    }
+	    set EDITOR(fresh) [list]
+	    return
+	}
+	set EDITOR(bindsig) $sig
+	set EDITOR(fresh) [list]
+
 	# When in adding mode, we will be following the mouse motion
 	# events to draw a skeleton line for the "next" line segment in
 	# the process of creating a line, which means that we will not
@@ -688,6 +725,7 @@ proc ::zlineedit::__binding { editor bind } {
 	    }
 	}
     } else {
+	set EDITOR(bindsig) ""
 	__lineedit $editor UNBIND
 	foreach vertex $EDITOR(vertices) {
 	    __vertexedit $vertex UNBIND
@@ -743,15 +781,16 @@ proc ::zlineedit::__tag { editor } {
 	}
     }
 
-    # Give a name to each vertex in turn, if any.
+    # Give a name to each vertex in turn, if any.  Vertices remember
+    # the root that they were tagged with, so that we only tag new
+    # vertices.
     foreach vertex $EDITOR(vertices) {
 	upvar #0 $vertex VERTEX
-	if { $VERTEX(itm) ne "" \
-		 && [$EDITOR(canvas) find withtag \
-			 ${root}_vertex$VERTEX(id)] eq "" } {
+	if { $VERTEX(itm) ne "" && $VERTEX(tagged) ne $root } {
 	    $EDITOR(canvas) addtag ${root}_vertex$VERTEX(id) \
 		withtag $VERTEX(itm)
 	    lappend tags ${root}_vertex$VERTEX(id)
+	    set VERTEX(tagged) $root
 	}
     }
     
@@ -763,11 +802,120 @@ proc ::zlineedit::__tag { editor } {
 
 
 
+# ::zlineedit::__dirty -- Mark a vertex for redraw
+#
+#	This procedure marks a vertex so that its representation will
+#	be updated at the next redraw.
+#
+# Arguments:
+#	editor	Identifier of the editor, as returned by ::zlineedit::new
+#	vertex	Identifier of the vertex
+#	idx	Index of the vertex in the line, empty if the coordinates
+#		of the vertex have not changed.
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::zlineedit::__dirty { editor vertex { idx "" } } {
+    upvar #0 $editor EDITOR
+
+    # Look at the first element only, comparing the whole list to
+    # "all" would generate its string representation at each call.
+    if { [lindex $EDITOR(dirty) 0] ne "all" } {
+	lappend EDITOR(dirty) $vertex $idx
+    }
+}
+
+
+# ::zlineedit::__setxy -- Set vertex coordinates
+#
+#	This procedure sets the coordinates of a vertex, both in the
+#	vertex and in the packed coordinates of its editor, and marks
+#	the vertex for redraw.
+#
+# Arguments:
+#	editor	Identifier of the editor, as returned by ::zlineedit::new
+#	vertex	Identifier of the vertex
+#	x	New x position
+#	y	New y position
+#	idx	Index of the vertex in the line, if known.
+#
+# Results:
+#	Return the index of the vertex in the line.
+#
+# Side Effects:
+#	None.
+proc ::zlineedit::__setxy { editor vertex x y { idx "" } } {
+    upvar #0 $editor EDITOR
+    upvar #0 $vertex VERTEX
+
+    if { $idx eq "" || [lindex $EDITOR(vertices) $idx] ne $vertex } {
+	set idx [lsearch -exact $EDITOR(vertices) $vertex]
+    }
+    set VERTEX(x) $x
+    set VERTEX(y) $y
+    lset EDITOR(coords) [expr {2*$idx}] $x
+    lset EDITOR(coords) [expr {2*$idx+1}] $y
+    __dirty $editor $vertex $idx
+
+    return $idx
+}
+
+
+# ::zlineedit::__marker -- Draw the marker of a vertex
+#
+#	This procedure creates or updates the small rectangle that
+#	represents a vertex on the canvas.  The style of the marker is
+#	only applied when it has changed.
+#
+# Arguments:
+#	editor	Identifier of the editor, as returned by ::zlineedit::new
+#	vertex	Identifier of the vertex
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	Will modify the canvas!
+proc ::zlineedit::__marker { editor vertex } {
+    upvar #0 $editor EDITOR
+    upvar #0 $vertex VERTEX
+
+    set half [expr {round(0.5*$EDITOR(-markersize))}]
+    set box [list [expr {$VERTEX(x) - $half}] [expr {$VERTEX(y) - $half}] \
+		 [expr {$VERTEX(x) + $half}] [expr {$VERTEX(y) + $half}]]
+
+    # If we don't have any representation on the Zinc canvas (or if
+    # it has disappeared), create an initial rectangle.
+    if { $VERTEX(itm) eq "" \
+	     || [catch {$EDITOR(canvas) coords $VERTEX(itm) $box}] } {
+	set VERTEX(itm) [$EDITOR(canvas) add rectangle $EDITOR(root) $box]
+	set VERTEX(style) ""
+	set VERTEX(tagged) ""
+    }
+
+    # Account for its appearance, as from the configuration of the
+    # editor.
+    if { [string is true $VERTEX(editing)] } {
+	set style $EDITOR(-markereditstyle)
+    } else {
+	set style $EDITOR(-markerstyle)
+    }
+    if { $style ne $VERTEX(style) } {
+	eval $EDITOR(canvas) itemconfigure $VERTEX(itm) $style
+	set VERTEX(style) $style
+    }
+}
+
+
 # ::zlineedit::__draw -- Draw a line editor
 #
 #	This command draws a line editor, creating/removing all the
 #	necessary graphical objects if necessary, and updating these
-#	if they already existed.
+#	if they already existed.  Only the vertices that have changed
+#	since the last redraw are pushed to the canvas.
 #
 # Arguments:
 #	editor	Identifier of the editor, as returned by ::zlineedit::new
@@ -800,6 +948,8 @@ proc ::zlineedit::__draw { editor } {
 	if { $EDITOR(line) eq "" } {
 	    set EDITOR(line) [$EDITOR(canvas) add curve $EDITOR(root) \
 				  [list 0 0]]
+	    set EDITOR(linestyle) ""
+	    set EDITOR(reshape) 1
 	}
 	# Make sure that it is a child of the main group (this can
 	# happen when we have taken over a polyline.
@@ -811,11 +961,13 @@ proc ::zlineedit::__draw { editor } {
 	# Account for its appearance, as from the configuration of the
 	# editor.
 	if { [string is true $EDITOR(editing)] } {
-	    eval $EDITOR(canvas) itemconfigure $EDITOR(line) \
-		$EDITOR(-lineeditstyle)
+	    set style $EDITOR(-lineeditstyle)
 	} else {
-	    eval $EDITOR(canvas) itemconfigure $EDITOR(line) \
-		$EDITOR(-linestyle)
+	    set style $EDITOR(-linestyle)
+	}
+	if { $style ne $EDITOR(linestyle) } {
+	    eval $EDITOR(canvas) itemconfigure $EDITOR(line) $style
+	    set EDITOR(linestyle) $style
 	}
 	
 	if { $EDITOR(-outlinestyle) ne "" } {
@@ -824,44 +976,65 @@ proc ::zlineedit::__draw { editor } {
 	    if { $EDITOR(outline) eq "" } {
 		set EDITOR(outline) [$EDITOR(canvas) add curve $EDITOR(root) \
 					 [list 0 0]]
+		$EDITOR(canvas) lower $EDITOR(outline) $EDITOR(line)
+		set EDITOR(outlinestyle) ""
+		set EDITOR(reshape) 1
 	    }
-	    $EDITOR(canvas) lower $EDITOR(outline) $EDITOR(line)
 
 	    # Account for its appearance, as from the configuration of
-	    # the editor.
-	    eval $EDITOR(canvas) itemconfigure $EDITOR(outline) \
-		$EDITOR(-outlinestyle)
-
-	    # Fix line width if none was specified, be sure to be
-	    # larger than the line
-	    if { [lsearch -glob $EDITOR(-outlinestyle) "-linew*"] < 0 } {
-		set linewidth 1
-		foreach cfginfo [$EDITOR(canvas) itemconfigure $EDITOR(line)] {
-		    foreach {attr type ro unused val} $cfginfo {}
-		    if { [string match "-linew*" $attr] } {
-			set linewidth $val
+	    # the editor, and of the line.
+	    set style [list $EDITOR(-outlinestyle) $EDITOR(linestyle)]
+	    if { $style ne $EDITOR(outlinestyle) } {
+		eval $EDITOR(canvas) itemconfigure $EDITOR(outline) \
+		    $EDITOR(-outlinestyle)
+
+		# Fix line width if none was specified, be sure to be
+		# larger than the line
+		if { [lsearch -glob $EDITOR(-outlinestyle) "-linew*"] < 0 } {
+		    set linewidth 1
+		    foreach cfginfo \
+			[$EDITOR(canvas) itemconfigure $EDITOR(line)] {
+			foreach {attr type ro unused val} $cfginfo {}
+			if { [string match "-linew*" $attr] } {
+			    set linewidth $val
+			}
 		    }
+		    set linewidth [expr {$linewidth + 2}]
+		    $EDITOR(canvas) itemconfigure $EDITOR(outline) \
+			-linewidth $linewidth
 		}
-		set linewidth [expr {$linewidth + 2}]
-		$EDITOR(canvas) itemconfigure $EDITOR(outline) \
-		    -linewidth $linewidth
+		set EDITOR(outlinestyle) $style
 	    }
 	}
 
-	# Gather all the coordinates of the vertices and modify the
-	# associated Zinc curve.
-	set vlist [list]
-	foreach vertex $EDITOR(vertices) {
-	    upvar #0 $vertex VERTEX
-	    lappend vlist $VERTEX(x) $VERTEX(y)
-	}
-	$EDITOR(canvas) coords $EDITOR(line) $vlist
+	# Push the coordinates of the vertices to the associated Zinc
+	# curve(s).  When the shape of the line has not changed and
+	# only a few vertices have moved, only these are modified.
+	set lines [list $EDITOR(line)]
 	if { $EDITOR(outline) ne "" } {
-	    $EDITOR(canvas) coords $EDITOR(outline) $vlist
+	    lappend lines $EDITOR(outline)
+	}
+	if { $EDITOR(reshape) || [lindex $EDITOR(dirty) 0] eq "all" \
+		 || [llength $EDITOR(dirty)] > $len / 4 } {
+	    foreach itm $lines {
+		$EDITOR(canvas) coords $itm $EDITOR(coords)
+	    }
+	    set EDITOR(reshape) 0
+	} else {
+	    foreach {vertex idx} $EDITOR(dirty) {
+		if { $idx ne "" } {
+		    set xy [lrange $EDITOR(coords) [expr {2*$idx}] \
+				[expr {2*$idx+1}]]
+		    foreach itm $lines {
+			$EDITOR(canvas) coords $itm 0 $idx $xy
+		    }
+		}
+	    }
 	}
     } else {
 	# Remove the Zinc curve if we have less than 2 vertices.
-	if { [$EDITOR(canvas) find withtag $EDITOR(line)] ne "" } {
+	if { $EDITOR(line) ne "" \
+		 && [$EDITOR(canvas) find withtag $EDITOR(line)] ne "" } {
 	    $EDITOR(canvas) remove $EDITOR(line)
 	    set EDITOR(line) ""
 	}
@@ -872,35 +1045,20 @@ proc ::zlineedit::__draw { editor } {
 	}
     }
 
-    # If we have at least one vertex, represent each of these, in
-    # turn, by a small rectangle.
-    if { $len > 0 } {
+    # Represent each vertex that has changed, in turn, by a small
+    # rectangle.
+    if { [lindex $EDITOR(dirty) 0] eq "all" } {
 	foreach vertex $EDITOR(vertices) {
-	    upvar #0 $vertex VERTEX
-	    # If we don't have any representation on the Zinc canvas,
-	    # create an initial rectangle.
-	    if { $VERTEX(itm) eq "" \
-		     || [$EDITOR(canvas) find withtag $VERTEX(itm)] eq "" } {
-		set VERTEX(itm) [$EDITOR(canvas) add rectangle $EDITOR(root) \
-				     [list 0 0 0 0]]
-	    }
-	    # Account for its appearance, as from the configuration of the
-	    # editor.
-	    if { [string is true $VERTEX(editing)] } {
-		eval $EDITOR(canvas) itemconfigure $VERTEX(itm) \
-		    $EDITOR(-markereditstyle)
-	    } else {
-		eval $EDITOR(canvas) itemconfigure $VERTEX(itm) \
-		    $EDITOR(-markerstyle)
+	    __marker $editor $vertex
+	}
+    } else {
+	foreach {vertex idx} $EDITOR(dirty) {
+	    if { [info exists $vertex] } {
+		__marker $editor $vertex
 	    }
-	    $EDITOR(canvas) coords $VERTEX(itm) \
-		[list \
-		     [expr {$VERTEX(x) - round(0.5*$EDITOR(-markersize))}] \
-		     [expr {$VERTEX(y) - round(0.5*$EDITOR(-markersize))}] \
-		     [expr {$VERTEX(x) + round(0.5*$EDITOR(-markersize))}] \
-		     [expr {$VERTEX(y) + round(0.5*$EDITOR(-markersize))}]]
 	}
     }
+    set EDITOR(dirty) [list]
 
     # Fix the bindings for the various parts of the line editor
     __binding $editor on
@@ -957,13 +1115,11 @@ proc ::zlineedit::movevertex { vertex x y {abs on}} {
     variable log
 
     upvar #0 $vertex VERTEX
-    if { [string is true $abs] } {
-	set VERTEX(x) $x
-	set VERTEX(y) $y
-    } else {
-	set VERTEX(x) [expr {$VERTEX(x) + $x}]
-	set VERTEX(y) [expr {$VERTEX(y) + $y}]
+    if { [string is false $abs] } {
+	set x [expr {$VERTEX(x) + $x}]
+	set y [expr {$VERTEX(y) + $y}]
     }
+    __setxy $VERTEX(editor) $vertex $x $y
     __draw $VERTEX(editor)
     
     return [list $VERTEX(x) $VERTEX(y)]
@@ -1000,6 +1156,9 @@ proc ::zlineedit::removevertex { vertex } {
 	__vertexedit $vertex UNBIND
 	$EDITOR(canvas) remove $VERTEX(itm)
 	set EDITOR(vertices) [lreplace $EDITOR(vertices) $idx $idx]
+	set EDITOR(coords) [lreplace $EDITOR(coords) \
+				[expr {2*$idx}] [expr {2*$idx+1}]]
+	set EDITOR(reshape) 1
 	__trigger $EDITOR(self) VertexRemove $vertex $VERTEX(x) $VERTEX(y)
 	unset VERTEX
 	__draw $EDITOR(self)
@@ -1043,8 +1202,15 @@ proc ::zlineedit::insertvertex { editor x y { where end } { redraw off } } {
     set VERTEX(editing) off
     set VERTEX(lock) off
     set VERTEX(itm) ""
+    set VERTEX(style) "";	# Style applied to marker
+    set VERTEX(tagged) "";	# Root tag that marker was tagged with
     
     set EDITOR(vertices) [linsert $EDITOR(vertices) $where $vertex]
+    set idx [lsearch -exact $EDITOR(vertices) $vertex]
+    set EDITOR(coords) [linsert $EDITOR(coords) [expr {2*$idx}] $x $y]
+    set EDITOR(reshape) 1
+    __dirty $editor $vertex $idx
+    lappend EDITOR(fresh) $vertex
     ${log}::info "Inserted vertex $vertex at $where in $editor"
     __trigger $EDITOR(self) VertexInsert $vertex $VERTEX(x) $VERTEX(y) $where
 
@@ -1120,10 +1286,14 @@ proc ::zlineedit::move { editor {dx 0} {dy 0} } {
     }
     upvar #0 $editor EDITOR
 
+    # All vertices move, redraw them all at once.
+    set EDITOR(dirty) "all"
+    set idx 0
     foreach vertex $EDITOR(vertices) {
 	upvar #0 $vertex VERTEX
-	set VERTEX(x) [expr {$VERTEX(x) + $dx}]
-	set VERTEX(y) [expr {$VERTEX(y) + $dy}]
+	__setxy $editor $vertex \
+	    [expr {$VERTEX(x) + $dx}] [expr {$VERTEX(y) + $dy}] $idx
+	incr idx
     }
     __draw $editor
 }
@@ -1166,12 +1336,7 @@ proc ::zlineedit::get { editor type } {
 	    return $EDITOR($type)
 	}
 	"coords" {
-	    set coords [list]
-	    foreach vertex $EDITOR(vertices) {
-		upvar #0 $vertex VERTEX
-		lappend coords $VERTEX(x) $VERTEX(y)
-	    }
-	    return $coords
+	    return $EDITOR(coords)
 	}
 	"-*" {
 	    return [config $editor $type]
@@ -1223,6 +1388,9 @@ proc ::zlineedit::config { editor args } {
     }
     upvar #0 $editor EDITOR
     set result [eval ::uobj::config EDITOR "-*" $args]
+    if { [llength $args] > 1 } {
+	set EDITOR(dirty) "all"
+    }
     if { [string is false $EDITOR(-autostart)] } {
 	set EDITOR(adding) off
     }
@@ -1267,6 +1435,13 @@ proc ::zlineedit::__create { zcs coords } {
     set EDITOR(outline) "";     # Zinc outline representation id
     set EDITOR(elastic) "";     # Zinc elastic band representation id
     set EDITOR(vertices) [list]
+    set EDITOR(coords) [list];  # Packed coordinates of the vertices
+    set EDITOR(dirty) "all";    # Vertices (and indices) to redraw, or all
+    set EDITOR(reshape) 1;      # Should all coordinates be pushed?
+    set EDITOR(linestyle) "";   # Style applied to line
+    set EDITOR(outlinestyle) "";# Style applied to outline
+    set EDITOR(bindsig) "";     # Interaction state when last bound
+    set EDITOR(fresh) [list];   # Vertices inserted since last bound
     set EDITOR(callbacks) [list]
     set len [llength $coords]
     # Be smart about the coords argument of the argument list when
@@ -16,6 +16,7 @@ package require Tk
 package require Tkzinc
 
 package require uobj
+package require frameclock
 
 namespace eval ::zshader {
     variable ZSHADER
@@ -26,6 +27,7 @@ namespace eval ::zshader {
 	    -reject          ""
 	    -time            2000
 	    -period          75
+	    -rescan          500
 	    -restoreondelete on
 	    -autostart       on
 	    idgene           0
@@ -107,19 +109,63 @@ proc ::zshader::find { cs grp } {
 }
 
 
-# ::zshader::__traverse -- Traverse and gather items
+# ::zshader::__allowed -- Filter a tag
+#
+#	This procedure decides if items with a given tag should be
+#	shaded, i.e. if the tag matches one of the patterns of the
+#	-consider option, but none of the patterns of the -reject
+#	option.  Decisions are remembered per tag.
+#
+# Arguments:
+#	shader	Identifier of shader
+#	tag	Tag to decide upon
+#
+# Results:
+#	Return 1 if items with the tag should be shaded, 0 otherwise.
+#
+# Side Effects:
+#	None.
+proc ::zshader::__allowed { shader tag } {
+    upvar \#0 $shader SHADER
+
+    if { ! [info exists SHADER(filter,$tag)] } {
+	set allow 0
+	foreach ptn $SHADER(-consider) {
+	    if { [string match $ptn $tag] } {
+		set allow 1
+		break
+	    }
+	}
+	if { $allow } {
+	    foreach ptn $SHADER(-reject) {
+		if { [string match $ptn $tag] } {
+		    set allow 0
+		    break
+		}
+	    }
+	}
+	set SHADER(filter,$tag) $allow
+    }
+    return $SHADER(filter,$tag)
+}
+
+
+# ::zshader::__traverse -- Traverse and gather new items
 #
 #	This procedure traverses the group that is associated to a
-#	shader and computes the list of items that should be shaded.
-#	Items that should be shaded are those which tags match one of
-#	the patterns of the -consider option, except those which tags
-#	match one of the patterns of the -reject option.
+#	shader and computes the list of new items that should be
+#	shaded.  Items that should be shaded are those which tags
+#	match one of the patterns of the -consider option, except
+#	those which tags match one of the patterns of the -reject
+#	option.  Only Zinc items that were not seen during previous
+#	traversals are inspected.
 #
 # Arguments:
 #	shader	Identifier of shader
 #
 # Results:
-#       Return the list of matching items in the tree below the group.
+#       Return the list of matching tags in the tree below the group
+#       that are not yet known to the shader.
 #
 # Side Effects:
 #	None.
@@ -139,21 +185,16 @@ proc ::zshader::__traverse { shader } {
     foreach itm [$SHADER(canvas) find withtag $SHADER(group)] {
 	# Then recursively get all the sub items of each group item
 	foreach sub [$SHADER(canvas) find withtag .${itm}*] {
-	    # And for each of these, get their tags so that we can
-	    # match against the allowance/denial filter.
+	    # Zinc never reuses item numbers, so we only need to look
+	    # at the tags of items that we have not seen before and
+	    # match them against the allowance/denial filter.
+	    if { [info exists SHADER(seen,$sub)] } {
+		continue
+	    }
+	    set SHADER(seen,$sub) 1
 	    foreach tag [$SHADER(canvas) gettags $sub] {
-		set allow 0
-		foreach ptn $SHADER(-consider) {
-		    if { [string match $ptn $tag] } {
-			set allow 1
-		    }
-		}
-		foreach ptn $SHADER(-reject) {
-		    if { [string match $ptn $tag] } {
-			set allow 0
-		    }
-		}
-		if { $allow } {
+		if { ! [info exists SHADER(item,$tag)] \
+			 && [__allowed $shader $tag] } {
 		    lappend items $tag
 		}
 	    }
@@ -164,6 +205,31 @@ proc ::zshader::__traverse { shader } {
 }
 
 
+# ::zshader::__forget -- Forget about an item
+#
+#	This procedure removes an item that has disappeared from the
+#	canvas from the items known to a shader.
+#
+# Arguments:
+#	shader	Identifier of shader
+#	tag	Tag of the item
+#
+# Results:
+#	None.
+#
+# Side Effects:
+#	None.
+proc ::zshader::__forget { shader tag } {
+    variable log
+
+    upvar \#0 $shader SHADER
+    ${log}::debug "Item $tag has disappeared from $SHADER(canvas)"
+    unset SHADER(item,$tag)
+    set idx [lsearch -exact $SHADER(items) $tag]
+    set SHADER(items) [lreplace $SHADER(items) $idx $idx]
+}
+
+
 # ::zshader::__shadeitem -- Shade an item
 #
 #	This procedure is the core animation routine.  Depending on
@@ -171,27 +237,28 @@ proc ::zshader::__traverse { shader } {
 #	state.  When shading, the procedure performs a linear
 #	interpolation on all colorable properties of the items, so
 #	that its alpha value gradually fades to full transparency.
+#	The type, colours and original alpha values of the item are
+#	only read once per animation and the item is only
+#	reconfigured when its alpha values change.
 #
 # Arguments:
 #	shader	Identifier of a shader, as returned by ::zshader::new
 #	action	Action to perform, can be "shade" or "restore"
-#	item_a	Even list containing all information on the item (array set)
+#	tag	Tag of the item, its state is kept in the shader.
 #	now	Current time (used for alpha value linear interpolation)
 #	end	End time (used for alpha value linear interpolation)
 #
 # Results:
-#	Return the (possibly modified) item array information in the
-#	form of an even list ready for an array set command.  This
-#	procedure supposes to be able to store information in this
-#	even list for remembering information between calls.
+#	None.
 #
 # Side Effects:
-#	None.
-proc ::zshader::__shadeitem { shader action item_a { now 0 } { end -1 } } {
+#	Forgets about items that have been removed from the canvas.
+proc ::zshader::__shadeitem { shader action tag { now 0 } { end -1 } } {
     variable ZSHADER
     variable log
 
-    array set item $item_a
+    upvar \#0 $shader SHADER
+    array set item $SHADER(item,$tag)
     if { [array names item start] eq "" } { set item(start) $now }
     if { $end < $now } { set end $now }
     ${log}::debug "Shading operation: $action on $item(tag) <$now,$end>"
@@ -203,18 +270,25 @@ proc ::zshader::__shadeitem { shader action item_a { now 0 } { end -1 } } {
     }
 
     # Ask the item what type it is and decide upon which features
-    # (colors) we should try to shade.
-    set colopts [list]
-    switch [$item(canvas) type $item(tag)] {
-	"rectangle" -
-	"arc" {
-	    set colopts [list -fillcolor -linecolor]
-	}
-	"icon" {
-	    set colopts [list -color]
+    # (colors) we should try to shade.  Items that cannot be asked
+    # have been removed from the group.
+    if { [array names item colopts] eq "" } {
+	if { [catch {$item(canvas) type $item(tag)} type] } {
+	    __forget $shader $tag
+	    return
 	}
-	"curve" {
-	    set colopts [list -fillcolor -linecolor -markercolor]
+	set item(colopts) [list]
+	switch $type {
+	    "rectangle" -
+	    "arc" {
+		set item(colopts) [list -fillcolor -linecolor]
+	    }
+	    "icon" {
+		set item(colopts) [list -color]
+	    }
+	    "curve" {
+		set item(colopts) [list -fillcolor -linecolor -markercolor]
+	    }
 	}
     }
     
@@ -223,36 +297,44 @@ proc ::zshader::__shadeitem { shader action item_a { now 0 } { end -1 } } {
     # shadowing so that the item will be invisible at the end.  Catch
     # away errors to account for items that could have been removed
     # from the group.
-    if { [llength $colopts] > 0 } {
-	foreach opt $colopts {
-	    if { [catch {$item(canvas) itemcget $item(tag) $opt} gradient]==0 \
-		     && $gradient ne "" } {
-		# XXX: We only support simple color gradients,
-		# sorry...
-		foreach {c a} [split $gradient ";"] break
-		if { $a eq "" } { set a 100 }; # No alpha means fully opaque
-		if { [array names item $opt] eq "" } {
-		    set item($opt) $a
-		}
-		
-		if { $action eq "shade" } {
-		    if { $now >= $end } {
-			set alpha 0
-		    } else {
-			set factor \
-			    [expr {double($now-$item(start))/ \
-				       ($end-$item(start))}]
-			set alpha \
-			    [expr {round($item($opt) - $item($opt)*$factor)}]
-			if { $alpha > 100 } { set alpha 100 }
-			if { $alpha < 0 } { set alpha 0 }
-		    }
-		} else {
-		    set alpha $item($opt)
-		}
-		
-		$item(canvas) itemconfigure $item(tag) $opt "${c};${alpha}"
+    foreach opt $item(colopts) {
+	if { [array names item $opt] eq "" } {
+	    if { [catch {$item(canvas) itemcget $item(tag) $opt} gradient] \
+		     || $gradient eq "" } {
+		continue
 	    }
+	    # XXX: We only support simple color gradients,
+	    # sorry...
+	    foreach {c a} [split $gradient ";"] break
+	    if { $a eq "" } { set a 100 }; # No alpha means fully opaque
+	    set item($opt) $a
+	    set item(color$opt) $c
+	}
+
+	if { $action eq "shade" } {
+	    if { $now >= $end } {
+		set alpha 0
+	    } else {
+		set factor \
+		    [expr {double($now-$item(start))/ \
+			       ($end-$item(start))}]
+		set alpha \
+		    [expr {round($item($opt) - $item($opt)*$factor)}]
+		if { $alpha > 100 } { set alpha 100 }
+		if { $alpha < 0 } { set alpha 0 }
+	    }
+	} else {
+	    set alpha $item($opt)
+	}
+
+	if { [array names item alpha$opt] ne "" && $item(alpha$opt) == $alpha } {
+	    continue
+	}
+	set item(alpha$opt) $alpha
+	if { [catch {$item(canvas) itemconfigure $item(tag) $opt \
+			 "$item(color$opt);${alpha}"}] } {
+	    __forget $shader $tag
+	    return
 	}
     }
 
@@ -261,12 +343,12 @@ proc ::zshader::__shadeitem { shader action item_a { now 0 } { end -1 } } {
     if { $action eq "restore" } {
 	unset item(start)
 	foreach opt [array names item -*] {
-	    unset item($opt)
+	    unset item($opt) item(color$opt)
 	}
+	array unset item alpha-*
     }
 
-    # Returned (modified) item
-    return [array get item]
+    set SHADER(item,$tag) [array get item]
 }
 
 
@@ -276,9 +358,10 @@ proc ::zshader::__shadeitem { shader action item_a { now 0 } { end -1 } } {
 #	be animated (shaded) and regularily schedules itself to
 #	perform the shading animation if necessary.  The procedure
 #	attempts to account for new items that could be added to the
-#	original shader Zinc group under the time of an animation.
-#	Typically, these items will be shaded quicker than those that
-#	were present from the start.
+#	original shader Zinc group under the time of an animation,
+#	looking for these every -rescan milliseconds.  Typically,
+#	these items will be shaded quicker than those that were
+#	present from the start.
 #
 # Arguments:
 #	shader	Identifier of a shader, as returned by ::zshader::new
@@ -301,56 +384,44 @@ proc ::zshader::__shade { shader } {
 
     upvar \#0 $shader SHADER
 
-    # Take care of time issues.  Remember what time it is, and
-    # initialises the shader to remember when we started and when we
-    # should stop.
-    set now [clock clicks -milliseconds]
+    # Take care of time issues.  Remember what time it is (the time of
+    # the current frame), and initialises the shader to remember when
+    # we started and when we should stop.
+    set now [::frameclock::now]
     if { $SHADER(start) eq "" } {
 	set SHADER(start) $now
     }
     set end [expr {$SHADER(start) + $SHADER(-time)}]
 
-    # Traverse the group according to the traversal options at this
-    # time and remember all new items that we have discovered since
-    # the shader was last run.  This algorithm will not remove items
-    # from the list of known items.
-    set grpitems [__traverse $shader]
-    foreach itm $grpitems {
-	# Look in known items for one that has the same tag.
-	set found 0
-	foreach i $SHADER(items) {
-	    array set olditem $i
-	    if { $olditem(tag) eq $itm } {
-		set found 1
-		break
-	    }
-	}
-	# If we had not any item with the same tag, then this one is
-	# new and we initialise it and remember it.
-	if { ! $found } {
-	    set newitem(tag) $itm
-	    set newitem(canvas) $SHADER(canvas)
-	    lappend SHADER(items) [array get newitem]
+    # Traverse the group according to the traversal options, at most
+    # every -rescan ms, and remember all new items that we have
+    # discovered since the group was last traversed.  This algorithm
+    # will only remove items from the list of known items once they
+    # have disappeared from the canvas.
+    if { $SHADER(scanned) eq "" || $now - $SHADER(scanned) >= $SHADER(-rescan) } {
+	set SHADER(scanned) $now
+	foreach itm [__traverse $shader] {
+	    set SHADER(item,$itm) [list tag $itm canvas $SHADER(canvas)]
+	    lappend SHADER(items) $itm
 	    __trigger $shader ItemNew $itm
 	}
     }
 
     # Now we can start reasoning about how to shade all these items.
     # We will act through the alpha channel only.
-    set newitems [list]
     foreach itm $SHADER(items) {
-	lappend newitems [__shadeitem $shader shade $itm $now $end]
+	__shadeitem $shader shade $itm $now $end
     }
-    set SHADER(items) $newitems
 
-    # Reschedule a new shading loop
+    # Reschedule a new shading loop on the shared animation clock
     if { $now <= $end } {
-	set SHADER(next) [after $SHADER(-period) ::zshader::__shade $shader]
+	set SHADER(next) \
+	    [::frameclock::schedule $SHADER(-period) ::zshader::__shade $shader]
     } else {
 	set SHADER(next) ""
     }
 
-    return $grpitems
+    return $SHADER(items)
 }
 
 
@@ -395,12 +466,7 @@ proc ::zshader::get { shader type } {
 	    return $SHADER($type)
 	}
 	"items" {
-	    set items [list]
-	    foreach itm $SHADER(items) {
-		array set $itm item
-		lappend items $item(tag)
-	    }
-	    return $items
+	    return $SHADER(items)
 	}
 	"-*" {
 	    return [config $shader $type]
@@ -421,8 +487,10 @@ proc ::zshader::get { shader type } {
 #	not be considered for shading.  -time is the time (in
 #	milliseconds) of the shading animation.  -period is the
 #	frequency of the animation, it should be much less than the
-#	animation time.  -restoreondelete will restore the items to
-#	their original shape on deletion.
+#	animation time.  -rescan is the number of milliseconds between
+#	two traversals of the group for new items during the
+#	animation.  -restoreondelete will restore the items to their
+#	original shape on deletion.
 #
 # Arguments:
 #	shader	Identifier of the shader, as returned by ::zshader::new.
@@ -451,13 +519,20 @@ proc ::zshader::config { shader args } {
     upvar \#0 $shader SHADER
     set result [eval ::uobj::config SHADER "-*" $args]
     
+    # Filtering decisions depend on the options, forget them and
+    # traverse the whole group again.
+    if { [llength $args] > 1 } {
+	array unset SHADER filter,*
+	array unset SHADER seen,*
+	set SHADER(scanned) ""
+    }
 
     if { [string is true $SHADER(-autostart)] } {
 	if { $SHADER(next) ne "" } {
-	    after cancel $SHADER(next)
+	    ::frameclock::cancel $SHADER(next)
 	    set SHADER(next) ""
 	}
-	set SHADER(next) [after idle ::zshader::__shade $shader]
+	set SHADER(next) [::frameclock::schedule 0 ::zshader::__shade $shader]
     }
 
     # XXX: When Zinc is able to register events on items other that
@@ -498,7 +573,8 @@ proc ::zshader::new { cs grp args } {
 	set SHADER(group) $grp
 	set SHADER(id) $shader
 	set SHADER(start) ""
-	set SHADER(items) [list]
+	set SHADER(items) [list];   # Tags of known items, in discovery order
+	set SHADER(scanned) "";     # Time of last traversal
 	set SHADER(next) ""
 	set SHADER(callbacks) [list]
 	lappend ZSHADER(shaders) $shader
@@ -538,15 +614,13 @@ proc ::zshader::restore { shader } {
 
     upvar \#0 $shader SHADER
     if { $SHADER(next) ne "" } {
-	after cancel $SHADER(next)
+	::frameclock::cancel $SHADER(next)
 	set SHADER(next) ""
     }
     
-    set newitems [list]
     foreach itm $SHADER(items) {
-	lappend newitems [__shadeitem $shader restore $itm]
+	__shadeitem $shader restore $itm
     }
-    set SHADER(items) $newitems
     set SHADER(start) ""
 }
 